@@ -0,0 +1,221 @@
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util/cache-protocol.hh"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+/// The directory where cached content is stored
+fs::path store;
+
+/// Read exactly len bytes from a client
+bool recv_all(int fd, void* data, size_t len) {
+  auto p = static_cast<uint8_t*>(data);
+  while (len > 0) {
+    ssize_t rc = recv(fd, p, len, 0);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+    p += rc;
+    len -= rc;
+  }
+  return true;
+}
+
+/// Send an entire buffer to a client
+bool send_all(int fd, const void* data, size_t len) {
+  auto p = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    ssize_t rc = send(fd, p, len, MSG_NOSIGNAL);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+    p += rc;
+    len -= rc;
+  }
+  return true;
+}
+
+/// Get the path to the file holding content with a given hash. Uses the same layout as .rkr/cache
+fs::path hash_path(const uint8_t* hash) {
+  char hex[CACHE_HASH_LEN * 2 + 1];
+  for (int i = 0; i < CACHE_HASH_LEN; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", hash[i]);
+  }
+  string h(hex);
+  return store / h.substr(0, 2) / h.substr(2, 2) / h.substr(4, 2) / h;
+}
+
+/// Answer a batched existence check
+bool handle_has(int fd) {
+  uint32_t count;
+  if (!recv_all(fd, &count, sizeof(count)) || count > CACHE_MAX_BATCH) return false;
+
+  vector<uint8_t> status(count);
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t hash[CACHE_HASH_LEN];
+    if (!recv_all(fd, hash, sizeof(hash))) return false;
+    status[i] = access(hash_path(hash).c_str(), R_OK) == 0 ? CACHE_PRESENT : CACHE_MISSING;
+  }
+
+  return send_all(fd, status.data(), status.size());
+}
+
+/// Stream cached content to a client
+bool handle_get(int fd) {
+  uint8_t hash[CACHE_HASH_LEN];
+  if (!recv_all(fd, hash, sizeof(hash))) return false;
+
+  int file = open(hash_path(hash).c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat statbuf;
+  if (file < 0 || fstat(file, &statbuf)) {
+    if (file >= 0) close(file);
+    uint8_t status = CACHE_MISSING;
+    return send_all(fd, &status, sizeof(status));
+  }
+
+  uint8_t status = CACHE_PRESENT;
+  uint64_t len = statbuf.st_size;
+  bool ok = send_all(fd, &status, sizeof(status)) && send_all(fd, &len, sizeof(len));
+
+  off_t offset = 0;
+  while (ok && (uint64_t)offset < len) {
+    ssize_t rc = sendfile(fd, file, &offset, len - offset);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) ok = false;
+  }
+
+  close(file);
+  return ok;
+}
+
+/// Store content streamed from a client
+bool handle_put(int fd) {
+  uint8_t hash[CACHE_HASH_LEN];
+  uint64_t len;
+  if (!recv_all(fd, hash, sizeof(hash)) || !recv_all(fd, &len, sizeof(len))) return false;
+
+  // Stream into a temporary file, then rename it into place so readers never see partial content
+  auto dest = hash_path(hash);
+  auto tmp = dest;
+  tmp += "." + std::to_string(getpid());
+
+  std::error_code ec;
+  fs::create_directories(dest.parent_path(), ec);
+  int file = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  bool written = file >= 0;
+  char buf[CACHE_CHUNK_SIZE];
+  while (len > 0) {
+    size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+    if (!recv_all(fd, buf, chunk)) {
+      if (file >= 0) close(file);
+      unlink(tmp.c_str());
+      return false;
+    }
+    if (written && write(file, buf, chunk) != (ssize_t)chunk) written = false;
+    len -= chunk;
+  }
+
+  if (file >= 0) close(file);
+
+  uint8_t status = CACHE_ERROR;
+  if (written && rename(tmp.c_str(), dest.c_str()) == 0) {
+    status = CACHE_PRESENT;
+  } else {
+    unlink(tmp.c_str());
+  }
+
+  return send_all(fd, &status, sizeof(status));
+}
+
+/// Serve requests on a connection until the client disconnects
+void serve(int fd) {
+  uint8_t op;
+  while (recv_all(fd, &op, sizeof(op))) {
+    bool ok = false;
+    if (op == CACHE_OP_HAS) {
+      ok = handle_has(fd);
+    } else if (op == CACHE_OP_GET) {
+      ok = handle_get(fd);
+    } else if (op == CACHE_OP_PUT) {
+      ok = handle_put(fd);
+    } else {
+      fprintf(stderr, "rkr-cache-server: unknown request %d\n", op);
+    }
+
+    if (!ok) break;
+  }
+  close(fd);
+}
+
+/**
+ * A minimal cache daemon for Riker's remote cache protocol. Content is stored in a local directory
+ * using the same layout as .rkr/cache. This is meant for testing and as a starting point for a
+ * daemon that forwards requests to a shared build cache.
+ */
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <socket path> <storage directory>\n", argv[0]);
+    return 2;
+  }
+
+  store = argv[2];
+  std::error_code ec;
+  fs::create_directories(store, ec);
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", argv[1]);
+    return 1;
+  }
+  strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    perror("Failed to create socket");
+    return 1;
+  }
+
+  unlink(argv[1]);
+  if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(sock, 16)) {
+    perror("Failed to listen on socket");
+    return 1;
+  }
+
+  // Serve each client in its own process, and don't leave zombies behind
+  signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      perror("Failed to accept connection");
+      return 1;
+    }
+
+    if (fork() == 0) {
+      close(sock);
+      serve(fd);
+      exit(0);
+    }
+
+    close(fd);
+  }
+}
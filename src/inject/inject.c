@@ -444,6 +444,9 @@ uint64_t channel_buffer_argv(size_t c, char* const* argv) {
     for (size_t i = 0; i < count; i++) {
       buffered_argv[i] = channel_buffer_string(c, argv[i]);
     }
+
+    // Return the special tracing channel buffer pointer to the buffered array
+    return TRACING_CHANNEL_BUFFER_PTR + pos;
   }
 
   // The array won't fit. Just return the existing pointer.
@@ -660,6 +663,18 @@ int execve_untraced(const char* pathname, char* const* argv, char* const* envp)
   }
 }
 
+/// Allow the parallel compiler wrapper to talk to a jobserver without being traced
+long syscall_untraced(long nr, long a1, long a2, long a3, long a4, long a5, long a6) {
+  long rc = safe_syscall(nr, a1, a2, a3, a4, a5, a6);
+
+  if (rc < 0) {
+    errno = -rc;
+    return -1;
+  } else {
+    return rc;
+  }
+}
+
 // Include architecture-specific register names
 #if defined(__x86_64__) || defined(_M_X64)
 
@@ -13,6 +13,7 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "util/stats.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
@@ -223,6 +224,8 @@ void Artifact::commitContent() noexcept {
   // If this artifact's content is fully committed, stop immediately
   if (!hasUncommittedContent()) return;
 
+  ScopedTimer timer(Timer::Commit);
+
   // Get a committed path to this artifact, possibly by committing links above it in the path
   auto path = commitPath();
   if (path.has_value()) {
@@ -236,6 +239,8 @@ void Artifact::commitMetadata() noexcept {
   // If metadata is already committed, there's nothing to do
   if (_metadata.isCommitted()) return;
 
+  ScopedTimer timer(Timer::Commit);
+
   // Get a committed path to this artifact, possibly by committing links above it in the path
   auto path = commitPath();
   ASSERT(path.has_value()) << "Committing metadata to an artifact with no path";
@@ -8,6 +8,7 @@
 #include "artifacts/DirArtifact.hh"
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
+#include "runtime/env.hh"
 #include "runtime/policy.hh"
 #include "util/log.hh"
 #include "util/options.hh"
@@ -46,7 +47,7 @@ void FileArtifact::commitContentTo(fs::path path) noexcept {
     ASSERT(version->canCommit()) << "Cannot commit content to " << path << ": " << _content;
 
     // Commit the uncommitted content only
-    version->commit(path);
+    writeContent(version, path, 0);
 
   } else {
     // No committed content yet. Commit metadata along with the content
@@ -56,7 +57,7 @@ void FileArtifact::commitContentTo(fs::path path) noexcept {
     // Commit the content with initial metadata
     auto [version, writer] = _content.getLatest();
     auto [metadata_version, _] = _metadata.getLatest();
-    version->commit(path, metadata_version->getMode());
+    writeContent(version, path, metadata_version->getMode());
     _metadata.setCommitted();
   }
 
@@ -77,6 +78,9 @@ void FileArtifact::commitLink(shared_ptr<DirEntry> entry) noexcept {
   auto dir_path = maybe_dir_path.value();
   auto new_path = dir_path / entry->getName();
 
+  // Any queued write to this file has to land before it can be moved or linked
+  finishCommit();
+
   // Committing a new path to this artifact has three cases:
   // 1. The file has a temporary path. Move it into place
   // 2. The file has an existing committed path. Create a hard link
@@ -119,6 +123,9 @@ void FileArtifact::commitUnlink(shared_ptr<DirEntry> entry) noexcept {
   auto dir_path = maybe_dir_path.value();
   auto unlink_path = dir_path / entry->getName();
 
+  // Any queued write to this file has to land before it can be moved or removed
+  finishCommit();
+
   // Committing an unlink of a file has two cases:
   // 1. There are uncommitted links, but no other committed links. Move to a temporary path.
   // 2. Otherwise just unlink
@@ -145,40 +152,56 @@ void FileArtifact::commitUnlink(shared_ptr<DirEntry> entry) noexcept {
 void FileArtifact::checkFinalState(fs::path path) noexcept {
   // Get the command that wrote this file. If there was no writer, no need to check
   auto [version, weak_creator] = _content.getLatest();
-  auto creator = weak_creator.lock();
-  if (!creator) return;
+  if (!weak_creator.lock()) return;
 
-  // Is there an uncommitted update to this file?
-  if (_content.isUncommitted()) {
-    // Get the committed state
-    auto [committed_version, committed_creator] = _content.getCommitted();
+  // The comparison is queued if env::checkFinalState is running. Otherwise, do it now.
+  if (env::queueCheck(as<FileArtifact>(), path)) return;
 
-    // Does the uncommitted version match what's on the filesystem?
-    bool matches = version->matches(committed_version);
+  finishCheck(compareFinalState(path));
+  fingerprintAndCache(nullptr);
+}
 
-    // If there was no match, try again with a fingerprint
-    if (!matches && committed_version) {
-      auto fingerprint_type =
-          policy::chooseFingerprintType(nullptr, committed_creator.lock(), path);
-      committed_version->fingerprint(path, fingerprint_type);
-      matches = version->matches(committed_version);
-    }
+/// Compare the latest content version to the committed version on disk
+bool FileArtifact::compareFinalState(fs::path path) noexcept {
+  // If there is no uncommitted update to this file, there is nothing to compare
+  if (_content.isCommitted()) return true;
 
-    // Were we able to find a match?
-    if (matches) {
-      // Yes. We can treat the content as committed now
-      _content.setCommitted();
+  // Get the uncommitted and committed state
+  auto [version, weak_creator] = _content.getLatest();
+  auto [committed_version, committed_creator] = _content.getCommitted();
 
-      // TODO: What happens if the artifact has no committed links? That shouldn't happen because we
-      // need a link to reach this function.
+  // Does the uncommitted version match what's on the filesystem?
+  bool matches = version->matches(committed_version);
 
-    } else {
-      // No. The creating command has to rerun.
-      creator->outputChanged(shared_from_this(), committed_version, version);
-    }
+  // If there was no match, try again with a fingerprint
+  if (!matches && committed_version) {
+    auto fingerprint_type = policy::chooseFingerprintType(nullptr, committed_creator.lock(), path);
+    committed_version->fingerprint(path, fingerprint_type);
+    matches = version->matches(committed_version);
   }
 
-  fingerprintAndCache(nullptr);
+  return matches;
+}
+
+/// Apply the result of compareFinalState
+void FileArtifact::finishCheck(bool matches) noexcept {
+  if (_content.isCommitted()) return;
+
+  auto [version, weak_creator] = _content.getLatest();
+  auto [committed_version, committed_creator] = _content.getCommitted();
+
+  // Were we able to find a match?
+  if (matches) {
+    // Yes. We can treat the content as committed now
+    _content.setCommitted();
+
+    // TODO: What happens if the artifact has no committed links? That shouldn't happen because we
+    // need a link to reach this function.
+
+  } else {
+    // No. The creating command has to rerun.
+    weak_creator.lock()->outputChanged(shared_from_this(), committed_version, version);
+  }
 }
 
 /// Commit any pending versions and save fingerprints for this artifact
@@ -198,14 +221,32 @@ void FileArtifact::applyFinalState(fs::path path) noexcept {
 
     } else {
       // No. Commit now
-      version->commit(path);
+      writeContent(version, path, 0);
       _content.setCommitted();
     }
   }
 
-  // If we don't already have a content fingerprint, take one
-  auto fingerprint_type = policy::chooseFingerprintType(nullptr, creator, path);
-  version->fingerprint(path, fingerprint_type);
+  // Fingerprinting and caching read the committed content, so they are queued behind its write
+  if (env::queueCommit(as<FileArtifact>())) {
+    _queued_final_state = path;
+  } else {
+    finishFinalState(path);
+  }
+}
+
+/// Fingerprint and cache the committed content, and commit metadata
+void FileArtifact::finishFinalState(fs::path path) noexcept {
+  auto [version, weak_creator] = _content.getLatest();
+  auto creator = weak_creator.lock();
+
+  // If we don't already have a content fingerprint, take one. Uncached outputs are only hashed
+  // when a later comparison needs the hash.
+  if (policy::canDeferFingerprint(nullptr, creator, path)) {
+    version->deferFingerprint(path);
+  } else {
+    auto fingerprint_type = policy::chooseFingerprintType(nullptr, creator, path);
+    version->fingerprint(path, fingerprint_type);
+  }
 
   // Cache the contents
   if (policy::isCacheable(nullptr, creator, path)) {
@@ -216,6 +257,35 @@ void FileArtifact::applyFinalState(fs::path path) noexcept {
   Artifact::applyFinalState(path);
 }
 
+/// Write a content version to a path, or queue the write if env::commitAll is running
+void FileArtifact::writeContent(shared_ptr<FileVersion> version,
+                                fs::path path,
+                                mode_t mode) noexcept {
+  // Earlier queued work on this file must land first
+  finishCommit();
+
+  if (env::queueCommit(as<FileArtifact>())) {
+    _queued_write.emplace(std::move(version), std::move(path), mode);
+  } else {
+    version->commit(path, mode);
+  }
+}
+
+/// Run any content write and final state queued for this file during env::commitAll
+void FileArtifact::finishCommit() noexcept {
+  if (_queued_write.has_value()) {
+    auto [version, path, mode] = std::move(_queued_write.value());
+    _queued_write.reset();
+    version->commit(path, mode);
+  }
+
+  if (_queued_final_state.has_value()) {
+    auto path = std::move(_queued_final_state.value());
+    _queued_final_state.reset();
+    finishFinalState(path);
+  }
+}
+
 /// Fingerprint and cache the committed state of this artifact
 void FileArtifact::cacheAll(fs::path path) const noexcept {
   fingerprintAndCache(nullptr);
@@ -259,6 +329,11 @@ void FileArtifact::beforeWrite(Build& build,
                                Ref::ID ref) noexcept {
   // The command now depends on the content of this file
   build.matchContent(source, c, Scenario::Build, ref, getContent(c));
+
+  // The on-disk version is about to be overwritten, so take its hash if it was deferred. Hashes
+  // for outputs of commands marked to run were already taken by env::resolvePendingHashes, so this
+  // only hashes a file while the tracee waits when some other command overwrites it.
+  resolvePendingHash();
 }
 
 /// A traced command just wrote to this artifact
@@ -278,7 +353,9 @@ void FileArtifact::beforeTruncate(Build& build,
                                   const IRSource& source,
                                   const shared_ptr<Command>& c,
                                   Ref::ID ref) noexcept {
-  // Do nothing before a truncate
+  // The on-disk version is about to be discarded, so take its hash if it was deferred. See
+  // beforeWrite.
+  resolvePendingHash();
 }
 
 /// A trace command just truncated this artifact to length 0
@@ -369,6 +446,12 @@ void FileArtifact::fingerprintAndCache(const shared_ptr<Command>& reader) const
 
   // If the artifact has a committed path, we may fingerprint or cache it
   if (path.has_value()) {
+    // Outputs that are not cached are only hashed when a later comparison needs the hash
+    if (policy::canDeferFingerprint(reader, writer, path.value())) {
+      version->deferFingerprint(path.value());
+      return;
+    }
+
     auto fingerprint_type = policy::chooseFingerprintType(reader, writer, path.value());
     version->fingerprint(path.value(), fingerprint_type);
 
@@ -378,3 +461,23 @@ void FileArtifact::fingerprintAndCache(const shared_ptr<Command>& reader) const
     }
   }
 }
+
+bool FileArtifact::needsPendingHash() const noexcept {
+  if (!_content.isCommitted()) return false;
+
+  auto [version, weak_writer] = _content.getLatest();
+  if (!version->hasPendingHash()) return false;
+
+  auto writer = weak_writer.lock();
+  return writer && (writer->mustRun() || writer->mayRun());
+}
+
+void FileArtifact::resolvePendingHash() const noexcept {
+  if (!_content.isCommitted()) return;
+
+  auto [version, weak_writer] = _content.getLatest();
+  if (!version->hasPendingHash()) return;
+
+  auto path = getCommittedPath();
+  if (path.has_value()) version->resolvePendingHash(path.value());
+}
@@ -4,6 +4,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <tuple>
 
 #include "artifacts/Artifact.hh"
 #include "runtime/Ref.hh"
@@ -51,6 +52,27 @@ class FileArtifact : public Artifact {
   /// Fingerprint and cache the committed state of this artifact
   virtual void cacheAll(fs::path path) const noexcept override;
 
+  /// Run the content write and final state queued for this file while env::commitAll committed
+  /// directories and links. Files with no queued work are unchanged.
+  void finishCommit() noexcept;
+
+  /// Is the committed version's hash deferred, and is its writer marked to run again? That writer
+  /// may overwrite the file, so its hash should be taken before the command starts.
+  bool needsPendingHash() const noexcept;
+
+  /// Take the hash of the committed version if it was deferred and the file still holds it. This
+  /// only touches this artifact's versions, so it may run on a worker.
+  void resolvePendingHash() const noexcept;
+
+  /// Compare the latest content version to the on-disk state at path, fingerprinting the on-disk
+  /// version if needed. This only touches this artifact's versions, so it may run on a worker.
+  /// Returns true if the versions match.
+  bool compareFinalState(fs::path path) noexcept;
+
+  /// Apply the result of compareFinalState, either committing the latest version or reporting a
+  /// changed output to its creator
+  void finishCheck(bool matches) noexcept;
+
   /// Revert this artifact to its committed state
   virtual void rollback() noexcept override;
 
@@ -125,9 +147,22 @@ class FileArtifact : public Artifact {
   /// Cache and fingerprint this file's content if necessary
   void fingerprintAndCache(const std::shared_ptr<Command>& reader) const noexcept;
 
+ private:
+  /// Write a content version to a path, or queue the write if env::commitAll is running
+  void writeContent(std::shared_ptr<FileVersion> version, fs::path path, mode_t mode) noexcept;
+
+  /// Fingerprint and cache the committed content at path, and commit its metadata
+  void finishFinalState(fs::path path) noexcept;
+
  private:
   /// The committed and uncommitted state that represent this file's content
   VersionState<FileVersion> _content;
+
+  /// Transient: a content write queued by env::commitAll, with its path and mode
+  std::optional<std::tuple<std::shared_ptr<FileVersion>, fs::path, mode_t>> _queued_write;
+
+  /// Transient: the path to apply final state at once the queued write is done
+  std::optional<fs::path> _queued_final_state;
 };
 
 template <>
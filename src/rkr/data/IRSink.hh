@@ -53,7 +53,7 @@ class IRSink {
   /// Handle a SymlinkRef IR step
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& command,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept {}
 
   /// Handle a DirRef IR step
@@ -66,7 +66,7 @@ class IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& command,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept {}
 
@@ -99,46 +99,46 @@ class IRSink {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion version) noexcept {}
+                             const MetadataVersion& version) noexcept {}
 
   /// Handel a MatchContent IR step
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> version) noexcept {}
+                            const std::shared_ptr<ContentVersion>& version) noexcept {}
 
   /// Handle an UpdateMetadata IR step
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion version) noexcept {}
+                              const MetadataVersion& version) noexcept {}
 
   /// Handle an UpdateContent IR step
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> version) noexcept {}
+                             const std::shared_ptr<ContentVersion>& version) noexcept {}
 
   /// Handle an AddEntry IR step
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept {}
 
   /// Handle a RemoveEntry IR step
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept {}
 
   /// Handle a Launch IR step
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& command,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept {}
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept {}
 
   /// Handle a Join IR step
   virtual void join(const IRSource& source,
@@ -149,5 +149,6 @@ class IRSink {
   /// Handle an Exit IR step
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& command,
-                    int exit_status) noexcept {}
+                    int exit_status,
+                    const Command::Usage& usage) noexcept {}
 };
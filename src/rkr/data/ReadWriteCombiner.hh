@@ -40,7 +40,7 @@ class MetadataReadCombiner : public Next {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     // Post-build checks should be emitted as-is
     if (scenario & Scenario::PostBuild) {
       Next::matchMetadata(source, command, scenario, ref, expected);
@@ -64,7 +64,7 @@ class MetadataReadCombiner : public Next {
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion writing) noexcept override {
+                              const MetadataVersion& writing) noexcept override {
     // Clear the last read
     _last_reader.reset();
     _last_ref = -1;
@@ -89,7 +89,7 @@ class MetadataWriteCombiner : public Next {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     // Does this read match the last write?
     if (command == _last_writer && ref == _last_ref) {
       // Yes. We can skip the read, since it's just reading the last write.
@@ -113,7 +113,7 @@ class MetadataWriteCombiner : public Next {
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion writing) noexcept override {
+                              const MetadataVersion& writing) noexcept override {
     // We can coalesce this new write with the previous write if the command and reference are the
     // same and the last write has not been accessed
     if (command == _last_writer && ref == _last_ref && !_accessed) {
@@ -143,14 +143,15 @@ class MetadataWriteCombiner : public Next {
    */
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& command,
-                    int exit_status) noexcept override {
+                    int exit_status,
+                    const Command::Usage& usage) noexcept override {
     // If the last write hasn't been emitted and the exiting command performed that write, emit it
     if (!_emitted && _last_writer == command) {
       Next::updateMetadata(source, _last_writer, _last_ref, _last_written.value());
       _emitted = true;
     }
 
-    Next::exit(source, command, exit_status);
+    Next::exit(source, command, exit_status, usage);
   }
 
  private:
@@ -178,7 +179,7 @@ class ContentReadCombiner : public Next {
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     if (scenario & Scenario::PostBuild) {
       Next::matchContent(source, command, scenario, ref, expected);
       return;
@@ -201,7 +202,7 @@ class ContentReadCombiner : public Next {
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> writing) noexcept override {
+                             const std::shared_ptr<ContentVersion>& writing) noexcept override {
     // Clear the last read
     _last_reader.reset();
     _last_ref = -1;
@@ -231,7 +232,7 @@ class ContentWriteCombiner : public Next {
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     // Does this read match the last write?
     if (command == _last_writer && ref == _last_ref) {
       // Yes. We can skip the read, since it's just reading the last write.
@@ -261,7 +262,7 @@ class ContentWriteCombiner : public Next {
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> writing) noexcept override {
+                             const std::shared_ptr<ContentVersion>& writing) noexcept override {
     // We can coalesce this new write with the previous write if the command and reference are the
     // same, the last write has not been accessed, and the specific versions allow coalescing
     if (command == _last_writer && ref == _last_ref && !_accessed &&
@@ -292,14 +293,15 @@ class ContentWriteCombiner : public Next {
    */
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& command,
-                    int exit_status) noexcept override {
+                    int exit_status,
+                    const Command::Usage& usage) noexcept override {
     // If the last write hasn't been emitted and the exiting command performed that write, emit it
     if (!_emitted && _last_writer == command) {
       Next::updateContent(source, _last_writer, _last_ref, _last_written);
       _emitted = true;
     }
 
-    Next::exit(source, command, exit_status);
+    Next::exit(source, command, exit_status, usage);
   }
 
  private:
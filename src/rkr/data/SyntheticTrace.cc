@@ -0,0 +1,124 @@
+#include "SyntheticTrace.hh"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "data/AccessFlags.hh"
+#include "data/IRSink.hh"
+#include "runtime/Command.hh"
+#include "runtime/Ref.hh"
+#include "versions/FileVersion.hh"
+#include "versions/MetadataVersion.hh"
+
+using std::list;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::tuple;
+using std::vector;
+
+void SyntheticTrace::sendTo(IRSink& handler) noexcept {
+  auto root = make_shared<Command>();
+  handler.start(root);
+
+  // Set up the same special references as the default trace
+  handler.specialRef(*this, root, SpecialRef::stdin, Ref::Stdin);
+  handler.usingRef(*this, root, Ref::Stdin);
+  handler.specialRef(*this, root, SpecialRef::stdout, Ref::Stdout);
+  handler.usingRef(*this, root, Ref::Stdout);
+  handler.specialRef(*this, root, SpecialRef::stderr, Ref::Stderr);
+  handler.usingRef(*this, root, Ref::Stderr);
+  handler.specialRef(*this, root, SpecialRef::root, Ref::Root);
+  handler.usingRef(*this, root, Ref::Root);
+  handler.specialRef(*this, root, SpecialRef::cwd, Ref::Cwd);
+  handler.usingRef(*this, root, Ref::Cwd);
+  handler.specialRef(*this, root, SpecialRef::launch_exe, Ref::Exe);
+  handler.usingRef(*this, root, Ref::Exe);
+
+  // Every command inherits the special references unchanged
+  list<tuple<Ref::ID, Ref::ID>> refs = {{Ref::Stdin, Ref::Stdin},   {Ref::Stdout, Ref::Stdout},
+                                        {Ref::Stderr, Ref::Stderr}, {Ref::Root, Ref::Root},
+                                        {Ref::Cwd, Ref::Cwd},       {Ref::Exe, Ref::Exe}};
+
+  // Create a command that has already run, with the standard file descriptors
+  auto make_command = [](vector<string> args) {
+    auto c = make_shared<Command>(args);
+    c->setExecuted();
+    c->addInitialFD(STDIN_FILENO, Ref::Stdin);
+    c->addInitialFD(STDOUT_FILENO, Ref::Stdout);
+    c->addInitialFD(STDERR_FILENO, Ref::Stderr);
+    return c;
+  };
+
+  // Launch the command that stands in for the Rikerfile
+  auto driver = make_command({"rkr-launch"});
+  handler.launch(*this, root, driver, refs);
+
+  AccessFlags read_flags;
+  read_flags.r = true;
+
+  AccessFlags write_flags;
+  write_flags.w = true;
+  write_flags.create = true;
+  write_flags.truncate = true;
+  write_flags.type = AccessType::file();
+  write_flags.mode = 0644;
+
+  MetadataVersion file_metadata(getuid(), getgid(), S_IFREG | 0644);
+
+  // Write a file through a new reference and return the version that was written
+  auto write_file = [&](const shared_ptr<Command>& c, Ref::ID ref, string name) {
+    auto written = make_shared<FileVersion>();
+    handler.pathRef(*this, c, Ref::Cwd, name, write_flags, ref);
+    handler.expectResult(*this, c, Scenario::Build, ref, SUCCESS);
+    handler.usingRef(*this, c, ref);
+    handler.updateContent(*this, c, ref, written);
+    handler.doneWithRef(*this, c, ref);
+    return written;
+  };
+
+  // One command creates all of the shared inputs
+  auto generator = make_command({"generate"});
+  handler.launch(*this, driver, generator, refs);
+
+  vector<shared_ptr<ContentVersion>> inputs;
+  for (size_t i = 0; i < _inputs; i++) {
+    inputs.push_back(write_file(generator, Ref::ReservedRefs + i, "input" + to_string(i) + ".h"));
+  }
+
+  handler.exit(*this, generator, 0, {});
+  handler.join(*this, driver, generator, 0);
+
+  // Every other command reads all of the inputs and writes one output
+  for (size_t i = 0; i < _commands; i++) {
+    auto c = make_command({"compile", "output" + to_string(i) + ".o"});
+    handler.launch(*this, driver, c, refs);
+
+    for (size_t j = 0; j < _inputs; j++) {
+      Ref::ID ref = Ref::ReservedRefs + j;
+      handler.pathRef(*this, c, Ref::Cwd, "input" + to_string(j) + ".h", read_flags, ref);
+      handler.expectResult(*this, c, Scenario::Build, ref, SUCCESS);
+      handler.usingRef(*this, c, ref);
+      handler.matchMetadata(*this, c, Scenario::Build, ref, file_metadata);
+      handler.matchContent(*this, c, Scenario::Build, ref, inputs[j]);
+      handler.doneWithRef(*this, c, ref);
+    }
+
+    write_file(c, Ref::ReservedRefs + _inputs, "output" + to_string(i) + ".o");
+
+    handler.exit(*this, c, 0, {});
+    handler.join(*this, driver, c, 0);
+  }
+
+  handler.exit(*this, driver, 0, {});
+  handler.join(*this, root, driver, 0);
+
+  handler.finish();
+}
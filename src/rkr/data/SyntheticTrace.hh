@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "data/IRSource.hh"
+
+class Command;
+class IRSink;
+
+/**
+ * A SyntheticTrace generates a build trace with a configurable shape, for benchmarking the trace
+ * handling code without a real project. One command creates a set of shared inputs, and every
+ * other command reads all of those inputs and writes a single output of its own.
+ */
+class SyntheticTrace : public IRSource {
+ public:
+  /// Create a source for a synthetic trace with the given number of commands and shared inputs
+  SyntheticTrace(size_t commands, size_t inputs) noexcept :
+      _commands(commands), _inputs(inputs) {}
+
+  /// Send a stream of IR steps to the given handler
+  void sendTo(IRSink& handler) noexcept;
+
+  /// Send a stream of IR steps to an r-value reference handler
+  void sendTo(IRSink&& handler) noexcept { sendTo(handler); }
+
+  /// A synthetic trace is never an executing IRSource
+  virtual bool isExecuting() const override { return false; }
+
+ private:
+  /// The number of commands that read the shared inputs
+  size_t _commands;
+
+  /// The number of shared inputs
+  size_t _inputs;
+};
@@ -16,8 +16,10 @@
 #include <sys/types.h>
 
 #include "data/IRSink.hh"
+#include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "util/log.hh"
+#include "util/stats.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirListVersion.hh"
 #include "versions/FileVersion.hh"
@@ -34,12 +36,23 @@ using std::nullopt;
 using std::optional;
 using std::shared_ptr;
 using std::string;
+using std::string_view;
 using std::tuple;
 using std::vector;
 
 // Grow the trace file by 2MB as needed
 enum : size_t { TraceFileSizeIncrement = 2 * 1024 * 1024 };
 
+// Every trace file starts with "RKRT" and the version of its record layout. Bump TraceVersion
+// whenever a record changes, so traces written by an older rkr are discarded instead of misread.
+enum : uint32_t { TraceMagic = 0x54524b52, TraceVersion = 2 };
+
+/// The header at the start of every trace file
+struct TraceHeader {
+  uint32_t magic;
+  uint32_t version;
+} __attribute__((packed));
+
 /********** Trace File Operations **********/
 
 // Open a trace file at a given path
@@ -267,10 +280,20 @@ enum class RecordType : uint8_t {
 /********** TraceReader Constructor and Destructor **********/
 
 optional<TraceReader> TraceReader::load(string path) noexcept {
+  ScopedTimer timer(Timer::TraceLoad);
+
   // Open the trace file
   auto file = TraceFile::open(path);
   if (!file) return nullopt;
 
+  // A trace with a different layout cannot be read, so the build starts over without it
+  auto header = reinterpret_cast<const TraceHeader*>(file.data);
+  if (file.length < sizeof(TraceHeader) || header->magic != TraceMagic ||
+      header->version != TraceVersion) {
+    LOG(phase) << "Discarding trace " << path << " written by a different version of rkr";
+    return nullopt;
+  }
+
   return TraceReader(std::move(file));
 }
 
@@ -281,8 +304,8 @@ TraceReader::TraceReader() noexcept {
 
 // Create a trace reader from an already open trace file
 TraceReader::TraceReader(TraceFile&& file) noexcept : _file(std::move(file)) {
-  // Jump back to the beginning of the file
-  _file.pos = 0;
+  // Jump back to the first record, just past the header
+  _file.pos = sizeof(TraceHeader);
 
   // Create a root command
   setCommand(0, make_shared<Command>());
@@ -298,6 +321,8 @@ TraceWriter::TraceWriter(optional<string> path) noexcept :
     _id(getNextID()), _path(path), _file(TraceFile::create()) {
   ASSERT(_file) << "Failed to create backing file for TraceWrite";
   ASSERT(_file.pos == 0) << "File is not at the beginning";
+
+  emitValue<TraceHeader>(TraceMagic, TraceVersion);
 }
 
 TraceWriter::~TraceWriter() noexcept {
@@ -337,6 +362,8 @@ void TraceWriter::link() const noexcept {
   // Is there an open file? If not, just return
   if (!_file) return;
 
+  ScopedTimer timer(Timer::TraceWrite);
+
   // Was a path provided?
   if (_path.has_value()) {
     // Yes. Link the trace onto the filesystem before it vanishes
@@ -565,10 +592,17 @@ void TraceWriter::reservePaths(size_t n) noexcept {
 }
 
 /// Get a string from the table of strings
-const string& TraceReader::getString(StringID id) const noexcept {
+string_view TraceReader::getString(StringID id) const noexcept {
   return _strings[id];
 }
 
+/// Get a path from the table of strings
+const fs::path& TraceReader::getPath(PathID id) noexcept {
+  auto& path = _paths[id];
+  if (!path.has_value()) path.emplace(_strings[id]);
+  return path.value();
+}
+
 StringID TraceWriter::getStringID(const std::string& str) noexcept {
   // Look for this string in the string table
   auto iter = _strtab.find(str);
@@ -610,11 +644,15 @@ struct Record<RecordType::Start> {
 
 // Read a Start record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Start>(IRSink& sink) noexcept {
-  ASSERT(_file.pos == 6) << "Reading a start record at a weird place (" << _file.pos << ")";
-  const auto& data = takeRecord<RecordType::Start>();
-  sink.start(getCommand(data.root_command));
-}
+struct TraceReader::RecordHandler<RecordType::Start> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    ASSERT(reader._file.pos == sizeof(TraceHeader) + 6)
+        << "Reading a start record at a weird place (" << reader._file.pos << ")";
+    const auto& data = reader.takeRecord<RecordType::Start>();
+    sink.start(reader.getCommand(data.root_command));
+  }
+};
 
 // Write a Start record to the output trace
 void TraceWriter::start(const shared_ptr<Command>& c) noexcept {
@@ -630,10 +668,13 @@ struct Record<RecordType::Finish> {
 
 // Read a Finish record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Finish>(IRSink& sink) noexcept {
-  takeRecord<RecordType::Finish>();
-  sink.finish();
-}
+struct TraceReader::RecordHandler<RecordType::Finish> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::Finish>();
+    sink.finish();
+  }
+};
 
 // Write a Finish record to the output trace
 void TraceWriter::finish() noexcept {
@@ -651,10 +692,13 @@ struct Record<RecordType::SpecialRef> {
 
 // Read a SpecialRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::SpecialRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::SpecialRef>();
-  sink.specialRef(*this, _current_command, data.entity, data.output);
-}
+struct TraceReader::RecordHandler<RecordType::SpecialRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::SpecialRef>();
+    sink.specialRef(reader, reader._current_command, data.entity, data.output);
+  }
+};
 
 // Write a SpecialRef record to the output trace
 void TraceWriter::specialRef(const IRSource& source,
@@ -676,10 +720,13 @@ struct Record<RecordType::PipeRef> {
 
 // Read a PipeRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::PipeRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::PipeRef>();
-  sink.pipeRef(*this, _current_command, data.read_end, data.write_end);
-}
+struct TraceReader::RecordHandler<RecordType::PipeRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::PipeRef>();
+    sink.pipeRef(reader, reader._current_command, data.read_end, data.write_end);
+  }
+};
 
 // Write a PipeRef record to the output trace
 void TraceWriter::pipeRef(const IRSource& source,
@@ -701,10 +748,13 @@ struct Record<RecordType::FileRef> {
 
 // Read a FileRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::FileRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::FileRef>();
-  sink.fileRef(*this, _current_command, data.mode, data.output);
-}
+struct TraceReader::RecordHandler<RecordType::FileRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::FileRef>();
+    sink.fileRef(reader, reader._current_command, data.mode, data.output);
+  }
+};
 
 // Write a FileRef record to the output trace
 void TraceWriter::fileRef(const IRSource& source,
@@ -726,15 +776,18 @@ struct Record<RecordType::SymlinkRef> {
 
 // Read a SymlinkRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::SymlinkRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::SymlinkRef>();
-  sink.symlinkRef(*this, _current_command, getString(data.target), data.output);
-}
+struct TraceReader::RecordHandler<RecordType::SymlinkRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::SymlinkRef>();
+    sink.symlinkRef(reader, reader._current_command, reader.getPath(data.target), data.output);
+  }
+};
 
 // Write a SymlinkRef record to the output trace
 void TraceWriter::symlinkRef(const IRSource& source,
                              const shared_ptr<Command>& c,
-                             fs::path target,
+                             const fs::path& target,
                              Ref::ID output) noexcept {
   setCommand(c);
   emitRecord<RecordType::SymlinkRef>(getPathID(target), output);
@@ -751,10 +804,13 @@ struct Record<RecordType::DirRef> {
 
 // Read a DirRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::DirRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::DirRef>();
-  sink.dirRef(*this, _current_command, data.mode, data.output);
-}
+struct TraceReader::RecordHandler<RecordType::DirRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::DirRef>();
+    sink.dirRef(reader, reader._current_command, data.mode, data.output);
+  }
+};
 
 // Write a DirRef record to the output trace
 void TraceWriter::dirRef(const IRSource& source,
@@ -778,16 +834,20 @@ struct Record<RecordType::PathRef> {
 
 // Read a PathRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::PathRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::PathRef>();
-  sink.pathRef(*this, _current_command, data.base, getString(data.path), data.flags, data.output);
-}
+struct TraceReader::RecordHandler<RecordType::PathRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::PathRef>();
+    sink.pathRef(reader, reader._current_command, data.base, reader.getPath(data.path),
+                 data.flags, data.output);
+  }
+};
 
 // Write a PathRef record to the output trace
 void TraceWriter::pathRef(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Ref::ID base,
-                          fs::path path,
+                          const fs::path& path,
                           AccessFlags flags,
                           Ref::ID output) noexcept {
   setCommand(c);
@@ -804,10 +864,13 @@ struct Record<RecordType::UsingRef> {
 
 // Read a UsingRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::UsingRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::UsingRef>();
-  sink.usingRef(*this, _current_command, data.ref);
-}
+struct TraceReader::RecordHandler<RecordType::UsingRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::UsingRef>();
+    sink.usingRef(reader, reader._current_command, data.ref);
+  }
+};
 
 // Write a UsingRef record to the output trace
 void TraceWriter::usingRef(const IRSource& source,
@@ -827,10 +890,13 @@ struct Record<RecordType::DoneWithRef> {
 
 // Read a DoneWithRef record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::DoneWithRef>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::DoneWithRef>();
-  sink.doneWithRef(*this, _current_command, data.ref);
-}
+struct TraceReader::RecordHandler<RecordType::DoneWithRef> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::DoneWithRef>();
+    sink.doneWithRef(reader, reader._current_command, data.ref);
+  }
+};
 
 // Write a DoneWithRef record to the output trace
 void TraceWriter::doneWithRef(const IRSource& source,
@@ -852,10 +918,13 @@ struct Record<RecordType::CompareRefs> {
 
 // Read a CompareRefs record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::CompareRefs>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::CompareRefs>();
-  sink.compareRefs(*this, _current_command, data.ref1, data.ref2, data.cmp);
-}
+struct TraceReader::RecordHandler<RecordType::CompareRefs> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::CompareRefs>();
+    sink.compareRefs(reader, reader._current_command, data.ref1, data.ref2, data.cmp);
+  }
+};
 
 // Write a CompareRefs record to the output trace
 void TraceWriter::compareRefs(const IRSource& source,
@@ -879,10 +948,13 @@ struct Record<RecordType::ExpectResult> {
 
 // Read an ExpectResult record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::ExpectResult>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::ExpectResult>();
-  sink.expectResult(*this, _current_command, data.scenario, data.ref, data.expected);
-}
+struct TraceReader::RecordHandler<RecordType::ExpectResult> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::ExpectResult>();
+    sink.expectResult(reader, reader._current_command, data.scenario, data.ref, data.expected);
+  }
+};
 
 // Write an ExpectResult record to the output trace
 void TraceWriter::expectResult(const IRSource& source,
@@ -906,17 +978,20 @@ struct Record<RecordType::MatchMetadata> {
 
 // Read a MatchMetadata record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::MatchMetadata>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::MatchMetadata>();
-  sink.matchMetadata(*this, _current_command, data.scenario, data.ref, data.version);
-}
+struct TraceReader::RecordHandler<RecordType::MatchMetadata> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::MatchMetadata>();
+    sink.matchMetadata(reader, reader._current_command, data.scenario, data.ref, data.version);
+  }
+};
 
 // Write a MatchMetadata record to the output trace
 void TraceWriter::matchMetadata(const IRSource& source,
                                 const shared_ptr<Command>& c,
                                 Scenario scenario,
                                 Ref::ID ref,
-                                MetadataVersion version) noexcept {
+                                const MetadataVersion& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::MatchMetadata>(scenario, ref, version);
 }
@@ -933,18 +1008,21 @@ struct Record<RecordType::MatchContent> {
 
 // Read a MatchContent record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::MatchContent>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::MatchContent>();
-  sink.matchContent(*this, _current_command, data.scenario, data.ref,
-                    getContentVersion(data.version));
-}
+struct TraceReader::RecordHandler<RecordType::MatchContent> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::MatchContent>();
+    sink.matchContent(reader, reader._current_command, data.scenario, data.ref,
+                      reader.getContentVersion(data.version));
+  }
+};
 
 // Write a MatchContent record to the output trace
 void TraceWriter::matchContent(const IRSource& source,
                                const shared_ptr<Command>& c,
                                Scenario scenario,
                                Ref::ID ref,
-                               shared_ptr<ContentVersion> version) noexcept {
+                               const shared_ptr<ContentVersion>& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::MatchContent>(scenario, ref, getContentVersionID(version));
 }
@@ -960,16 +1038,19 @@ struct Record<RecordType::UpdateMetadata> {
 
 // Read an UpdateMetadata record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::UpdateMetadata>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::UpdateMetadata>();
-  sink.updateMetadata(*this, _current_command, data.ref, data.version);
-}
+struct TraceReader::RecordHandler<RecordType::UpdateMetadata> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::UpdateMetadata>();
+    sink.updateMetadata(reader, reader._current_command, data.ref, data.version);
+  }
+};
 
 // Write an UpdateMetadata record to the output trace
 void TraceWriter::updateMetadata(const IRSource& source,
                                  const shared_ptr<Command>& c,
                                  Ref::ID ref,
-                                 MetadataVersion version) noexcept {
+                                 const MetadataVersion& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::UpdateMetadata>(ref, version);
 }
@@ -985,16 +1066,20 @@ struct Record<RecordType::UpdateContent> {
 
 // Read an UpdateContent record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::UpdateContent>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::UpdateContent>();
-  sink.updateContent(*this, _current_command, data.ref, getContentVersion(data.version));
-}
+struct TraceReader::RecordHandler<RecordType::UpdateContent> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::UpdateContent>();
+    sink.updateContent(reader, reader._current_command, data.ref,
+                       reader.getContentVersion(data.version));
+  }
+};
 
 // Write an UpdateContent record to the output trace
 void TraceWriter::updateContent(const IRSource& source,
                                 const shared_ptr<Command>& c,
                                 Ref::ID ref,
-                                shared_ptr<ContentVersion> version) noexcept {
+                                const shared_ptr<ContentVersion>& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::UpdateContent>(ref, getContentVersionID(version));
 }
@@ -1011,16 +1096,20 @@ struct Record<RecordType::AddEntry> {
 
 // Read an AddEntry record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::AddEntry>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::AddEntry>();
-  sink.addEntry(*this, _current_command, data.dir, getString(data.name), data.target);
-}
+struct TraceReader::RecordHandler<RecordType::AddEntry> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::AddEntry>();
+    sink.addEntry(reader, reader._current_command, data.dir, string(reader.getString(data.name)),
+                  data.target);
+  }
+};
 
 // Write an AddEntry record to the output trace
 void TraceWriter::addEntry(const IRSource& source,
                            const shared_ptr<Command>& c,
                            Ref::ID dir,
-                           string name,
+                           const string& name,
                            Ref::ID target) noexcept {
   setCommand(c);
   emitRecord<RecordType::AddEntry>(dir, getStringID(name), target);
@@ -1038,16 +1127,20 @@ struct Record<RecordType::RemoveEntry> {
 
 // Read a RemoveEntry record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::RemoveEntry>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::RemoveEntry>();
-  sink.removeEntry(*this, _current_command, data.dir, getString(data.name), data.target);
-}
+struct TraceReader::RecordHandler<RecordType::RemoveEntry> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::RemoveEntry>();
+    sink.removeEntry(reader, reader._current_command, data.dir, string(reader.getString(data.name)),
+                     data.target);
+  }
+};
 
 // Write a RemoveEntry record to the output trace
 void TraceWriter::removeEntry(const IRSource& source,
                               const shared_ptr<Command>& c,
                               Ref::ID dir,
-                              string name,
+                              const string& name,
                               Ref::ID target) noexcept {
   setCommand(c);
   emitRecord<RecordType::RemoveEntry>(dir, getStringID(name), target);
@@ -1069,23 +1162,26 @@ struct RefMapping {
 
 // Read a Launch record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Launch>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::Launch>();
-  const RefMapping* refs = takeArray<RefMapping>(data.refs_length);
+struct TraceReader::RecordHandler<RecordType::Launch> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::Launch>();
+    const RefMapping* refs = reader.takeArray<RefMapping>(data.refs_length);
 
-  list<tuple<Ref::ID, Ref::ID>> refs_list;
-  for (size_t i = 0; i < data.refs_length; i++) {
-    refs_list.push_back(tuple{refs[i].in_parent, refs[i].in_child});
-  }
+    list<tuple<Ref::ID, Ref::ID>> refs_list;
+    for (size_t i = 0; i < data.refs_length; i++) {
+      refs_list.push_back(tuple{refs[i].in_parent, refs[i].in_child});
+    }
 
-  sink.launch(*this, _current_command, getCommand(data.child), refs_list);
-}
+    sink.launch(reader, reader._current_command, reader.getCommand(data.child), refs_list);
+  }
+};
 
 // Write a Launch record to the output trace
 void TraceWriter::launch(const IRSource& source,
                          const shared_ptr<Command>& parent,
                          const shared_ptr<Command>& child,
-                         list<tuple<Ref::ID, Ref::ID>> refs) noexcept {
+                         const list<tuple<Ref::ID, Ref::ID>>& refs) noexcept {
   // Compute the length of the ref mapping list, which should fit in a 16-bit integer
   uint16_t refs_length = refs.size();
 
@@ -1112,10 +1208,13 @@ struct Record<RecordType::Join> {
 
 // Read a Join record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Join>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::Join>();
-  sink.join(*this, _current_command, getCommand(data.child), data.exit_status);
-}
+struct TraceReader::RecordHandler<RecordType::Join> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::Join>();
+    sink.join(reader, reader._current_command, reader.getCommand(data.child), data.exit_status);
+  }
+};
 
 // Write a Join record to the output trace
 void TraceWriter::join(const IRSource& source,
@@ -1132,21 +1231,38 @@ template <>
 struct Record<RecordType::Exit> {
   RecordType type;
   int exit_status;
+  uint64_t wall_ns;
+  uint64_t start_ns;
+  uint64_t cpu_ns;
+  uint64_t max_rss_kb;
+  uint64_t syscalls;
+  uint64_t ptrace_stops;
 } __attribute__((packed));
 
 // Read an Exit record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Exit>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::Exit>();
-  sink.exit(*this, _current_command, data.exit_status);
-}
+struct TraceReader::RecordHandler<RecordType::Exit> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::Exit>();
+    Command::Usage usage{.wall_ns = data.wall_ns,
+                         .start_ns = data.start_ns,
+                         .cpu_ns = data.cpu_ns,
+                         .max_rss_kb = data.max_rss_kb,
+                         .syscalls = data.syscalls,
+                         .ptrace_stops = data.ptrace_stops};
+    sink.exit(reader, reader._current_command, data.exit_status, usage);
+  }
+};
 
 // Write an Exit record to the output trace
 void TraceWriter::exit(const IRSource& source,
                        const shared_ptr<Command>& c,
-                       int exit_status) noexcept {
+                       int exit_status,
+                       const Command::Usage& usage) noexcept {
   setCommand(c);
-  emitRecord<RecordType::Exit>(exit_status);
+  emitRecord<RecordType::Exit>(exit_status, usage.wall_ns, usage.start_ns, usage.cpu_ns,
+                               usage.max_rss_kb, usage.syscalls, usage.ptrace_stops);
 }
 
 /********** Command Record **********/
@@ -1168,29 +1284,32 @@ struct FDRecord2 {
 
 // Read a Command record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::Command>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::Command>();
-  const StringID* arg_ids = takeArray<StringID>(data.argv_length);
-  const FDRecord2* fds = takeArray<FDRecord2>(data.initial_fds_length);
+struct TraceReader::RecordHandler<RecordType::Command> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::Command>();
+    const StringID* arg_ids = reader.takeArray<StringID>(data.argv_length);
+    const FDRecord2* fds = reader.takeArray<FDRecord2>(data.initial_fds_length);
+
+    // Get argument strings
+    vector<string> args;
+    for (size_t i = 0; i < data.argv_length; i++) {
+      args.emplace_back(reader.getString(arg_ids[i]));
+    }
 
-  // Get argument strings
-  vector<string> args;
-  for (size_t i = 0; i < data.argv_length; i++) {
-    args.push_back(getString(arg_ids[i]));
-  }
+    // Create a command
+    auto cmd = make_shared<Command>(args);
+    if (data.has_executed) cmd->setExecuted();
 
-  // Create a command
-  auto cmd = make_shared<Command>(args);
-  if (data.has_executed) cmd->setExecuted();
+    // Add initial file descriptors
+    for (size_t i = 0; i < data.initial_fds_length; i++) {
+      cmd->addInitialFD(fds[i].fd, fds[i].ref);
+    }
 
-  // Add initial file descriptors
-  for (size_t i = 0; i < data.initial_fds_length; i++) {
-    cmd->addInitialFD(fds[i].fd, fds[i].ref);
+    // Save the command in the commands table
+    reader.addCommand(cmd);
   }
-
-  // Save the command in the commands table
-  addCommand(cmd);
-}
+};
 
 // Write a Command record to the output trace
 void TraceWriter::emitCommand(const std::shared_ptr<Command>& c) noexcept {
@@ -1228,11 +1347,15 @@ struct Record<RecordType::String> {
 
 // Read a String record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::String>(IRSink& sink) noexcept {
-  takeRecord<RecordType::String>();
-  const char* str = takeString();
-  _strings.emplace_back(str);
-}
+struct TraceReader::RecordHandler<RecordType::String> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::String>();
+    const char* str = reader.takeString();
+    reader._strings.emplace_back(str);
+    reader._paths.emplace_back();
+  }
+};
 
 // Write a String record to the output trace
 void TraceWriter::emitString(const string& str) noexcept {
@@ -1250,10 +1373,14 @@ struct Record<RecordType::NewStrtab> {
 
 // Read a NewStrtab record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::NewStrtab>(IRSink& sink) noexcept {
-  takeRecord<RecordType::NewStrtab>();
-  _strings.clear();
-}
+struct TraceReader::RecordHandler<RecordType::NewStrtab> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::NewStrtab>();
+    reader._strings.clear();
+    reader._paths.clear();
+  }
+};
 
 // Write a NewStrtab record to the output trace
 void TraceWriter::emitNewStrtab() noexcept {
@@ -1269,11 +1396,14 @@ struct Record<RecordType::End> {
 
 // Read an end record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::End>(IRSink& sink) noexcept {
-  takeRecord<RecordType::End>();
-  // The reader is finished
-  _done = true;
-}
+struct TraceReader::RecordHandler<RecordType::End> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::End>();
+    // The reader is finished
+    reader._done = true;
+  }
+};
 
 // Write an end record to the output trace
 void TraceWriter::emitEnd() noexcept {
@@ -1289,23 +1419,30 @@ struct Record<RecordType::FileVersion> {
   bool is_cached : 1;
   bool has_mtime : 1;
   bool has_hash : 1;
+  bool hash_pending : 1;
   struct timespec mtime;
   FileVersion::Hash hash;
+  uint64_t size;
+  uint64_t inode;
 } __attribute__((packed));
 
 // Read a FileVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::FileVersion>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::FileVersion>();
+struct TraceReader::RecordHandler<RecordType::FileVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::FileVersion>();
 
-  optional<struct timespec> mtime;
-  if (data.has_mtime) mtime = data.mtime;
+    optional<struct timespec> mtime;
+    if (data.has_mtime) mtime = data.mtime;
 
-  optional<FileVersion::Hash> hash;
-  if (data.has_hash) hash = data.hash;
+    optional<FileVersion::Hash> hash;
+    if (data.has_hash) hash = data.hash;
 
-  addVersion(make_shared<FileVersion>(data.is_empty, data.is_cached, mtime, hash));
-}
+    reader.addVersion(make_shared<FileVersion>(data.is_empty, data.is_cached, mtime, hash,
+                                               data.hash_pending, data.size, data.inode));
+  }
+};
 
 // Write a FileVersion record to the output trace
 void TraceWriter::emitFileVersion(const shared_ptr<FileVersion>& v) noexcept {
@@ -1315,9 +1452,13 @@ void TraceWriter::emitFileVersion(const shared_ptr<FileVersion>& v) noexcept {
   bool has_hash = v->getHash().has_value();
   auto hash = v->getHash().value_or(FileVersion::Hash());
 
+  // A pending hash is stored with the file state it must be taken from
+  uint64_t size = v->getSize();
+  uint64_t inode = v->getInode();
+
   // Emit the file version
-  emitRecord<RecordType::FileVersion>(v->isEmpty(), v->isCached(), has_mtime, has_hash, mtime,
-                                      hash);
+  emitRecord<RecordType::FileVersion>(v->isEmpty(), v->isCached(), has_mtime, has_hash,
+                                      v->hasPendingHash(), mtime, hash, size, inode);
 }
 
 /********** SymlinkVersion Record **********/
@@ -1330,10 +1471,13 @@ struct Record<RecordType::SymlinkVersion> {
 
 // Read a SymlinkVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::SymlinkVersion>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::SymlinkVersion>();
-  addVersion(make_shared<SymlinkVersion>(getString(data.dest)));
-}
+struct TraceReader::RecordHandler<RecordType::SymlinkVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::SymlinkVersion>();
+    reader.addVersion(make_shared<SymlinkVersion>(reader.getPath(data.dest)));
+  }
+};
 
 // Write a SymlinkVersion record to the output trace
 void TraceWriter::emitSymlinkVersion(const shared_ptr<SymlinkVersion>& v) noexcept {
@@ -1350,17 +1494,20 @@ struct Record<RecordType::DirListVersion> {
 
 // Read a DirListVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::DirListVersion>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::DirListVersion>();
-  const PathID* entry_ids = takeArray<PathID>(data.entry_count);
+struct TraceReader::RecordHandler<RecordType::DirListVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::DirListVersion>();
+    const PathID* entry_ids = reader.takeArray<PathID>(data.entry_count);
 
-  auto v = make_shared<DirListVersion>();
-  for (size_t i = 0; i < data.entry_count; i++) {
-    v->addEntry(getString(entry_ids[i]));
-  }
+    auto v = make_shared<DirListVersion>();
+    for (size_t i = 0; i < data.entry_count; i++) {
+      v->addEntry(reader.getPath(entry_ids[i]));
+    }
 
-  addVersion(v);
-}
+    reader.addVersion(v);
+  }
+};
 
 // Write a DirListVersion record to the output trace
 void TraceWriter::emitDirListVersion(const shared_ptr<DirListVersion>& v) noexcept {
@@ -1396,10 +1543,13 @@ struct Record<RecordType::PipeWriteVersion> {
 
 // Read a PipeWriteVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::PipeWriteVersion>(IRSink& sink) noexcept {
-  takeRecord<RecordType::PipeWriteVersion>();
-  addVersion(make_shared<PipeWriteVersion>());
-}
+struct TraceReader::RecordHandler<RecordType::PipeWriteVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::PipeWriteVersion>();
+    reader.addVersion(make_shared<PipeWriteVersion>());
+  }
+};
 
 // Write a PipeWriteVersion record to the output trace
 void TraceWriter::emitPipeWriteVersion(const shared_ptr<PipeWriteVersion>& v) noexcept {
@@ -1415,10 +1565,13 @@ struct Record<RecordType::PipeCloseVersion> {
 
 // Read a PipeCloseVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::PipeCloseVersion>(IRSink& sink) noexcept {
-  takeRecord<RecordType::PipeCloseVersion>();
-  addVersion(make_shared<PipeCloseVersion>());
-}
+struct TraceReader::RecordHandler<RecordType::PipeCloseVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::PipeCloseVersion>();
+    reader.addVersion(make_shared<PipeCloseVersion>());
+  }
+};
 
 // Write a PipeCloseVersion record to the output trace
 void TraceWriter::emitPipeCloseVersion(const shared_ptr<PipeCloseVersion>& v) noexcept {
@@ -1434,10 +1587,13 @@ struct Record<RecordType::PipeReadVersion> {
 
 // Read a PipeReadVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::PipeReadVersion>(IRSink& sink) noexcept {
-  takeRecord<RecordType::PipeReadVersion>();
-  addVersion(make_shared<PipeReadVersion>());
-}
+struct TraceReader::RecordHandler<RecordType::PipeReadVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    reader.takeRecord<RecordType::PipeReadVersion>();
+    reader.addVersion(make_shared<PipeReadVersion>());
+  }
+};
 
 // Write a PipeReadVersion record to the output trace
 void TraceWriter::emitPipeReadVersion(const shared_ptr<PipeReadVersion>& v) noexcept {
@@ -1454,10 +1610,13 @@ struct Record<RecordType::SpecialVersion> {
 
 // Read a SpecialVersion record from the input trace
 template <>
-void TraceReader::handleRecord<RecordType::SpecialVersion>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::SpecialVersion>();
-  addVersion(make_shared<SpecialVersion>(data.can_commit));
-}
+struct TraceReader::RecordHandler<RecordType::SpecialVersion> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::SpecialVersion>();
+    reader.addVersion(make_shared<SpecialVersion>(data.can_commit));
+  }
+};
 
 // Write a SpecialVersion record to the output trace
 void TraceWriter::emitSpecialVersion(const shared_ptr<SpecialVersion>& v) noexcept {
@@ -1474,10 +1633,13 @@ struct Record<RecordType::SetCommand> {
 
 // Read a SetCommand record from the trace
 template <>
-void TraceReader::handleRecord<RecordType::SetCommand>(IRSink& sink) noexcept {
-  const auto& data = takeRecord<RecordType::SetCommand>();
-  _current_command = getCommand(data.c);
-}
+struct TraceReader::RecordHandler<RecordType::SetCommand> {
+  template <class Sink>
+  static void handle(TraceReader& reader, Sink& sink) noexcept {
+    const auto& data = reader.takeRecord<RecordType::SetCommand>();
+    reader._current_command = reader.getCommand(data.c);
+  }
+};
 
 // Write a SetCommand record to the output trace
 void TraceWriter::setCommand(std::shared_ptr<Command> c) noexcept {
@@ -1489,140 +1651,153 @@ void TraceWriter::setCommand(std::shared_ptr<Command> c) noexcept {
 
 /********** Process an input trace **********/
 
+// Send the trace to any IRSink through virtual calls
 void TraceReader::sendTo(IRSink& sink) noexcept {
+  dispatch(sink);
+}
+
+// Send the trace to a Build. Build is final, so each step handler is called directly.
+void TraceReader::sendTo(Build& build) noexcept {
+  dispatch(build);
+}
+
+template <class Sink>
+void TraceReader::dispatch(Sink& sink) noexcept {
   while (!done()) {
+    _record_count++;
+
     // Handle the next record
     switch (peek()) {
       case RecordType::Start:
-        handleRecord<RecordType::Start>(sink);
+        RecordHandler<RecordType::Start>::handle(*this, sink);
         break;
 
       case RecordType::Finish:
-        handleRecord<RecordType::Finish>(sink);
+        RecordHandler<RecordType::Finish>::handle(*this, sink);
         break;
 
       case RecordType::SpecialRef:
-        handleRecord<RecordType::SpecialRef>(sink);
+        RecordHandler<RecordType::SpecialRef>::handle(*this, sink);
         break;
 
       case RecordType::PipeRef:
-        handleRecord<RecordType::PipeRef>(sink);
+        RecordHandler<RecordType::PipeRef>::handle(*this, sink);
         break;
 
       case RecordType::FileRef:
-        handleRecord<RecordType::FileRef>(sink);
+        RecordHandler<RecordType::FileRef>::handle(*this, sink);
         break;
 
       case RecordType::SymlinkRef:
-        handleRecord<RecordType::SymlinkRef>(sink);
+        RecordHandler<RecordType::SymlinkRef>::handle(*this, sink);
         break;
 
       case RecordType::DirRef:
-        handleRecord<RecordType::DirRef>(sink);
+        RecordHandler<RecordType::DirRef>::handle(*this, sink);
         break;
 
       case RecordType::PathRef:
-        handleRecord<RecordType::PathRef>(sink);
+        RecordHandler<RecordType::PathRef>::handle(*this, sink);
         break;
 
       case RecordType::UsingRef:
-        handleRecord<RecordType::UsingRef>(sink);
+        RecordHandler<RecordType::UsingRef>::handle(*this, sink);
         break;
 
       case RecordType::DoneWithRef:
-        handleRecord<RecordType::DoneWithRef>(sink);
+        RecordHandler<RecordType::DoneWithRef>::handle(*this, sink);
         break;
 
       case RecordType::CompareRefs:
-        handleRecord<RecordType::CompareRefs>(sink);
+        RecordHandler<RecordType::CompareRefs>::handle(*this, sink);
         break;
 
       case RecordType::ExpectResult:
-        handleRecord<RecordType::ExpectResult>(sink);
+        RecordHandler<RecordType::ExpectResult>::handle(*this, sink);
         break;
 
       case RecordType::MatchMetadata:
-        handleRecord<RecordType::MatchMetadata>(sink);
+        RecordHandler<RecordType::MatchMetadata>::handle(*this, sink);
         break;
 
       case RecordType::MatchContent:
-        handleRecord<RecordType::MatchContent>(sink);
+        RecordHandler<RecordType::MatchContent>::handle(*this, sink);
         break;
 
       case RecordType::UpdateMetadata:
-        handleRecord<RecordType::UpdateMetadata>(sink);
+        RecordHandler<RecordType::UpdateMetadata>::handle(*this, sink);
         break;
 
       case RecordType::UpdateContent:
-        handleRecord<RecordType::UpdateContent>(sink);
+        RecordHandler<RecordType::UpdateContent>::handle(*this, sink);
         break;
 
       case RecordType::AddEntry:
-        handleRecord<RecordType::AddEntry>(sink);
+        RecordHandler<RecordType::AddEntry>::handle(*this, sink);
         break;
 
       case RecordType::RemoveEntry:
-        handleRecord<RecordType::RemoveEntry>(sink);
+        RecordHandler<RecordType::RemoveEntry>::handle(*this, sink);
         break;
 
       case RecordType::Launch:
-        handleRecord<RecordType::Launch>(sink);
+        RecordHandler<RecordType::Launch>::handle(*this, sink);
         break;
 
       case RecordType::Join:
-        handleRecord<RecordType::Join>(sink);
+        RecordHandler<RecordType::Join>::handle(*this, sink);
         break;
 
       case RecordType::Exit:
-        handleRecord<RecordType::Exit>(sink);
+        RecordHandler<RecordType::Exit>::handle(*this, sink);
         break;
 
       case RecordType::Command:
-        handleRecord<RecordType::Command>(sink);
+        RecordHandler<RecordType::Command>::handle(*this, sink);
         break;
 
       case RecordType::String:
-        handleRecord<RecordType::String>(sink);
+        RecordHandler<RecordType::String>::handle(*this, sink);
         break;
 
       case RecordType::NewStrtab:
-        handleRecord<RecordType::NewStrtab>(sink);
+        RecordHandler<RecordType::NewStrtab>::handle(*this, sink);
         break;
 
       case RecordType::End:
-        handleRecord<RecordType::End>(sink);
+        RecordHandler<RecordType::End>::handle(*this, sink);
         break;
 
       case RecordType::FileVersion:
-        handleRecord<RecordType::FileVersion>(sink);
+        RecordHandler<RecordType::FileVersion>::handle(*this, sink);
         break;
 
       case RecordType::SymlinkVersion:
-        handleRecord<RecordType::SymlinkVersion>(sink);
+        RecordHandler<RecordType::SymlinkVersion>::handle(*this, sink);
         break;
 
       case RecordType::DirListVersion:
-        handleRecord<RecordType::DirListVersion>(sink);
+        RecordHandler<RecordType::DirListVersion>::handle(*this, sink);
         break;
 
       case RecordType::PipeWriteVersion:
-        handleRecord<RecordType::PipeWriteVersion>(sink);
+        RecordHandler<RecordType::PipeWriteVersion>::handle(*this, sink);
         break;
 
       case RecordType::PipeCloseVersion:
-        handleRecord<RecordType::PipeCloseVersion>(sink);
+        RecordHandler<RecordType::PipeCloseVersion>::handle(*this, sink);
         break;
 
       case RecordType::PipeReadVersion:
-        handleRecord<RecordType::PipeReadVersion>(sink);
+        RecordHandler<RecordType::PipeReadVersion>::handle(*this, sink);
         break;
 
       case RecordType::SpecialVersion:
-        handleRecord<RecordType::SpecialVersion>(sink);
+        RecordHandler<RecordType::SpecialVersion>::handle(*this, sink);
         break;
 
       case RecordType::SetCommand:
-        handleRecord<RecordType::SetCommand>(sink);
+        RecordHandler<RecordType::SetCommand>::handle(*this, sink);
         break;
     }
   }
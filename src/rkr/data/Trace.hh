@@ -4,6 +4,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <unordered_map>
 
@@ -12,6 +13,7 @@
 #include "runtime/Command.hh"
 #include "versions/ContentVersion.hh"
 
+class Build;
 class MetadataVersion;
 class FileVersion;
 class SymlinkVersion;
@@ -94,9 +96,18 @@ class TraceReader : public IRSource {
   /// Accept r-value reference to a sink
   void sendTo(IRSink&& handler) noexcept { return sendTo(handler); }
 
+  /// Send a loaded trace to a Build, without going through virtual IRSink calls
+  void sendTo(Build& build) noexcept;
+
+  /// Accept r-value reference to a Build
+  void sendTo(Build&& build) noexcept { return sendTo(build); }
+
   /// Get the root command
   std::shared_ptr<Command> getRootCommand() const noexcept;
 
+  /// Get the number of records read from the trace so far
+  size_t getRecordCount() const noexcept { return _record_count; }
+
   /// A saved trace is never an executing IRSource
   virtual bool isExecuting() const override { return false; }
 
@@ -128,9 +139,14 @@ class TraceReader : public IRSource {
   /// Get a pointer to a string in the trace and advance the current position past the string
   const char* takeString() noexcept;
 
-  /// Handle a record from the trace (specialized in Trace.cc)
+  /// Decodes one type of record and passes it to a sink (specialized in Trace.cc)
   template <RecordType T>
-  void handleRecord(IRSink& sink) noexcept;
+  struct RecordHandler;
+
+  /// Send every record in the trace to a sink. The sink type is known statically, so calls to a
+  /// final sink like Build do not go through the IRSink vtable.
+  template <class Sink>
+  void dispatch(Sink& sink) noexcept;
 
   /// Get a command from the table of commands
   const std::shared_ptr<Command>& getCommand(Command::ID id) const noexcept;
@@ -138,8 +154,11 @@ class TraceReader : public IRSource {
   /// Get a content version from the table of content versions
   const std::shared_ptr<ContentVersion>& getContentVersion(ContentVersion::ID id) const noexcept;
 
-  /// Get a string from the table of strings
-  const std::string& getString(StringID id) const noexcept;
+  /// Get a string from the table of strings. The view points into the mapped trace file.
+  std::string_view getString(StringID id) const noexcept;
+
+  /// Get a path from the table of strings. Each path is parsed once, on its first use.
+  const fs::path& getPath(PathID id) noexcept;
 
   /// Set a command in the commands table using a known ID
   void setCommand(Command::ID id, std::shared_ptr<Command> c) noexcept;
@@ -160,6 +179,9 @@ class TraceReader : public IRSource {
   /// When true, the reader has reached the end of the trace
   bool _done = false;
 
+  /// The number of records read from the trace
+  size_t _record_count = 0;
+
   /// The table of commands indexed by ID
   std::vector<std::shared_ptr<Command>> _commands;
 
@@ -172,8 +194,11 @@ class TraceReader : public IRSource {
   /// The next content version ID that will be assigned in the trace
   size_t _next_version_id = 0;
 
-  /// The table of strings indexed by ID
-  std::vector<std::string> _strings;
+  /// The table of strings indexed by ID. Strings are not copied out of the trace file.
+  std::vector<std::string_view> _strings;
+
+  /// Parsed paths for entries in the string table, filled in as each path is first used
+  std::vector<std::optional<fs::path>> _paths;
 
   /// The ID of the current command
   Command::ID _current_command_id = 0;
@@ -229,7 +254,7 @@ class TraceWriter : public IRSink {
   /// Handle a SymlinkRef IR step
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& command,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override;
 
   /// Handle a DirRef IR step
@@ -242,7 +267,7 @@ class TraceWriter : public IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& command,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override;
 
@@ -275,46 +300,46 @@ class TraceWriter : public IRSink {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion version) noexcept override;
+                             const MetadataVersion& version) noexcept override;
 
   /// Handel a MatchContent IR step
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> version) noexcept override;
+                            const std::shared_ptr<ContentVersion>& version) noexcept override;
 
   /// Handle an UpdateMetadata IR step
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion version) noexcept override;
+                              const MetadataVersion& version) noexcept override;
 
   /// Handle an UpdateContent IR step
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> version) noexcept override;
+                             const std::shared_ptr<ContentVersion>& version) noexcept override;
 
   /// Handle an AddEntry IR step
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override;
 
   /// Handle a RemoveEntry IR step
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override;
 
   /// Handle a Launch IR step
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& command,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override;
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override;
 
   /// Handle a Join IR step
   virtual void join(const IRSource& source,
@@ -325,7 +350,8 @@ class TraceWriter : public IRSink {
   /// Handle an Exit IR step
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& command,
-                    int exit_status) noexcept override;
+                    int exit_status,
+                    const Command::Usage& usage) noexcept override;
 
  private:
   /// Write a record to the trace
@@ -1,12 +1,17 @@
 #include "Build.hh"
 
+#include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -21,6 +26,7 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "runtime/jobserver.hh"
 #include "runtime/policy.hh"
 #include "tracing/Tracer.hh"
 #include "util/TracePrinter.hh"
@@ -50,15 +56,130 @@ namespace fs = std::filesystem;
 Build::Build(IRSink& output, std::ostream& print_to) noexcept :
     _output(output), _print_to(print_to) {}
 
-void Build::runDeferredSteps() noexcept {
-  // Create a TraceReader to emit deferred steps
-  auto input = _deferred_steps.getReader();
+void Build::defer(const shared_ptr<Command>& c, std::function<void()> step) noexcept {
+  _deferred_commands.emplace(c);
+  _deferred_steps[c].push_back(DeferredStep{_next_deferred_index++, std::move(step)});
+}
+
+/// Get the pipes in a command's initial file descriptor table
+static vector<shared_ptr<Artifact>> getInitialPipes(const shared_ptr<Command>& c) noexcept {
+  vector<shared_ptr<Artifact>> pipes;
+  for (const auto& [fd, ref_id] : c->getInitialFDs()) {
+    const auto& ref = c->getRef(ref_id);
+    if (ref->isResolved() && ref->getArtifact()->as<PipeArtifact>()) {
+      pipes.push_back(ref->getArtifact());
+    }
+  }
+  return pipes;
+}
+
+void Build::startPending() noexcept {
+  if (_pending_starts.empty()) return;
+
+  // Commands with no recorded run time keep their order from the trace
+  auto longer = [](const auto& a, const auto& b) {
+    return a->getCriticalPath() > b->getCriticalPath();
+  };
+  std::stable_sort(_pending_starts.begin(), _pending_starts.end(), longer);
+
+  reclaimTokens();
+
+  // Is a pipe used by a process that is already running?
+  auto running = [this](const shared_ptr<Artifact>& pipe) {
+    for (const auto& started : _started) {
+      auto& pipes = started.pipes;
+      if (std::find(pipes.begin(), pipes.end(), pipe) != pipes.end()) return true;
+    }
+    return false;
+  };
+
+  // Start commands in order, skipping those that cannot get a token. A command later in the list
+  // may still join the job of a command started before it.
+  vector<shared_ptr<Command>> waiting;
+  for (const auto& c : _pending_starts) {
+    auto pipes = getInitialPipes(c);
+
+    // The build holds one implicit token, which is free whenever nothing else is running. A
+    // command connected by a pipe to a running command is part of that command's job. Holding
+    // it back could leave both stuck on a full pipe.
+    bool token = false;
+    if (jobserver::enabled() && !_started.empty() &&
+        std::none_of(pipes.begin(), pipes.end(), running)) {
+      if (!jobserver::tryAcquire()) {
+        waiting.push_back(c);
+        continue;
+      }
+      token = true;
+    }
+
+    LOGF(exec, "Starting {} (critical path {}ms)", c, c->getCriticalPath() / 1000000);
+    auto process = _tracer.start(*this, c);
+    c->setLaunched(process);
+    _started.push_back(StartedProcess{process, token, std::move(pipes)});
+  }
+  _pending_starts = std::move(waiting);
+}
 
-  // Create a new buffer to hold new deferred steps
-  _deferred_steps = TraceWriter();
+void Build::reclaimTokens() noexcept {
+  for (auto iter = _started.begin(); iter != _started.end();) {
+    if (iter->process && !iter->process->hasExited()) {
+      iter++;
+      continue;
+    }
+
+    if (iter->token) jobserver::release();
+    iter = _started.erase(iter);
+  }
+}
 
-  // Feed all deferred IR steps back through for emulation
-  input.sendTo(*this);
+void Build::waitAndStart(std::function<bool()> done) noexcept {
+  // Tokens come back when our own processes exit, but also when other members of a shared
+  // jobserver finish their jobs, so try to start held commands after every tracing event. The
+  // tracer returns early once no processes are left, but a held command can always start then.
+  do {
+    startPending();
+    _tracer.waitUntil(*this, [&] {
+      startPending();
+      return done();
+    });
+  } while (!done() && !_pending_starts.empty());
+}
+
+void Build::runDeferredSteps(const shared_ptr<Command>& c) noexcept {
+  // Queues of steps that are ready to run. Steps may launch more commands, so keep running the
+  // earliest step across all ready queues to preserve the original order of the trace.
+  using Queue = std::deque<DeferredStep>;
+  auto later = [](const Queue* a, const Queue* b) { return a->front().index > b->front().index; };
+  std::priority_queue<Queue*, vector<Queue*>, decltype(later)> ready(later);
+
+  // Take the queue of deferred steps for a launched command, if it has one
+  list<Queue> released;
+  auto release = [&](const shared_ptr<Command>& cmd) {
+    auto iter = _deferred_steps.find(cmd);
+    if (iter == _deferred_steps.end()) return;
+    released.push_back(std::move(iter->second));
+    _deferred_steps.erase(iter);
+    ready.push(&released.back());
+  };
+
+  release(c);
+
+  while (!ready.empty()) {
+    auto queue = ready.top();
+    ready.pop();
+
+    auto step = std::move(queue->front());
+    queue->pop_front();
+    step.run();
+
+    if (!queue->empty()) ready.push(queue);
+
+    // Release the steps of any commands this step launched
+    for (const auto& launched : _released_commands) {
+      release(launched);
+    }
+    _released_commands.clear();
+  }
 }
 
 /// Start a build with the given root command
@@ -73,11 +194,13 @@ void Build::start(const shared_ptr<Command>& c) noexcept {
 }
 
 void Build::finish() noexcept {
-  // Wait for all remaining processes to exit
-  _tracer.wait(*this);
+  // Start any commands that are still waiting as job tokens become available, and wait for all
+  // remaining processes to exit
+  waitAndStart([] { return false; });
+  reclaimTokens();
 
   // Compare the final state of all artifacts to the actual filesystem
-  env::getRootDir()->checkFinalState("/");
+  env::checkFinalState();
 
   // Finish the run of the root command and all descendants (recursively)
   _root_command->finishRun();
@@ -101,8 +224,7 @@ void Build::specialRef(const IRSource& source,
 
   // If this step comes from a command that hasn't been launched, we need to defer this step
   if (!c->isLaunched()) {
-    _deferred_commands.emplace(c);
-    _deferred_steps.specialRef(source, c, entity, output);
+    defer(c, [=] { specialRef(_deferred_source, c, entity, output); });
     return;
   }
 
@@ -179,8 +301,7 @@ void Build::pipeRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.pipeRef(source, c, read_end, write_end);
+      defer(c, [=] { pipeRef(_deferred_source, c, read_end, write_end); });
       return;
     }
   }
@@ -215,8 +336,7 @@ void Build::fileRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.fileRef(source, c, mode, output);
+      defer(c, [=] { fileRef(_deferred_source, c, mode, output); });
       return;
     }
   }
@@ -231,7 +351,7 @@ void Build::fileRef(const IRSource& source,
 // A command references a new anonymous symlink
 void Build::symlinkRef(const IRSource& source,
                        const shared_ptr<Command>& c,
-                       fs::path target,
+                       const fs::path& target,
                        Ref::ID output) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -249,8 +369,7 @@ void Build::symlinkRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.symlinkRef(source, c, target, output);
+      defer(c, [=] { symlinkRef(_deferred_source, c, target, output); });
       return;
     }
   }
@@ -284,8 +403,7 @@ void Build::dirRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.dirRef(source, c, mode, output);
+      defer(c, [=] { dirRef(_deferred_source, c, mode, output); });
       return;
     }
   }
@@ -301,7 +419,7 @@ void Build::dirRef(const IRSource& source,
 void Build::pathRef(const IRSource& source,
                     const shared_ptr<Command>& c,
                     Ref::ID base,
-                    fs::path path,
+                    const fs::path& path,
                     AccessFlags flags,
                     Ref::ID output) noexcept {
   // If the command must run but the step comes from a saved source, skip it
@@ -320,8 +438,7 @@ void Build::pathRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.pathRef(source, c, base, path, flags, output);
+      defer(c, [=] { pathRef(_deferred_source, c, base, path, flags, output); });
       return;
     }
   }
@@ -331,16 +448,20 @@ void Build::pathRef(const IRSource& source,
 
   // Is this a path to a temporary file?
   bool is_tempfile = false;
+  fs::path tempfile_path;
   if (base_dir == env::getRootDir() && path.string().substr(0, 4) == "tmp/") {
     is_tempfile = true;
 
     // The command may be running different temporary file paths. Substitute the path now
     string newpath = c->substitutePath("/" + path.string());
-    path = fs::path(newpath.substr(1));
+    tempfile_path = fs::path(newpath.substr(1));
   }
 
+  // Non-temporary paths are passed along and resolved without making a copy
+  const auto& resolve_path = is_tempfile ? tempfile_path : path;
+
   // Create an IR step and add it to the output trace
-  _output.pathRef(source, c, base, path, flags, output);
+  _output.pathRef(source, c, base, resolve_path, flags, output);
 
   // Is the base directory available?
   if (!base_dir) {
@@ -349,7 +470,7 @@ void Build::pathRef(const IRSource& source,
   }
 
   // Resolve the reference
-  shared_ptr<Ref> result = make_shared<Ref>(base_dir->resolve(c, path, flags));
+  shared_ptr<Ref> result = make_shared<Ref>(base_dir->resolve(c, resolve_path, flags));
 
   // If this reference was to a temporary file, inform the command
   if (result->isSuccess() && is_tempfile) c->addTempfile(result->getArtifact());
@@ -376,8 +497,7 @@ void Build::usingRef(const IRSource& source, const shared_ptr<Command>& c, Ref::
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.usingRef(source, c, ref);
+      defer(c, [=] { usingRef(_deferred_source, c, ref); });
       return;
     }
   }
@@ -409,8 +529,7 @@ void Build::doneWithRef(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.doneWithRef(source, c, ref_id);
+      defer(c, [=] { doneWithRef(_deferred_source, c, ref_id); });
       return;
     }
   }
@@ -453,8 +572,7 @@ void Build::compareRefs(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.compareRefs(source, c, ref1_id, ref2_id, type);
+      defer(c, [=] { compareRefs(_deferred_source, c, ref1_id, ref2_id, type); });
       return;
     }
   }
@@ -508,8 +626,7 @@ void Build::expectResult(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.expectResult(source, c, scenario, ref_id, expected);
+      defer(c, [=] { expectResult(_deferred_source, c, scenario, ref_id, expected); });
       return;
     }
   }
@@ -540,7 +657,7 @@ void Build::matchMetadata(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Scenario scenario,
                           Ref::ID ref_id,
-                          MetadataVersion expected) noexcept {
+                          const MetadataVersion& expected) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -557,8 +674,7 @@ void Build::matchMetadata(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.matchMetadata(source, c, scenario, ref_id, expected);
+      defer(c, [=] { matchMetadata(_deferred_source, c, scenario, ref_id, expected); });
       return;
     }
   }
@@ -589,7 +705,7 @@ void Build::matchContent(const IRSource& source,
                          const shared_ptr<Command>& c,
                          Scenario scenario,
                          Ref::ID ref_id,
-                         shared_ptr<ContentVersion> expected) noexcept {
+                         const shared_ptr<ContentVersion>& expected) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -606,8 +722,7 @@ void Build::matchContent(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.matchContent(source, c, scenario, ref_id, expected);
+      defer(c, [=] { matchContent(_deferred_source, c, scenario, ref_id, expected); });
       return;
     }
   }
@@ -631,7 +746,7 @@ void Build::matchContent(const IRSource& source,
 void Build::updateMetadata(const IRSource& source,
                            const shared_ptr<Command>& c,
                            Ref::ID ref_id,
-                           MetadataVersion written) noexcept {
+                           const MetadataVersion& written) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -648,8 +763,7 @@ void Build::updateMetadata(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.updateMetadata(source, c, ref_id, written);
+      defer(c, [=] { updateMetadata(_deferred_source, c, ref_id, written); });
       return;
     }
   }
@@ -682,7 +796,7 @@ void Build::updateMetadata(const IRSource& source,
 void Build::updateContent(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Ref::ID ref_id,
-                          shared_ptr<ContentVersion> written) noexcept {
+                          const shared_ptr<ContentVersion>& written) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -699,8 +813,7 @@ void Build::updateContent(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.updateContent(source, c, ref_id, written);
+      defer(c, [=] { updateContent(_deferred_source, c, ref_id, written); });
       return;
     }
   }
@@ -733,7 +846,7 @@ void Build::updateContent(const IRSource& source,
 void Build::addEntry(const IRSource& source,
                      const shared_ptr<Command>& c,
                      Ref::ID dir_id,
-                     string name,
+                     const string& name,
                      Ref::ID target_id) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -751,8 +864,7 @@ void Build::addEntry(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.addEntry(source, c, dir_id, name, target_id);
+      defer(c, [=] { addEntry(_deferred_source, c, dir_id, name, target_id); });
       return;
     }
   }
@@ -761,21 +873,25 @@ void Build::addEntry(const IRSource& source,
   auto dir = c->getRef(dir_id);
   auto target = c->getRef(target_id);
 
+  // A replacement entry name, used when a temporary file path is substituted
+  string newname;
+  bool substituted = false;
+
   // Did both references resolve?
   if (dir->isResolved() && target->isResolved()) {
     // Is this adding an entry in /tmp/? If so, do path substitution
     auto dirname = dir->getArtifact()->getName();
     if (dirname.substr(0, 5) == "/tmp/") {
       string newpath = c->substitutePath(dirname + "/" + name);
-      string newname = newpath.substr(dirname.size() + 1);
+      newname = newpath.substr(dirname.size() + 1);
       if (newname != name) {
         LOG(exec) << "Replaced " << name << " with " << newname;
+        substituted = true;
       }
-      name = newname;
     }
 
     // Yes. Add the entry to the directory
-    dir->getArtifact()->addEntry(c, name, target->getArtifact());
+    dir->getArtifact()->addEntry(c, substituted ? newname : name, target->getArtifact());
 
   } else {
     // No. Are we emulating or tracing?
@@ -791,14 +907,14 @@ void Build::addEntry(const IRSource& source,
   }
 
   // Create an IR step and add it to the output trace
-  _output.addEntry(source, c, dir_id, name, target_id);
+  _output.addEntry(source, c, dir_id, substituted ? newname : name, target_id);
 }
 
 // Command c removes an entry from a directory
 void Build::removeEntry(const IRSource& source,
                         const shared_ptr<Command>& c,
                         Ref::ID dir_id,
-                        string name,
+                        const string& name,
                         Ref::ID target_id) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -816,8 +932,7 @@ void Build::removeEntry(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.removeEntry(source, c, dir_id, name, target_id);
+      defer(c, [=] { removeEntry(_deferred_source, c, dir_id, name, target_id); });
       return;
     }
   }
@@ -826,21 +941,25 @@ void Build::removeEntry(const IRSource& source,
   auto dir = c->getRef(dir_id);
   auto target = c->getRef(target_id);
 
+  // A replacement entry name, used when a temporary file path is substituted
+  string newname;
+  bool substituted = false;
+
   // Did both references resolve?
   if (dir->isResolved() && target->isResolved()) {
     // Is this removing an entry in /tmp/? If so, do path substitution
     auto dirname = dir->getArtifact()->getName();
     if (dirname.substr(0, 5) == "/tmp/") {
       string newpath = c->substitutePath(dirname + "/" + name);
-      string newname = newpath.substr(dirname.size() + 1);
+      newname = newpath.substr(dirname.size() + 1);
       if (newname != name) {
         LOG(exec) << "Replaced " << name << " with " << newname;
+        substituted = true;
       }
-      name = newname;
     }
 
     // Yes. Remove the entry from the directory
-    dir->getArtifact()->removeEntry(c, name, target->getArtifact());
+    dir->getArtifact()->removeEntry(c, substituted ? newname : name, target->getArtifact());
 
   } else {
     // No. Are we emulating or tracing?
@@ -856,14 +975,14 @@ void Build::removeEntry(const IRSource& source,
   }
 
   // Create an IR step and add it to the output trace
-  _output.removeEntry(source, c, dir_id, name, target_id);
+  _output.removeEntry(source, c, dir_id, substituted ? newname : name, target_id);
 }
 
 // A parent command launches a child command
 void Build::launch(const IRSource& source,
                    const shared_ptr<Command>& parent,
                    const shared_ptr<Command>& child,
-                   list<tuple<Ref::ID, Ref::ID>> refs) noexcept {
+                   const list<tuple<Ref::ID, Ref::ID>>& refs) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (parent->mustRun() && !source.isExecuting()) return;
 
@@ -880,8 +999,7 @@ void Build::launch(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!parent->isLaunched()) {
-      _deferred_commands.emplace(parent);
-      _deferred_steps.launch(source, parent, child, refs);
+      defer(parent, [=] { launch(_deferred_source, parent, child, refs); });
       return;
     }
   }
@@ -928,13 +1046,21 @@ void Build::launch(const IRSource& source,
   if (parent->canEmulate()) {
     // Yes. We need to launch the child if it is supposed to run
     if (child->mustRun()) {
-      // Start the child command in the tracer and record it as launched
-      child->setLaunched(_tracer.start(*this, child));
+      // Record the child as launched, but hold off on starting it in the tracer. Children that
+      // become ready before the build next waits are started together, so the ones at the head
+      // of the longest dependency chains can go first.
+      child->setLaunched();
+      _pending_starts.push_back(child);
 
     } else {
       // The child command is launched, and has no associated process
       child->setLaunched();
     }
+
+    // If the child has deferred steps, they can run now
+    if (_deferred_steps.find(child) != _deferred_steps.end()) {
+      _released_commands.push_back(child);
+    }
   }
 
   // Print the command if requested
@@ -968,17 +1094,21 @@ void Build::join(const IRSource& source,
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.join(source, c, child, exit_status);
+      defer(c, [=] { join(_deferred_source, c, child, exit_status); });
       return;
     }
   }
 
   // If we're emulating the parent command but the child is running, wait for it now
   if (c->canEmulate() && child->mustRun()) {
-    // If the child command is running in the tracer, wait for it
-    const auto& process = child->getProcess();
-    if (process) _tracer.wait(*this, process);
+    // Start held commands, including the child, as job tokens become available, and wait for
+    // the child to exit. Other held commands may need to start first, like the rest of a
+    // pipeline the child writes to.
+    LOG(exec) << "Waiting for " << child;
+    waitAndStart([&] {
+      const auto& process = child->getProcess();
+      return process && process->hasExited();
+    });
   }
 
   // Create an IR step and add it to the output trace
@@ -995,7 +1125,10 @@ void Build::join(const IRSource& source,
 }
 
 // Command c is exiting
-void Build::exit(const IRSource& source, const shared_ptr<Command>& c, int exit_status) noexcept {
+void Build::exit(const IRSource& source,
+                 const shared_ptr<Command>& c,
+                 int exit_status,
+                 const Command::Usage& usage) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -1012,17 +1145,17 @@ void Build::exit(const IRSource& source, const shared_ptr<Command>& c, int exit_
 
     // If this step comes from a command that hasn't been launched, we need to defer this step
     if (!c->isLaunched()) {
-      _deferred_commands.emplace(c);
-      _deferred_steps.exit(source, c, exit_status);
+      defer(c, [=] { exit(_deferred_source, c, exit_status, usage); });
       return;
     }
   }
 
   // Create an IR step and add it to the output trace
-  _output.exit(source, c, exit_status);
+  _output.exit(source, c, exit_status, usage);
 
-  // Save the exit status for this command
+  // Save the exit status and resource usage for this command
   c->setExitStatus(exit_status);
+  c->setUsage(usage);
 
   // Is this emulated command running in a process? If so, we need to let it exit
   const auto& process = c->getProcess();
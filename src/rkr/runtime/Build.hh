@@ -1,6 +1,8 @@
 #pragma once
 
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
@@ -15,7 +17,6 @@
 
 #include "data/IRSink.hh"
 #include "data/IRSource.hh"
-#include "data/Trace.hh"
 #include "runtime/Ref.hh"
 #include "tracing/Tracer.hh"
 
@@ -31,7 +32,7 @@ class Process;
  * A Build instance manages the execution of a build. This instance is responsible for setting up
  * the build environment, emulating or running each of the commands, and concluding the build.
  */
-class Build : public IRSink {
+class Build final : public IRSink {
  public:
   /// Create a build runner
   Build(IRSink& output, std::ostream& print_to = std::cout) noexcept;
@@ -43,8 +44,9 @@ class Build : public IRSink {
   Build(const Build&) = delete;
   Build& operator=(const Build&) = delete;
 
-  /// Try to run any steps that were deferred because they came from commands that had not launched
-  void runDeferredSteps() noexcept;
+  /// Run the steps that were deferred until a command launched, along with the deferred steps of
+  /// any commands launched by those steps
+  void runDeferredSteps(const std::shared_ptr<Command>& c) noexcept;
 
   /// Print information about this build
   std::ostream& print(std::ostream& o) const noexcept;
@@ -75,7 +77,7 @@ class Build : public IRSink {
   /// A command references a new anonymous symlink
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& c,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override;
 
   /// A command references a new anonymous directory
@@ -88,7 +90,7 @@ class Build : public IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override;
 
@@ -121,46 +123,46 @@ class Build : public IRSink {
                              const std::shared_ptr<Command>& c,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override;
+                             const MetadataVersion& expected) noexcept override;
 
   /// A command accesses content for an artifact and expects to find a particular version
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& c,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override;
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override;
 
   /// A command modifies the metadata for an artifact
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& c,
                               Ref::ID,
-                              MetadataVersion written) noexcept override;
+                              const MetadataVersion& written) noexcept override;
 
   /// A command writes a new version to an artifact
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& c,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> written) noexcept override;
+                             const std::shared_ptr<ContentVersion>& written) noexcept override;
 
   /// A command adds an entry to a directory
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override;
 
   /// A command removes an entry from a directory
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override;
 
   /// A parent command is launching a child command
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& parent,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override;
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override;
 
   /// A command is joining with a child command
   virtual void join(const IRSource& source,
@@ -171,7 +173,8 @@ class Build : public IRSink {
   /// A command has exited with an exit code
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& c,
-                    int exit_status) noexcept override;
+                    int exit_status,
+                    const Command::Usage& usage) noexcept override;
 
   /// Finish running a build
   virtual void finish() noexcept override;
@@ -185,8 +188,56 @@ class Build : public IRSink {
   /// Trace steps are sent to this trace handler, typically an OutputTrace
   IRSink& _output;
 
-  /// Deferred trace steps are placed in this buffer for later running
-  TraceWriter _deferred_steps;
+  /// A deferred IR step, numbered by the order it was deferred in
+  struct DeferredStep {
+    size_t index;
+    std::function<void()> run;
+  };
+
+  /// Hold an IR step until command c has launched
+  void defer(const std::shared_ptr<Command>& c, std::function<void()> step) noexcept;
+
+  /// Start the commands waiting in _pending_starts, longest critical path first. When a
+  /// jobserver is enabled, commands are only started while job tokens are available, except that
+  /// a command joins the job of a running command it shares a pipe with, as make runs a pipeline.
+  void startPending() noexcept;
+
+  /// Return the job tokens held by started processes that have exited
+  void reclaimTokens() noexcept;
+
+  /// Handle tracing events until done returns true or every process has exited, starting held
+  /// commands whenever a job token may have become available
+  void waitAndStart(std::function<bool()> done) noexcept;
+
+  /// A process started from _pending_starts
+  struct StartedProcess {
+    std::shared_ptr<Process> process;
+
+    /// Does this process hold a job token?
+    bool token;
+
+    /// The pipes in the command's initial file descriptor table
+    std::vector<std::shared_ptr<Artifact>> pipes;
+  };
+
+  /// Commands launched by emulated parents that have not been started in the tracer yet. These
+  /// are held until the build next waits on the tracer so they can be started in priority order.
+  std::vector<std::shared_ptr<Command>> _pending_starts;
+
+  /// Processes started from _pending_starts that may still be running
+  std::list<StartedProcess> _started;
+
+  /// Deferred IR steps, queued in trace order under the command they are waiting for
+  std::map<std::shared_ptr<Command>, std::deque<DeferredStep>> _deferred_steps;
+
+  /// The index assigned to the next deferred step
+  size_t _next_deferred_index = 0;
+
+  /// Commands launched by deferred steps whose own deferred steps are now ready to run
+  std::vector<std::shared_ptr<Command>> _released_commands;
+
+  /// Deferred steps are replayed from a saved trace, so they are sent from an emulated source
+  EmulatedIRSource _deferred_source;
 
   /// The set of deferred commands
   std::set<std::shared_ptr<Command>> _deferred_commands;
@@ -1,5 +1,7 @@
 #include "Command.hh"
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <list>
 #include <map>
@@ -11,6 +13,7 @@
 
 #include "artifacts/Artifact.hh"
 #include "artifacts/DirArtifact.hh"
+#include "runtime/CommandGraph.hh"
 #include "runtime/env.hh"
 #include "tracing/Process.hh"
 #include "util/options.hh"
@@ -241,184 +244,173 @@ void Command::finishRun() noexcept {
   }
 }
 
-// Plan the next build based on this command's completed run
+// Plan the next build based on the completed run of this command and its descendants
 void Command::planBuild() noexcept {
   // See rebuild planning rules in docs/new-rebuild.md
-  // Rules 1 & 2: If this command observe a change on its previous run, mark it for rerun
-  if (_previous_run._changed == Scenario::Both) {
-    if (mark(RebuildMarking::MustRun)) {
-      LOGF(rebuild, "{} must run: input changed or output is missing/modified", *this);
-    }
+  CommandGraph graph(shared_from_this());
+
+  // Start with the markings commands already have. Markings are only propagated when they are new.
+  vector<bool> must_run(graph.size());
+  vector<bool> may_run(graph.size());
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    must_run[i] = graph.getCommand(i)->mustRun();
+    may_run[i] = graph.getCommand(i)->mayRun();
   }
 
-  // Recursively call planBuild on all children
-  for (const auto& child : _previous_run._children) {
-    child->planBuild();
-  }
-}
+  // Commands with a new MustRun marking that still need to be propagated
+  vector<uint32_t> worklist;
 
-// Does this command or any of its descendants need to run? If not, return true.
-bool Command::allFinished() const noexcept {
-  if (mustRun()) {
-    LOG(rebuild) << this << " must run";
-    return false;
+  // Rules 1 & 2: If a command observed a change on its previous run, mark it for rerun
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    if (graph.getCommand(i)->_previous_run._changed == Scenario::Both && !must_run[i]) {
+      must_run[i] = true;
+      worklist.push_back(i);
+      LOGF(rebuild, "{} must run: input changed or output is missing/modified",
+           graph.getCommand(i));
+    }
   }
 
-  for (const auto& child : _previous_run._children) {
-    if (!child->allFinished()) return false;
-  }
+  // Commands that were newly marked MustRun, in the order they were marked
+  vector<uint32_t> new_must_run = worklist;
 
-  return true;
-}
+  while (!worklist.empty()) {
+    uint32_t i = worklist.back();
+    worklist.pop_back();
 
-// Get a set of all commands including this one and its descendants
-set<shared_ptr<Command>> Command::collectCommands() noexcept {
-  set<shared_ptr<Command>> result;
-  result.insert(shared_from_this());
-  for (const auto& child : getChildren()) {
-    for (const auto& include : child->collectCommands()) {
-      result.insert(include);
-    }
+    // Rule 3: For each command D that produces uncached input V to C: mark D as MustRun
+    graph.needsOutputFrom().forEach(i, [&](uint32_t d) {
+      if (must_run[d]) return;
+      must_run[d] = true;
+      worklist.push_back(d);
+      new_must_run.push_back(d);
+      LOGF(rebuild, "{} must run: {} requires output for its run", graph.getCommand(d),
+           graph.getCommand(i));
+    });
+
+    // Rule 5: For each command D that consumes uncached output V from C: mark D as MustRun
+    graph.outputNeededBy().forEach(i, [&](uint32_t d) {
+      if (must_run[d]) return;
+      must_run[d] = true;
+      worklist.push_back(d);
+      new_must_run.push_back(d);
+      LOGF(rebuild, "{} must run: {} may change uncached input during its run",
+           graph.getCommand(d), graph.getCommand(i));
+    });
   }
 
-  return result;
-}
-
-// Get a set of all commands that may run from this command and its descendants
-set<shared_ptr<Command>> Command::collectMayRun() noexcept {
-  set<shared_ptr<Command>> result;
-  if (mayRun()) {
-    result.insert(shared_from_this());
+  // Rule 5: For each command D that consumes cached output V from C: mark D as MayRun
+  for (uint32_t i : new_must_run) {
+    graph.outputUsedBy().forEach(i, [&](uint32_t d) {
+      if (must_run[d] || may_run[d]) return;
+      may_run[d] = true;
+      worklist.push_back(d);
+      LOGF(rebuild, "{} may run: {} may change input during its run", graph.getCommand(d),
+           graph.getCommand(i));
+    });
   }
 
-  for (const auto& child : getChildren()) {
-    for (const auto& include : child->collectMayRun()) {
-      result.insert(include);
-    }
-  }
+  while (!worklist.empty()) {
+    uint32_t i = worklist.back();
+    worklist.pop_back();
 
-  return result;
-}
+    // Rule 6: For each command D that produces uncached input V to C: mark D as MayRun
+    graph.needsOutputFrom().forEach(i, [&](uint32_t d) {
+      if (must_run[d] || may_run[d]) return;
+      may_run[d] = true;
+      worklist.push_back(d);
+      LOGF(rebuild, "{} may run: {} will require output if it runs", graph.getCommand(d),
+           graph.getCommand(i));
+    });
 
-// Get a set of all commands that must run from this command and its descendants
-set<shared_ptr<Command>> Command::collectMustRun() noexcept {
-  set<shared_ptr<Command>> result;
-  if (mustRun()) {
-    result.insert(shared_from_this());
+    // Rule 7: For each command D that consumes output V from C: mark D as MayRun
+    graph.outputUsedBy().forEach(i, [&](uint32_t d) {
+      if (must_run[d] || may_run[d]) return;
+      may_run[d] = true;
+      worklist.push_back(d);
+      LOGF(rebuild, "{} may run: {} may change input if it runs", graph.getCommand(d),
+           graph.getCommand(i));
+    });
   }
 
-  for (const auto& child : getChildren()) {
-    for (const auto& include : child->collectMustRun()) {
-      result.insert(include);
+  // Apply the new markings
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    if (must_run[i]) {
+      graph.getCommand(i)->_marking = RebuildMarking::MustRun;
+    } else if (may_run[i]) {
+      graph.getCommand(i)->_marking = RebuildMarking::MayRun;
     }
   }
 
-  return result;
-}
-
-// Assign a marking to this command. Return true if the marking is new.
-bool Command::mark(RebuildMarking m) noexcept {
-  // See rebuild planning rules in docs/new-rebuild.md
-
-  // Check the new marking
-  if (m == RebuildMarking::MustRun) {
-    // If this command already had an equivalent or higher marking, return false.
-    // There's no need to propagate this marking because it is not new.
-    if (_marking == RebuildMarking::MustRun) {
-      return false;
-    }
-
-    // Update the marking
-    _marking = RebuildMarking::MustRun;
-
-    // Rule 3: For each command D that produces uncached input V to C: mark D as MustRun
-    for (const auto& weak_producer : _previous_run._needs_output_from) {
-      auto producer = weak_producer.lock();
-      if (producer->mark(RebuildMarking::MustRun)) {
-        LOGF(rebuild, "{} must run: {} requires output for its run", producer, *this);
-      }
-    }
+  // Find the longest chain of recorded run time from each command through the commands that use
+  // its outputs. Only commands that may run add their time to a chain.
+  vector<uint64_t> weights(graph.size(), 0);
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    if (must_run[i] || may_run[i]) weights[i] = graph.getCommand(i)->getLastUsage().wall_ns;
+  }
+  auto path = graph.longestPaths(weights);
 
-    // Rule 4: For each command D that produces input V to C: if D is marked MayRun, mark D as
-    // MustRun
-    /*for (const auto& [weak_producer, info] : _previous_run._uses_output_from) {
-      auto producer = weak_producer.lock();
-      auto [a, v] = info;
-      if (producer->_marking == RebuildMarking::MayRun) {
-        producer->mark(RebuildMarking::MustRun);
-        LOGF(
-            rebuild,
-            "{} must run: may change output {} of {} needed by {}, which is already marked for run",
-            producer, v, a, this);
-      }
-    }*/
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    graph.getCommand(i)->_critical_path_ns = path[i];
+  }
+}
 
-    // Rule 5: For each command D that consumes output V from C: if V is cached mark D as MayRun. If
-    // not, mark D as MustRun.
+// Visit a command and its descendants in preorder, stopping early if f returns false
+template <class C, class F>
+bool Command::walk(C* root, F f) noexcept {
+  vector<C*> stack = {root};
+  while (!stack.empty()) {
+    auto c = stack.back();
+    stack.pop_back();
 
-    // Mark the MustRun commands first to avoid marking them a second time
-    for (const auto& weak_user : _previous_run._output_needed_by) {
-      auto user = weak_user.lock();
-      if (user->mark(RebuildMarking::MustRun)) {
-        LOGF(rebuild, "{} must run: {} may change uncached input during its run", user, *this);
-      }
-    }
+    if (!f(c)) return false;
 
-    // Now do the MayRun markings
-    for (const auto& weak_user : _previous_run._output_used_by) {
-      auto user = weak_user.lock();
-      if (user->mark(RebuildMarking::MayRun)) {
-        LOGF(rebuild, "{} may run: {} may change input during its run", user, *this);
-      }
+    const auto& children = c->_previous_run._children;
+    for (auto iter = children.rbegin(); iter != children.rend(); iter++) {
+      stack.push_back(iter->get());
     }
+  }
+  return true;
+}
 
-    // The marking was new, so return true
-    return true;
-
-  } else if (m == RebuildMarking::MayRun) {
-    // If this command already had an equivalent or higher marking, return false.
-    // There's no need to propagate this marking becasue it is not new.
-    if (_marking == RebuildMarking::MayRun || _marking == RebuildMarking::MustRun) {
+// Does this command or any of its descendants need to run? If not, return true.
+bool Command::allFinished() const noexcept {
+  return walk(this, [](const Command* c) {
+    if (c->mustRun()) {
+      LOG(rebuild) << c << " must run";
       return false;
     }
+    return true;
+  });
+}
 
-    // Update the marking
-    _marking = RebuildMarking::MayRun;
-
-    // Rule 6: For each command D that produces uncached input V to C: mark D as MayRun.
-    for (const auto& weak_producer : _previous_run._needs_output_from) {
-      auto producer = weak_producer.lock();
-      if (producer->mark(RebuildMarking::MayRun)) {
-        LOGF(rebuild, "{} may run: {} will require output if it runs", producer, *this);
-      }
-    }
-
-    // Rule 7: For each command D that consumes output V from C: mark D as MayRun
-    for (const auto& weak_user : _previous_run._output_used_by) {
-      auto user = weak_user.lock();
-      if (user->mark(RebuildMarking::MayRun)) {
-        LOGF(rebuild, "{} may run: {} may change input if it runs", user, *this);
-      }
-    }
-
-    // Rule 8: For each command D that consumes output V from C: if D is marked MustRun, mark C as
-    // MustRun
-    /*for (const auto& [weak_user, info] : _previous_run._output_used_by) {
-      auto user = weak_user.lock();
-      auto [a, v] = info;
-      if (user->_marking == RebuildMarking::MustRun) {
-        mark(RebuildMarking::MustRun);
-        LOGF(rebuild, "{} must run: output {} of {} is needed by command {}", this, v, a, user);
-      }
-    }*/
+// Get a set of all commands including this one and its descendants
+set<shared_ptr<Command>> Command::collectCommands() noexcept {
+  set<shared_ptr<Command>> result;
+  walk(this, [&](Command* c) {
+    result.insert(c->shared_from_this());
+    return true;
+  });
+  return result;
+}
 
-    // The marking was new, so return true
+// Get a set of all commands that may run from this command and its descendants
+set<shared_ptr<Command>> Command::collectMayRun() noexcept {
+  set<shared_ptr<Command>> result;
+  walk(this, [&](Command* c) {
+    if (c->mayRun()) result.insert(c->shared_from_this());
     return true;
+  });
+  return result;
+}
 
-  } else {
-    // Emulate and AlreadyRun are never new markings
-    return false;
-  }
+// Get a set of all commands that must run from this command and its descendants
+set<shared_ptr<Command>> Command::collectMustRun() noexcept {
+  set<shared_ptr<Command>> result;
+  walk(this, [&](Command* c) {
+    if (c->mustRun()) result.insert(c->shared_from_this());
+    return true;
+  });
+  return result;
 }
 
 /******************** Current Run Data ********************/
@@ -461,6 +453,9 @@ bool Command::isLaunched() noexcept {
 void Command::setLaunched(shared_ptr<Process> p) noexcept {
   _current_run._launched = true;
   _current_run._process = p;
+
+  // Time runs that actually execute
+  if (p) _current_run._start_time = std::chrono::steady_clock::now();
 }
 
 const shared_ptr<Process>& Command::getProcess() noexcept {
@@ -477,6 +472,24 @@ void Command::setExitStatus(int status) noexcept {
   _current_run._exit_status = status;
 }
 
+// Get the time since this command was launched in a traced process
+uint64_t Command::getElapsedTime() const noexcept {
+  if (!_current_run._start_time.has_value()) return 0;
+  auto elapsed = std::chrono::steady_clock::now() - _current_run._start_time.value();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+uint64_t Command::getStartOffset() const noexcept {
+  auto parent = _current_run._parent.lock();
+  if (!parent || !parent->_current_run._start_time.has_value() ||
+      !_current_run._start_time.has_value()) {
+    return 0;
+  }
+
+  auto offset = _current_run._start_time.value() - parent->_current_run._start_time.value();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(offset).count();
+}
+
 // Apply a set of substitutions to this command and save the mappings for future paths
 void Command::applySubstitutions(map<string, string> substitutions) noexcept {
   _short_names.clear();
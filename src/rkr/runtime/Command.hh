@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
@@ -203,6 +204,27 @@ class Command : public std::enable_shared_from_this<Command> {
 
   /****** Types and struct used to track run-specific data ******/
 
+  /// The resources used by one run of a command
+  struct Usage {
+    /// The time from launch to exit, in nanoseconds
+    uint64_t wall_ns = 0;
+
+    /// The time from the parent's launch to this command's launch, in nanoseconds
+    uint64_t start_ns = 0;
+
+    /// User and system CPU time in nanoseconds, including any descendants the command waited for
+    uint64_t cpu_ns = 0;
+
+    /// The peak resident set size, in kilobytes
+    uint64_t max_rss_kb = 0;
+
+    /// The number of system calls traced while this command ran
+    uint64_t syscalls = 0;
+
+    /// The number of ptrace stops handled for this command's processes
+    uint64_t ptrace_stops = 0;
+  };
+
   using WeakCommandSet = std::set<std::weak_ptr<Command>, std::owner_less<std::weak_ptr<Command>>>;
 
   using InputList =
@@ -247,6 +269,12 @@ class Command : public std::enable_shared_from_this<Command> {
     /// The exit status for this command
     int _exit_status = -1;
 
+    /// When this run was launched in a traced process
+    std::optional<std::chrono::steady_clock::time_point> _start_time;
+
+    /// The resources this run used, as measured when it ran or carried over from an earlier trace
+    Usage _usage;
+
     /// Keep track of the scenarios where this command has observed a change
     Scenario _changed = Scenario::None;
 
@@ -292,6 +320,25 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Set this command's exit status, and record that it has exited
   void setExitStatus(int status) noexcept;
 
+  /// Get the time elapsed since this command was launched in a traced process, in nanoseconds
+  uint64_t getElapsedTime() const noexcept;
+
+  /// Get the time from the parent's launch to this command's launch, in nanoseconds. Returns zero
+  /// unless both were launched in traced processes.
+  uint64_t getStartOffset() const noexcept;
+
+  /// Get the resources used by this command's run so far
+  const Usage& getUsage() const noexcept { return _current_run._usage; }
+
+  /// Save the resources used by this command's run
+  void setUsage(Usage usage) noexcept { _current_run._usage = usage; }
+
+  /// Count a system call traced in this command's run
+  void countSyscall() noexcept { _current_run._usage.syscalls++; }
+
+  /// Count a ptrace stop handled for this command's run
+  void countPtraceStop() noexcept { _current_run._usage.ptrace_stops++; }
+
   /// Apply a set of subsitutions to this command's arguments, and save the set for future path
   /// substitutions
   void applySubstitutions(std::map<std::string, std::string> substitutions) noexcept;
@@ -373,6 +420,13 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Get the set of commands that produce inputs to this command
   const WeakCommandSet& getInputProducers() const noexcept;
 
+  /// Get the resources this command used on its last run
+  const Usage& getLastUsage() const noexcept { return _previous_run._usage; }
+
+  /// Get the run time of the longest chain of commands starting with this one and following the
+  /// commands that use its outputs. Computed by planBuild, and used to start long chains first.
+  uint64_t getCriticalPath() const noexcept { return _critical_path_ns; }
+
   /**
    * Does this command match a given set of launch arguments? If so, return a set of
    * substitutions required to make the match work. These substitutions should be applied if the
@@ -403,9 +457,10 @@ class Command : public std::enable_shared_from_this<Command> {
   }
 
  private:
-  /// Assign a marking to this command for the next build. Returns true if this is a new
-  /// marking.
-  bool mark(RebuildMarking marking) noexcept;
+  /// Call f(c) for root and each of its descendants in preorder, stopping early if f returns
+  /// false. Returns false if the walk stopped early.
+  template <class C, class F>
+  static bool walk(C* root, F f) noexcept;
 
  private:
   /// The arguments passed to this command on startup
@@ -435,6 +490,14 @@ class Command : public std::enable_shared_from_this<Command> {
   // ID for this command and the buffer it is identified in
   Command::ID _id;
   size_t _buffer_id;
+
+  /// This command's index in the most recent CommandGraph that included it
+  uint32_t _graph_index = 0;
+
+  /// The critical path length through this command computed by the last planBuild
+  uint64_t _critical_path_ns = 0;
+
+  friend class CommandGraph;
 };
 
 template <>
@@ -0,0 +1,106 @@
+#include "CommandGraph.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "runtime/Command.hh"
+
+using std::shared_ptr;
+using std::vector;
+
+CommandGraph::CommandGraph(const shared_ptr<Command>& root) noexcept {
+  // Number the commands in preorder. Children are pushed in reverse so they are visited in order.
+  vector<const shared_ptr<Command>*> stack = {&root};
+  while (!stack.empty()) {
+    const auto& c = *stack.back();
+    stack.pop_back();
+
+    c->_graph_index = _commands.size();
+    _commands.push_back(c);
+
+    const auto& children = c->_previous_run._children;
+    for (auto iter = children.rbegin(); iter != children.rend(); iter++) {
+      stack.push_back(&*iter);
+    }
+  }
+
+  buildRelation(_needs_output_from, [](Command& c) -> auto& {
+    return c._previous_run._needs_output_from;
+  });
+  buildRelation(_output_used_by, [](Command& c) -> auto& {
+    return c._previous_run._output_used_by;
+  });
+  buildRelation(_output_needed_by, [](Command& c) -> auto& {
+    return c._previous_run._output_needed_by;
+  });
+}
+
+template <class GetSet>
+void CommandGraph::buildRelation(Relation& r, GetSet get_set) noexcept {
+  r._offsets.reserve(_commands.size() + 1);
+  r._offsets.push_back(0);
+
+  for (const auto& c : _commands) {
+    for (const auto& weak_other : get_set(*c)) {
+      // Commands that are gone or no longer part of the tree have no marking to update
+      auto other = weak_other.lock();
+      auto index = indexOf(other.get());
+      if (index >= 0) r._targets.push_back(index);
+    }
+    r._offsets.push_back(r._targets.size());
+  }
+}
+
+vector<uint64_t> CommandGraph::longestPaths(const vector<uint64_t>& weights) const noexcept {
+  enum : uint8_t { Unvisited, Active, Done };
+  vector<uint8_t> state(size(), Unvisited);
+  vector<uint64_t> path(size(), 0);
+
+  // The stack holds each command being visited and the index of the next edge to follow from it
+  vector<std::pair<uint32_t, uint32_t>> stack;
+  for (uint32_t root = 0; root < size(); root++) {
+    if (state[root] != Unvisited) continue;
+    state[root] = Active;
+    stack.emplace_back(root, 0);
+
+    while (!stack.empty()) {
+      uint32_t i = stack.back().first;
+      uint32_t k = stack.back().second++;
+
+      if (k < _output_used_by.degree(i)) {
+        uint32_t d = _output_used_by.target(i, k);
+        if (state[d] == Unvisited) {
+          state[d] = Active;
+          stack.emplace_back(d, 0);
+        } else if (state[d] == Done) {
+          path[i] = std::max(path[i], path[d]);
+        }
+
+      } else {
+        // Every edge has been followed, so the path from this command is complete
+        path[i] += weights[i];
+        state[i] = Done;
+        stack.pop_back();
+        if (!stack.empty()) {
+          uint32_t parent = stack.back().first;
+          path[parent] = std::max(path[parent], path[i]);
+        }
+      }
+    }
+  }
+
+  return path;
+}
+
+int64_t CommandGraph::indexOf(const Command* c) const noexcept {
+  if (c == nullptr) return -1;
+
+  // A stale index may be left over from a graph of an earlier tree
+  if (c->_graph_index >= _commands.size() || _commands[c->_graph_index].get() != c) return -1;
+
+  return c->_graph_index;
+}
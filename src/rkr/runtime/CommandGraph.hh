@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Command;
+
+/**
+ * A snapshot of a command tree and the dependencies recorded on each command's previous run. Each
+ * command is given a dense index in preorder, and each dependency relation is stored in compressed
+ * sparse row form so rebuild planning can walk it without locking weak pointers or touching sets.
+ */
+class CommandGraph {
+ public:
+  /// The edges of one relation in compressed sparse row form
+  class Relation {
+   public:
+    /// Call f(j) for each command index j that command i has an edge to
+    template <class F>
+    void forEach(uint32_t i, F f) const noexcept {
+      for (uint32_t k = _offsets[i]; k < _offsets[i + 1]; k++) f(_targets[k]);
+    }
+
+    /// Get the number of edges from command i
+    uint32_t degree(uint32_t i) const noexcept { return _offsets[i + 1] - _offsets[i]; }
+
+    /// Get the index of the command at the end of command i's k-th edge
+    uint32_t target(uint32_t i, uint32_t k) const noexcept { return _targets[_offsets[i] + k]; }
+
+   private:
+    friend class CommandGraph;
+
+    /// The edges from command i are _targets[_offsets[i]] up to _targets[_offsets[i + 1]]
+    std::vector<uint32_t> _offsets;
+
+    /// The index of the command at the end of each edge
+    std::vector<uint32_t> _targets;
+  };
+
+  /// Build a graph of a command and all of its descendants
+  CommandGraph(const std::shared_ptr<Command>& root) noexcept;
+
+  /// Get the number of commands in the graph
+  size_t size() const noexcept { return _commands.size(); }
+
+  /// Get the command with a given index
+  const std::shared_ptr<Command>& getCommand(uint32_t i) const noexcept { return _commands[i]; }
+
+  /// For each command, the commands that produce uncached inputs to it
+  const Relation& needsOutputFrom() const noexcept { return _needs_output_from; }
+
+  /// For each command, the commands that use its outputs
+  const Relation& outputUsedBy() const noexcept { return _output_used_by; }
+
+  /// For each command, the commands that require its uncached outputs
+  const Relation& outputNeededBy() const noexcept { return _output_needed_by; }
+
+  /// Find the heaviest chain that starts at each command and follows outputUsedBy edges, where
+  /// each command adds its weight. A dependency cycle is cut at the edge that returns to a command
+  /// still being visited.
+  std::vector<uint64_t> longestPaths(const std::vector<uint64_t>& weights) const noexcept;
+
+ private:
+  /// Fill in a relation from one of the weak command sets on each command's previous run
+  template <class GetSet>
+  void buildRelation(Relation& r, GetSet get_set) noexcept;
+
+  /// Get the index of a command in this graph, or -1 if it is not part of the graph
+  int64_t indexOf(const Command* c) const noexcept;
+
+  /// The commands in the graph, in preorder
+  std::vector<std::shared_ptr<Command>> _commands;
+
+  Relation _needs_output_from;
+  Relation _output_used_by;
+  Relation _output_needed_by;
+};
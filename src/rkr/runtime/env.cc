@@ -1,5 +1,6 @@
 #include "env.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <filesystem>
 #include <list>
@@ -7,7 +8,9 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -21,7 +24,9 @@
 #include "artifacts/SpecialArtifact.hh"
 #include "artifacts/SymlinkArtifact.hh"
 #include "runtime/Command.hh"
+#include "util/RemoteCache.hh"
 #include "util/log.hh"
+#include "util/parallel.hh"
 #include "util/stats.hh"
 #include "util/wrappers.hh"
 #include "versions/DirVersion.hh"
@@ -36,6 +41,8 @@ using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::string;
+using std::tuple;
+using std::vector;
 using std::weak_ptr;
 
 namespace fs = std::filesystem;
@@ -56,6 +63,12 @@ namespace env {
   /// A map of artifacts identified by inode
   map<pair<dev_t, ino_t>, weak_ptr<Artifact>> _inodes;
 
+  /// Files with comparisons queued during checkFinalState, with the path to compare and the result
+  vector<tuple<shared_ptr<FileArtifact>, fs::path, bool>>* _queued_checks = nullptr;
+
+  /// Files with work queued during commitAll, or nullptr when commitAll is not running
+  vector<shared_ptr<FileArtifact>>* _queued_commits = nullptr;
+
   // Reset the state of the environment by clearing all known artifacts
   void rollback() noexcept {
     _stdin.reset();
@@ -64,11 +77,105 @@ namespace env {
     if (_root_dir) _root_dir->rollback();
   }
 
+  // Drop every known artifact so the model is rebuilt from the filesystem on next use
+  void reset() noexcept {
+    _stdin.reset();
+    _stdout.reset();
+    _stderr.reset();
+    _root_dir.reset();
+    _artifacts.clear();
+    _inodes.clear();
+  }
+
   // Fingerprint and cache any versions on the filesystem
-  void cacheAll() noexcept { getRootDir()->cacheAll("/"); }
+  void cacheAll() noexcept {
+    ScopedTimer timer(Timer::Cache);
+    getRootDir()->cacheAll("/");
+
+    // Upload newly-cached files to the remote cache, if there is one
+    remote_cache::flush();
+  }
+
+  // Compare the final state of all artifacts to the filesystem
+  void checkFinalState() noexcept {
+    // Walk the tree to collect the files that need to be compared
+    vector<tuple<shared_ptr<FileArtifact>, fs::path, bool>> queued;
+    _queued_checks = &queued;
+    getRootDir()->checkFinalState("/");
+    _queued_checks = nullptr;
+
+    // A file with several links is queued once per path, but is only compared at the first one
+    auto same_file = [](const auto& a, const auto& b) { return std::get<0>(a) == std::get<0>(b); };
+    std::stable_sort(queued.begin(), queued.end(), [](const auto& a, const auto& b) {
+      return std::get<0>(a) < std::get<0>(b);
+    });
+    queued.erase(std::unique(queued.begin(), queued.end(), same_file), queued.end());
+
+    // Compare files to their on-disk state in parallel. This may stat and hash each file.
+    parallel_for(queued.size(), [&](size_t i) {
+      auto& [artifact, path, matches] = queued[i];
+      matches = artifact->compareFinalState(path);
+    });
+
+    // Commit matching versions and report changed outputs on this thread, since reporting a
+    // change updates the creating command
+    for (auto& [artifact, path, matches] : queued) {
+      artifact->finishCheck(matches);
+    }
+
+    // Fingerprint and cache the final state of each file in parallel
+    parallel_for(queued.size(), [&](size_t i) {
+      auto& [artifact, path, matches] = queued[i];
+      artifact->cacheAll(path);
+    });
+  }
+
+  bool queueCheck(shared_ptr<FileArtifact> a, fs::path path) noexcept {
+    if (_queued_checks == nullptr) return false;
+    _queued_checks->emplace_back(std::move(a), std::move(path), false);
+    return true;
+  }
 
   // Commit all changes to the filesystem
-  void commitAll() noexcept { getRootDir()->applyFinalState("/"); }
+  void commitAll() noexcept {
+    ScopedTimer timer(Timer::Commit);
+
+    // Directories and links are committed in order as the tree is walked, since each one can
+    // depend on the ones before it. File contents are queued instead of written.
+    vector<shared_ptr<FileArtifact>> queued;
+    _queued_commits = &queued;
+    getRootDir()->applyFinalState("/");
+    _queued_commits = nullptr;
+
+    // A file with several links may be queued more than once, but must only be finished once
+    std::sort(queued.begin(), queued.end());
+    queued.erase(std::unique(queued.begin(), queued.end()), queued.end());
+
+    // Write, fingerprint, and cache the queued files in parallel
+    parallel_for(queued.size(), [&](size_t i) { queued[i]->finishCommit(); });
+  }
+
+  // Take deferred hashes of files that commands marked to run may overwrite
+  void resolvePendingHashes() noexcept {
+    vector<shared_ptr<FileArtifact>> queued;
+    for (const auto& weak : _artifacts) {
+      auto a = weak.lock();
+      if (!a) continue;
+
+      auto f = a->as<FileArtifact>();
+      if (f && f->needsPendingHash()) queued.push_back(f);
+    }
+
+    // Hash the files on worker threads, so a traced command never waits for a whole-file hash
+    // taken just before it overwrites its own output
+    parallel_for(queued.size(), [&](size_t i) { queued[i]->resolvePendingHash(); });
+  }
+
+  bool queueCommit(shared_ptr<FileArtifact> a) noexcept {
+    if (_queued_commits == nullptr) return false;
+    _queued_commits->push_back(std::move(a));
+    return true;
+  }
 
   // Get the set of all artifacts
   const list<weak_ptr<Artifact>>& getArtifacts() noexcept { return _artifacts; }
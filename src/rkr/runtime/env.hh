@@ -12,6 +12,7 @@ namespace fs = std::filesystem;
 class Artifact;
 class Command;
 class DirArtifact;
+class FileArtifact;
 class PipeArtifact;
 class SymlinkArtifact;
 
@@ -23,12 +24,32 @@ namespace env {
   /// Reset the environment to match filesystem state
   void rollback() noexcept;
 
+  /// Discard the entire model of the filesystem, including committed state
+  void reset() noexcept;
+
   /// Fingerprint and cache any versions on the filesystem
   void cacheAll() noexcept;
 
   /// Commit all changes in the environment to the filesystem
   void commitAll() noexcept;
 
+  /// Take the deferred hashes of files that commands marked to run may overwrite, in parallel and
+  /// before any of those commands start
+  void resolvePendingHashes() noexcept;
+
+  /// Compare the final state of every artifact to the filesystem
+  void checkFinalState() noexcept;
+
+  /// Queue a file's final-state comparison to run on a worker thread once checkFinalState has
+  /// visited every artifact. Returns false if checkFinalState is not running, in which case the
+  /// caller must do the comparison itself.
+  bool queueCheck(std::shared_ptr<FileArtifact> a, fs::path path) noexcept;
+
+  /// Queue a file's content write and final state to run on a worker thread once commitAll has
+  /// committed every directory and link. Returns false if commitAll is not running, in which case
+  /// the caller must do the work itself.
+  bool queueCommit(std::shared_ptr<FileArtifact> a) noexcept;
+
   /// Get the standard input pipe
   std::shared_ptr<Artifact> getStdin(const std::shared_ptr<Command>& c) noexcept;
 
@@ -0,0 +1,154 @@
+#include "jobserver.hh"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/constants.hh"
+#include "util/log.hh"
+
+using std::optional;
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace jobserver {
+  /// The non-blocking read end of the token pool, or -1 if there is no jobserver
+  static int _read_fd = -1;
+
+  /// The write end of the token pool
+  static int _write_fd = -1;
+
+  /// The tokens taken from the pool. Make expects the same bytes back, so keep them.
+  static vector<char> _tokens;
+
+  /// Was the pool created by this process?
+  static bool _created = false;
+
+  /// Find the value of the last jobserver option in a MAKEFLAGS string
+  static optional<string> findAuth(const string& makeflags) noexcept {
+    optional<string> result;
+    for (const string option : {"--jobserver-auth=", "--jobserver-fds="}) {
+      size_t pos = makeflags.rfind(option);
+      if (pos == string::npos) continue;
+
+      size_t start = pos + option.size();
+      size_t end = makeflags.find(' ', start);
+      result = makeflags.substr(start, end == string::npos ? string::npos : end - start);
+      break;
+    }
+    return result;
+  }
+
+  /// Connect to a pool described by a jobserver option value, either "fifo:PATH" or "R,W"
+  static bool connect(const string& auth) noexcept {
+    if (auth.rfind("fifo:", 0) == 0) {
+      auto path = auth.substr(5);
+      _read_fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (_read_fd == -1) return false;
+      _write_fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+
+    } else {
+      int read_fd, write_fd;
+      if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) return false;
+
+      // Make closes the pipe for commands it does not consider recursive
+      if (::fcntl(read_fd, F_GETFD) == -1 || ::fcntl(write_fd, F_GETFD) == -1) return false;
+
+      // Open a separate, non-blocking description of the read end. Setting O_NONBLOCK on the
+      // inherited one would change it for every other member of the pool.
+      auto proc_path = "/proc/self/fd/" + std::to_string(read_fd);
+      _read_fd = ::open(proc_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (_read_fd == -1) return false;
+      _write_fd = ::dup(write_fd);
+    }
+
+    if (_write_fd == -1) {
+      ::close(_read_fd);
+      _read_fd = -1;
+      return false;
+    }
+
+    return true;
+  }
+
+  void init(size_t jobs) noexcept {
+    // Join an enclosing make's jobserver if there is one
+    if (char* makeflags = getenv("MAKEFLAGS"); makeflags != nullptr) {
+      if (auto auth = findAuth(makeflags); auth.has_value()) {
+        if (connect(auth.value())) {
+          LOG(exec) << "Joined jobserver " << auth.value();
+          return;
+        }
+        WARN << "Unable to join the jobserver in MAKEFLAGS (" << auth.value() << ")";
+      }
+    }
+
+    if (jobs <= 1) return;
+
+    // Create a FIFO for the pool. Commands may change directories, so advertise an absolute path.
+    auto path = fs::absolute(constants::JobserverFifo);
+    ::unlink(path.c_str());
+    FAIL_IF(::mkfifo(path.c_str(), 0600)) << "Failed to create jobserver FIFO " << path << ": "
+                                          << ERR;
+
+    auto auth = "fifo:" + path.string();
+    FAIL_IF(!connect(auth)) << "Failed to open jobserver FIFO " << path << ": " << ERR;
+    _created = true;
+
+    // This process holds the implicit token, so the pool starts with one fewer than jobs
+    string tokens(jobs - 1, '+');
+    FAIL_IF(::write(_write_fd, tokens.data(), tokens.size()) != (ssize_t)tokens.size())
+        << "Failed to fill jobserver: " << ERR;
+
+    auto advertised = "-j" + std::to_string(jobs) + " --jobserver-auth=" + auth;
+    setenv(EnvironmentVariable, advertised.c_str(), 1);
+    LOG(exec) << "Created jobserver with " << jobs << " jobs at " << path;
+  }
+
+  bool enabled() noexcept {
+    return _read_fd != -1;
+  }
+
+  bool tryAcquire() noexcept {
+    if (_read_fd == -1) return true;
+
+    char token;
+    if (::read(_read_fd, &token, 1) != 1) return false;
+    _tokens.push_back(token);
+    return true;
+  }
+
+  void release() noexcept {
+    if (_tokens.empty()) return;
+
+    char token = _tokens.back();
+    if (::write(_write_fd, &token, 1) == 1) _tokens.pop_back();
+  }
+
+  void shutdown() noexcept {
+    while (!_tokens.empty()) {
+      if (::write(_write_fd, &_tokens.back(), 1) != 1) break;
+      _tokens.pop_back();
+    }
+
+    if (_read_fd != -1) ::close(_read_fd);
+    if (_write_fd != -1) ::close(_write_fd);
+    _read_fd = _write_fd = -1;
+
+    if (_created) {
+      ::unlink(fs::absolute(constants::JobserverFifo).c_str());
+      unsetenv(EnvironmentVariable);
+      _created = false;
+    }
+  }
+}
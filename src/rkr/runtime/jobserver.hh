@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * A client for a GNU make jobserver, which limits how many jobs run at once across every process
+ * that shares its pool of tokens. Each member of the pool may run one job without a token, and
+ * must take a token from the pool for every additional job it runs at the same time.
+ *
+ * When rkr runs under a make that advertises a jobserver in MAKEFLAGS, rkr joins that pool.
+ * Otherwise rkr can create a pool of its own and advertise it to the commands it launches in the
+ * RKR_JOBSERVER environment variable, where the parallel compiler wrapper looks for it.
+ */
+namespace jobserver {
+  /// Environment variable that advertises a jobserver created by rkr, in MAKEFLAGS syntax
+  constexpr const char* EnvironmentVariable = "RKR_JOBSERVER";
+
+  /**
+   * Join the jobserver advertised in MAKEFLAGS, or create one when jobs is greater than one.
+   * \param jobs  The number of jobs allowed at once in a new jobserver, or zero to only join one
+   */
+  void init(size_t jobs) noexcept;
+
+  /// Is there a jobserver limiting the number of jobs?
+  bool enabled() noexcept;
+
+  /// Take a token without blocking. Returns false if none are available.
+  bool tryAcquire() noexcept;
+
+  /// Return a token taken with tryAcquire
+  void release() noexcept;
+
+  /// Return any tokens still held, and remove a jobserver rkr created
+  void shutdown() noexcept;
+}
@@ -136,4 +136,23 @@ namespace policy {
 
     return do_cache;*/
   }
+
+  bool canDeferFingerprint(const shared_ptr<Command>& reader,
+                           const shared_ptr<Command>& writer,
+                           fs::path path) {
+    // Every version is hashed immediately at the highest fingerprint level
+    if (options::fingerprint_level == FingerprintLevel::All) return false;
+
+    // Only outputs of the build can wait. Inputs can be changed outside the build, so their hashes
+    // must be taken while the file still holds the version.
+    if (reader || !writer) return false;
+
+    // Cached versions are stored under their hash, and the cache copies and hashes a file in a
+    // single read. Deferring the hash would not save that read, and a version that is not cached
+    // at the end of the build cannot be restored later. Deferral therefore only applies when
+    // caching is off, or to files the cache policy skips.
+    if (isCacheable(reader, writer, path)) return false;
+
+    return chooseFingerprintType(reader, writer, path) == FingerprintType::Full;
+  }
 }
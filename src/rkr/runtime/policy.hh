@@ -19,4 +19,9 @@ namespace policy {
   bool isCacheable(const std::shared_ptr<Command>& reader,
                    const std::shared_ptr<Command>& writer,
                    fs::path path);
+
+  /// Returns true iff a full fingerprint of the version can wait until a comparison needs it
+  bool canDeferFingerprint(const std::shared_ptr<Command>& reader,
+                           const std::shared_ptr<Command>& writer,
+                           fs::path path);
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "summary.hh"
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "artifacts/Artifact.hh"
+#include "artifacts/PipeArtifact.hh"
+#include "artifacts/SpecialArtifact.hh"
+#include "runtime/env.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+
+using std::ifstream;
+using std::ofstream;
+using std::optional;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+/// The first line of a summary file. Change this if the format changes.
+static const string SummaryHeader = "rkr-summary 2";
+
+/// Hash the Rikerfile arguments and the options that change which commands run or what counts as a
+/// change, so a summary never answers for a build that was asked to do something else
+static string buildKey(const vector<string>& args) noexcept {
+  string key = std::to_string(static_cast<int>(options::fingerprint_level)) + " " +
+               std::to_string(options::parallel_wrapper);
+  for (const auto& arg : args) {
+    key.push_back('\0');
+    key += arg;
+  }
+  return std::to_string(std::hash<string>()(key));
+}
+
+/// Stat a path and format the fields that identify its current state, or nullopt if it is missing
+static optional<string> fingerprint(const fs::path& path) noexcept {
+  struct stat statbuf;
+  if (::lstat(path.c_str(), &statbuf)) return std::nullopt;
+
+  return std::to_string(statbuf.st_mtim.tv_sec) + " " + std::to_string(statbuf.st_mtim.tv_nsec) +
+         " " + std::to_string(statbuf.st_ctim.tv_sec) + " " +
+         std::to_string(statbuf.st_ctim.tv_nsec) + " " + std::to_string(statbuf.st_size) + " " +
+         std::to_string(statbuf.st_ino) + " " + std::to_string(statbuf.st_mode);
+}
+
+/// Was a path modified at or after the given time? Allow for coarse filesystem timestamps.
+static bool modifiedSince(const fs::path& path, struct timespec t) noexcept {
+  struct stat statbuf;
+  if (::lstat(path.c_str(), &statbuf)) return true;
+  return statbuf.st_mtim.tv_sec >= t.tv_sec - 1 || statbuf.st_ctim.tv_sec >= t.tv_sec - 1;
+}
+
+namespace summary {
+  bool isUpToDate(const vector<string>& args) noexcept {
+    ifstream input(constants::BuildSummary);
+    if (!input) return false;
+
+    string line;
+    if (!std::getline(input, line) || line != SummaryHeader) return false;
+
+    if (!std::getline(input, line) || line != buildKey(args)) {
+      LOG(phase) << "Build summary was saved for different arguments or options";
+      return false;
+    }
+
+    // Each entry is a fingerprint line followed by a path line
+    string expected;
+    string path;
+    size_t count = 0;
+    while (std::getline(input, expected) && std::getline(input, path)) {
+      auto observed = fingerprint(path);
+      if (!observed.has_value() || observed.value() != expected) {
+        LOG(phase) << "Build summary does not match at " << path;
+        return false;
+      }
+      count++;
+    }
+
+    LOG(phase) << "Build summary matched " << count << " paths";
+    return count > 0;
+  }
+
+  void save(const vector<string>& args, struct timespec build_start) noexcept {
+    // Collect the path to every file and directory in the model
+    set<fs::path> paths = {constants::DatabaseFilename};
+    for (const auto& weak_artifact : env::getArtifacts()) {
+      auto a = weak_artifact.lock();
+      if (!a) continue;
+
+      // Pipes and special files do not have stable fingerprints
+      if (a->as<PipeArtifact>() || a->as<SpecialArtifact>()) continue;
+
+      auto path = a->getCommittedPath();
+      if (!path.has_value()) continue;
+
+      // The summary file separates entries with newlines
+      if (path.value().string().find('\n') != string::npos) return;
+
+      paths.insert(path.value());
+    }
+
+    fs::path tmp = constants::BuildSummary;
+    tmp += ".tmp";
+    ofstream output(tmp);
+    output << SummaryHeader << "\n" << buildKey(args) << "\n";
+
+    for (const auto& path : paths) {
+      // Anything modified since the build started may have changed after it was checked
+      if (modifiedSince(path, build_start)) {
+        LOG(phase) << "Not saving a build summary because " << path << " changed during the build";
+        output.close();
+        ::unlink(tmp.c_str());
+        return;
+      }
+
+      auto fp = fingerprint(path);
+      if (!fp.has_value()) continue;
+      output << fp.value() << "\n" << path.string() << "\n";
+    }
+
+    output.close();
+    if (!output || ::rename(tmp.c_str(), constants::BuildSummary.c_str())) {
+      LOG(phase) << "Failed to save build summary: " << ERR;
+      ::unlink(tmp.c_str());
+    }
+  }
+
+  void remove() noexcept { ::unlink(constants::BuildSummary.c_str()); }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+/**
+ * A build summary records the filesystem state that a fully up-to-date build depends on: every
+ * file and directory in the model of the build, along with its stat fingerprint. When none of
+ * those paths has changed, the next build can skip emulation entirely. A summary costs one lstat
+ * per input or output, regardless of the number of IR steps in the trace. The summary also records
+ * the Rikerfile arguments and the options that change what a build does, and only applies to a
+ * build with the same ones.
+ */
+namespace summary {
+  /**
+   * Does the saved summary show that nothing has changed since the last up-to-date build?
+   * \param args The arguments this build passes to the Rikerfile
+   */
+  bool isUpToDate(const std::vector<std::string>& args) noexcept;
+
+  /**
+   * Save a summary of the current model of the filesystem. This should only be called at the end
+   * of a build that had no commands to run. Paths modified after the build started cannot be
+   * trusted, so no summary is saved if any are found.
+   * \param args The arguments the build passed to the Rikerfile
+   * \param build_start The time the build started emulating its trace
+   */
+  void save(const std::vector<std::string>& args, struct timespec build_start) noexcept;
+
+  /// Remove any saved summary
+  void remove() noexcept;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "runtime/Ref.hh"
+
+/**
+ * A process' file descriptor table. Entries are stored in a dense array indexed by fd number, with
+ * bitsets to track which entries are open and which are closed on exec. Copies share storage until
+ * one of them is modified, so forking a process does not copy its table.
+ */
+class FDTable {
+ public:
+  /// Create an empty file descriptor table
+  FDTable() noexcept : _data(std::make_shared<Data>()) {}
+
+  /// Check if this table has an entry for a file descriptor
+  bool contains(int fd) const noexcept {
+    return fd >= 0 && static_cast<size_t>(fd) < _data->refs.size() && test(_data->open, fd);
+  }
+
+  /// Get the reference for an open file descriptor
+  Ref::ID getRef(int fd) const noexcept { return _data->refs[fd]; }
+
+  /// Check if an open file descriptor is closed on exec
+  bool isCloexec(int fd) const noexcept { return test(_data->cloexec, fd); }
+
+  /// Add or replace the entry for a file descriptor
+  void set(int fd, Ref::ID ref, bool cloexec) noexcept {
+    auto& data = modify();
+    if (static_cast<size_t>(fd) >= data.refs.size()) {
+      data.refs.resize(fd + 1);
+      data.open.resize(fd / 64 + 1);
+      data.cloexec.resize(fd / 64 + 1);
+    }
+
+    if (!test(data.open, fd)) data.count++;
+    data.refs[fd] = ref;
+    assign(data.open, fd, true);
+    assign(data.cloexec, fd, cloexec);
+  }
+
+  /// Set the close-on-exec flag for an open file descriptor
+  void setCloexec(int fd, bool cloexec) noexcept {
+    if (isCloexec(fd) != cloexec) assign(modify().cloexec, fd, cloexec);
+  }
+
+  /// Remove the entry for an open file descriptor
+  void erase(int fd) noexcept {
+    auto& data = modify();
+    assign(data.open, fd, false);
+    assign(data.cloexec, fd, false);
+    data.count--;
+  }
+
+  /// Remove all entries
+  void clear() noexcept { _data = std::make_shared<Data>(); }
+
+  /// Get the number of open file descriptors
+  size_t size() const noexcept { return _data->count; }
+
+  /// Call f(fd, ref, cloexec) for each open file descriptor, in order
+  template <class F>
+  void forEach(F f) const noexcept {
+    const auto& data = *_data;
+    for (size_t word = 0; word < data.open.size(); word++) {
+      for (uint64_t bits = data.open[word]; bits != 0; bits &= bits - 1) {
+        int fd = word * 64 + __builtin_ctzll(bits);
+        f(fd, data.refs[fd], test(data.cloexec, fd));
+      }
+    }
+  }
+
+ private:
+  struct Data {
+    /// The reference for each file descriptor, indexed by fd number
+    std::vector<Ref::ID> refs;
+
+    /// A bit for each file descriptor that is open
+    std::vector<uint64_t> open;
+
+    /// A bit for each file descriptor that is closed on exec
+    std::vector<uint64_t> cloexec;
+
+    /// The number of open file descriptors
+    size_t count = 0;
+  };
+
+  /// Get the table's storage for modification, copying it first if it is shared
+  Data& modify() noexcept {
+    if (_data.use_count() > 1) _data = std::make_shared<Data>(*_data);
+    return *_data;
+  }
+
+  static bool test(const std::vector<uint64_t>& bits, int fd) noexcept {
+    return (bits[fd / 64] >> (fd % 64)) & 1;
+  }
+
+  static void assign(std::vector<uint64_t>& bits, int fd, bool value) noexcept {
+    if (value) {
+      bits[fd / 64] |= uint64_t(1) << (fd % 64);
+    } else {
+      bits[fd / 64] &= ~(uint64_t(1) << (fd % 64));
+    }
+  }
+
+  /// The table's storage, possibly shared with copies of this table
+  std::shared_ptr<Data> _data;
+};
@@ -1,5 +1,6 @@
 #include "Process.hh"
 
+#include <fstream>
 #include <functional>
 #include <list>
 #include <map>
@@ -29,28 +30,39 @@ using std::string;
 using std::tuple;
 using std::vector;
 
+/// Read rkr's umask without setting it, which would race with other threads creating files
+static mode_t getOwnUmask() noexcept {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Umask:", 0) == 0) return std::stoul(line.substr(6), nullptr, 8);
+  }
+
+  // Kernels before 4.7 do not report the umask, so fall back on setting it and putting it back
+  mode_t mask = ::umask(0);
+  ::umask(mask);
+  return mask;
+}
+
 Process::Process(Build& build,
                  const IRSource& source,
                  shared_ptr<Command> command,
                  pid_t pid,
                  Ref::ID cwd,
                  Ref::ID root,
-                 map<int, FileDescriptor> fds,
+                 FDTable fds,
                  optional<mode_t> umask) noexcept :
     _command(command), _pid(pid), _cwd(cwd), _root(root), _fds(fds) {
   // Set the process' default umask if one was not provided
   if (!umask.has_value()) {
-    _umask = ::umask(0);
-    ::umask(_umask);
+    static const mode_t own_umask = getOwnUmask();
+    _umask = own_umask;
   } else {
     _umask = umask.value();
   }
 
   // The new process has an open handle to each file descriptor in the _fds table
-  for (auto& [index, desc] : _fds) {
-    auto& [ref, cloexec] = desc;
-    build.usingRef(source, _command, ref);
-  }
+  _fds.forEach([&](int fd, Ref::ID ref, bool cloexec) { build.usingRef(source, _command, ref); });
 
   // The child process also duplicates references to the root and working directories
   // TODO: Do we need to track _exe here as well?
@@ -75,10 +87,9 @@ void Process::setWorkingDir(Build& build, const IRSource& source, Ref::ID ref) n
 
 // Get a file descriptor entry
 Ref::ID Process::getFD(int fd) noexcept {
-  auto iter = _fds.find(fd);
-  ASSERT(iter != _fds.end()) << "Attempted to access an unknown fd " << fd << " in " << this;
+  ASSERT(_fds.contains(fd)) << "Attempted to access an unknown fd " << fd << " in " << this;
 
-  return std::get<0>(iter->second);
+  return _fds.getRef(fd);
 }
 
 // Add a file descriptor entry
@@ -87,40 +98,36 @@ void Process::addFD(Build& build,
                     int fd,
                     Ref::ID ref,
                     bool cloexec) noexcept {
-  if (auto iter = _fds.find(fd); iter != _fds.end()) {
+  if (_fds.contains(fd)) {
     WARN << "Overwriting an existing fd " << fd << " in " << this;
-    auto& [old_ref, old_cloexec] = iter->second;
+    auto old_ref = _fds.getRef(fd);
     WARN << "  Existing fd references " << getCommand()->getRef(old_ref)->getArtifact();
     build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
+    _fds.erase(fd);
   }
 
   // The command holds an additional handle to the provided Ref
   build.usingRef(source, _command, ref);
 
   // Add the entry to the process' file descriptor table
-  _fds.emplace(fd, FileDescriptor(ref, cloexec));
+  _fds.set(fd, ref, cloexec);
 }
 
 // Close a file descriptor
 void Process::closeFD(Build& build, const IRSource& source, int fd) noexcept {
-  auto iter = _fds.find(fd);
-  if (iter == _fds.end()) {
+  if (!_fds.contains(fd)) {
     LOG(trace) << "Closing an unknown file descriptor " << fd << " in " << this;
   } else {
-    auto& [old_ref, old_cloexec] = iter->second;
-    build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
+    build.doneWithRef(source, _command, _fds.getRef(fd));
+    _fds.erase(fd);
   }
 }
 
 // Remove a file descriptor entry if it exists
 bool Process::tryCloseFD(Build& build, const IRSource& source, int fd) noexcept {
-  auto iter = _fds.find(fd);
-  if (iter != _fds.end()) {
-    auto& [old_ref, old_cloexec] = iter->second;
-    build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
+  if (_fds.contains(fd)) {
+    build.doneWithRef(source, _command, _fds.getRef(fd));
+    _fds.erase(fd);
     return true;
   }
   return false;
@@ -128,17 +135,15 @@ bool Process::tryCloseFD(Build& build, const IRSource& source, int fd) noexcept
 
 // Set a file descriptor's close-on-exec flag
 void Process::setCloexec(int fd, bool cloexec) noexcept {
-  auto iter = _fds.find(fd);
-  ASSERT(iter != _fds.end())
+  ASSERT(_fds.contains(fd))
       << "Attempted to set the cloexec flag for non-existent file descriptor " << fd;
 
-  const auto& [ref, old_cloexec] = iter->second;
-  iter->second = FileDescriptor{ref, cloexec};
+  _fds.setCloexec(fd, cloexec);
 }
 
 // The process is creating a new child
 shared_ptr<Process> Process::fork(Build& build, const IRSource& source, pid_t child_pid) noexcept {
-  // Return the child process object
+  // Return the child process object. It shares this process' fd table until either one changes.
   return make_shared<Process>(build, source, _command, child_pid, _cwd, _root, _fds, _umask);
 }
 
@@ -153,12 +158,10 @@ const shared_ptr<Command>& Process::exec(Build& build,
   map<int, Ref::ID> inherited_fds;
 
   // Loop over this process' file descriptors to find the ones that are inherited (not cloexec)
-  for (const auto& [fd, desc] : _fds) {
-    const auto& [ref, cloexec] = desc;
-
+  _fds.forEach([&](int fd, Ref::ID ref, bool cloexec) {
     // If this fd is inherited by the child, record it
-    if (!cloexec) inherited_fds.emplace(fd, ref);
-  }
+    if (!cloexec) inherited_fds.emplace_hint(inherited_fds.end(), fd, ref);
+  });
 
   // Find (or create) a command for the child
   auto child = build.findCommand(_command, args, inherited_fds);
@@ -197,10 +200,8 @@ const shared_ptr<Command>& Process::exec(Build& build,
   build.doneWithRef(source, _command, _cwd);
   build.doneWithRef(source, _command, _root);
 
-  for (const auto& [fd, desc] : _fds) {
-    auto [ref, cloexec] = desc;
-    build.doneWithRef(source, _command, ref);
-  }
+  _fds.forEach(
+      [&](int fd, Ref::ID ref, bool cloexec) { build.doneWithRef(source, _command, ref); });
 
   // This process is now running the child
   _command = child;
@@ -212,7 +213,7 @@ const shared_ptr<Command>& Process::exec(Build& build,
   _fds.clear();
 
   for (auto& [fd, ref] : child->getInitialFDs()) {
-    _fds.emplace(fd, FileDescriptor{ref, false});
+    _fds.set(fd, ref, false);
   }
 
   // Update the cwd and root references for the process to use refs from the new command
@@ -227,7 +228,10 @@ const shared_ptr<Command>& Process::exec(Build& build,
 }
 
 // The process is exiting
-void Process::exit(Build& build, const IRSource& source, int exit_status) noexcept {
+void Process::exit(Build& build,
+                   const IRSource& source,
+                   int exit_status,
+                   const Command::Usage& usage) noexcept {
   // We only need to handle the exit if the process hasn't already been marked as exited. That will
   // happen for skipped commands that are forced to exit.
   if (!_exited) {
@@ -239,13 +243,11 @@ void Process::exit(Build& build, const IRSource& source, int exit_status) noexce
     build.doneWithRef(source, _command, _root);
 
     // Any remaining file descriptors in this process are closed
-    for (const auto& [index, desc] : _fds) {
-      const auto& [ref, cloexec] = desc;
-      build.doneWithRef(source, _command, ref);
-    }
+    _fds.forEach(
+        [&](int fd, Ref::ID ref, bool cloexec) { build.doneWithRef(source, _command, ref); });
 
     // If this process was the primary for its command, trace the exit
-    if (_primary) build.exit(source, _command, exit_status);
+    if (_primary) build.exit(source, _command, exit_status, usage);
   }
 }
 
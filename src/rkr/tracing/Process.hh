@@ -14,22 +14,19 @@
 #include "data/IRSource.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "tracing/FDTable.hh"
 
 class Build;
 
 class Process : public std::enable_shared_from_this<Process> {
  public:
-  /// Keep track of file descriptors with a reference, and a boolean to track whether or not the
-  /// descriptor is closed on an exec syscall
-  using FileDescriptor = std::tuple<Ref::ID, bool>;
-
   Process(Build& build,
           const IRSource& source,
           std::shared_ptr<Command> command,
           pid_t pid,
           Ref::ID cwd,
           Ref::ID root,
-          std::map<int, FileDescriptor> fds,
+          FDTable fds,
           std::optional<mode_t> umask = std::nullopt) noexcept;
 
   /// Get the process ID
@@ -51,7 +48,7 @@ class Process : public std::enable_shared_from_this<Process> {
   Ref::ID getFD(int fd) noexcept;
 
   /// Check if this process has a particular file descriptor
-  bool hasFD(int fd) const noexcept { return _fds.find(fd) != _fds.end(); }
+  bool hasFD(int fd) const noexcept { return _fds.contains(fd); }
 
   /// Add a file descriptor entry
   void addFD(Build& build,
@@ -91,7 +88,10 @@ class Process : public std::enable_shared_from_this<Process> {
                                        std::vector<std::string> args) noexcept;
 
   /// This process is exiting
-  void exit(Build& build, const IRSource& source, int exit_status) noexcept;
+  void exit(Build& build,
+            const IRSource& source,
+            int exit_status,
+            const Command::Usage& usage) noexcept;
 
   /// Set a callback that can be used to force this process to exit
   void waitForExit(std::function<void(int)> handler) noexcept;
@@ -131,7 +131,7 @@ class Process : public std::enable_shared_from_this<Process> {
   mode_t _umask;
 
   /// The process' file descriptor table
-  std::map<int, FileDescriptor> _fds;
+  FDTable _fds;
 
   /// Has this process exited?
   bool _exited = false;
@@ -0,0 +1,135 @@
+#include "Supervisor.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tracing/Tracer.hh"
+#include "util/log.hh"
+
+using std::optional;
+
+struct Supervisor::State {
+  std::mutex lock;
+
+  /// Signaled when a request is queued or the pool is stopping
+  std::condition_variable ready;
+
+  /// Opens waiting for a pool thread
+  std::deque<Request> requests;
+
+  /// Finished opens waiting for the build thread
+  std::deque<Result> results;
+
+  /// Set when the pool should exit
+  bool stop = false;
+
+  /// Signaled each time a result is posted, so a sleeping build thread can wake up
+  int event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  ~State() noexcept { ::close(event_fd); }
+};
+
+/**
+ * Give the calling thread a umask of zero without changing it for the rest of rkr. Requests
+ * already carry the mode with the tracee's umask applied.
+ */
+static void clearThreadUmask() noexcept {
+  FAIL_IF(::unshare(CLONE_FS)) << "Failed to unshare filesystem attributes: " << ERR;
+  ::umask(0);
+}
+
+Supervisor::Supervisor(size_t threads) noexcept : _state(std::make_shared<State>()) {
+  for (size_t i = 0; i < threads; i++) {
+    _threads.emplace_back([state = _state] {
+      clearThreadUmask();
+
+      std::unique_lock lock(state->lock);
+      while (true) {
+        state->ready.wait(lock, [&] { return state->stop || !state->requests.empty(); });
+        if (state->stop) return;
+
+        auto request = std::move(state->requests.front());
+        state->requests.pop_front();
+
+        lock.unlock();
+        run(*state, request);
+        lock.lock();
+      }
+    });
+  }
+}
+
+Supervisor::~Supervisor() noexcept {
+  {
+    std::scoped_lock lock(_state->lock);
+    _state->stop = true;
+  }
+  _state->ready.notify_all();
+
+  for (auto& t : _threads) t.join();
+}
+
+void Supervisor::open(Request request) noexcept {
+  // An open that may block gets its own thread. It holds the shared state, so it can outlive
+  // the pool if the tracee never unblocks.
+  if (request.may_block) {
+    std::thread([state = _state, request = std::move(request)]() mutable {
+      clearThreadUmask();
+      run(*state, request);
+    }).detach();
+    return;
+  }
+
+  {
+    std::scoped_lock lock(_state->lock);
+    _state->requests.push_back(std::move(request));
+  }
+  _state->ready.notify_one();
+}
+
+int Supervisor::getEventFD() const noexcept {
+  return _state->event_fd;
+}
+
+optional<Supervisor::Result> Supervisor::getResult() noexcept {
+  std::scoped_lock lock(_state->lock);
+  if (_state->results.empty()) return std::nullopt;
+
+  auto result = _state->results.front();
+  _state->results.pop_front();
+  return result;
+}
+
+void Supervisor::run(State& state, Request& request) noexcept {
+  long rc;
+  // Never let a terminal the tracee opens become rkr's controlling terminal
+  int flags = request.flags | O_CLOEXEC | O_NOCTTY;
+  int fd = ::openat(request.dirfd, request.path.c_str(), flags, request.mode);
+  if (fd < 0) {
+    rc = -errno;
+    Tracer::notifySkip(request.listener, request.id, rc);
+  } else {
+    rc = Tracer::notifyAddFD(request.listener, request.id, fd, request.flags & O_CLOEXEC);
+    ::close(fd);
+  }
+
+  ::close(request.dirfd);
+  ::close(request.listener);
+
+  {
+    std::scoped_lock lock(state.lock);
+    state.results.push_back(Result{request.tid, rc});
+  }
+  ::eventfd_write(state.event_fd, 1);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+/**
+ * A pool of supervisor threads that run opens on behalf of tracees blocked on seccomp
+ * notifications. The build thread updates the model for a notified open and hands the open itself
+ * to a supervisor, so it can handle other tracees' events while the filesystem does its work.
+ *
+ * Opens that may block, like a FIFO waiting for its other end, each get a thread of their own.
+ * The other end is often another tracee, which the build thread must still be free to serve.
+ */
+class Supervisor {
+ public:
+  /// An open to run for a tracee
+  struct Request {
+    /// A duplicate of the listener fd the notification arrived on, closed once it is answered
+    int listener;
+
+    /// The id of the notification to answer
+    uint64_t id;
+
+    /// The thread blocked on the notification
+    pid_t tid;
+
+    /// The directory the path is resolved from, closed once the open is done
+    int dirfd;
+
+    /// The open call's arguments, with the path already resolved for the tracee and the tracee's
+    /// umask applied to the mode
+    std::string path;
+    int flags;
+    mode_t mode;
+
+    /// Could this open block until some other process acts?
+    bool may_block;
+  };
+
+  /// The result of an open a supervisor has finished and answered
+  struct Result {
+    pid_t tid;
+    long rc;
+  };
+
+  /// Start a pool of supervisor threads
+  Supervisor(size_t threads) noexcept;
+
+  /// Stop the pool. Threads running opens that may block are left to finish on their own.
+  ~Supervisor() noexcept;
+
+  // Disallow copy
+  Supervisor(const Supervisor&) = delete;
+  Supervisor& operator=(const Supervisor&) = delete;
+
+  /// Run an open and answer its notification on a supervisor thread
+  void open(Request request) noexcept;
+
+  /// Take the result of a finished open, if there is one
+  std::optional<Result> getResult() noexcept;
+
+  /// Get an eventfd that becomes readable when a result is posted
+  int getEventFD() const noexcept;
+
+ private:
+  /// State shared with the supervisor threads
+  struct State;
+
+  /// Run an open, answer its notification, and post the result
+  static void run(State& state, Request& request) noexcept;
+
+  std::shared_ptr<State> _state;
+  std::vector<std::thread> _threads;
+};
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <string>
 #include <vector>
@@ -43,9 +44,17 @@ class SyscallEntry {
   constexpr SyscallEntry(const char* name) :
       _name(name), _traced(false), _handler(default_handler) {}
 
-  /// Create an entry with a name and handler
-  constexpr SyscallEntry(const char* name, handler_t handler) :
-      _name(name), _traced(true), _handler(handler) {}
+  /// Create an entry with a name and handler, and masks of the arguments the handler reads from
+  /// the tracee as strings and as argv-style string arrays
+  constexpr SyscallEntry(const char* name,
+                         handler_t handler,
+                         uint8_t string_args,
+                         uint8_t argv_args) :
+      _name(name),
+      _traced(true),
+      _handler(handler),
+      _string_args(string_args),
+      _argv_args(argv_args) {}
 
   /// Get the name of this system call
   const char* getName() const { return _name; }
@@ -53,6 +62,12 @@ class SyscallEntry {
   /// Check if this system call should be traced
   bool isTraced() const { return _traced; }
 
+  /// Is argument i (counting from zero) read from the tracee as a string?
+  bool isStringArg(size_t i) const { return _string_args & (1 << i); }
+
+  /// Is argument i (counting from zero) read from the tracee as an argv-style string array?
+  bool isArgvArg(size_t i) const { return _argv_args & (1 << i); }
+
   /// Run the handler for this system call
   void runHandler(Build& b, const IRSource& source, Thread& t, const user_regs_struct& regs) const {
     _handler(b, source, t, regs);
@@ -62,6 +77,8 @@ class SyscallEntry {
   const char* _name;
   bool _traced;
   handler_t _handler;
+  uint8_t _string_args = 0;
+  uint8_t _argv_args = 0;
 };
 
 /// The maximum number of system calls
@@ -70,10 +87,13 @@ class SyscallEntry {
 /// A helper macro for use in the SyscallTable constructor
 #define TRACE(constant, name)                                                                   \
   _syscalls[constant] = SyscallEntry(                                                           \
-      #name, [](Output& out, const IRSource& source, Thread& t, const user_regs_struct& regs) { \
+      #name,                                                                                    \
+      [](Output& out, const IRSource& source, Thread& t, const user_regs_struct& regs) {        \
         stats::syscalls++;                                                                      \
-        t.invokeHandler(&Thread::_##name, out, source, regs);                                   \
-      });
+        t.getCommand()->countSyscall();                                                         \
+        t.handleSyscall(&Thread::_##name, out, source, regs);                                   \
+      },                                                                                        \
+      Thread::stringArgMask(&Thread::_##name), Thread::argvArgMask(&Thread::_##name));
 
 /**
  * Create a system call table that specifies names and handlers for traced system calls
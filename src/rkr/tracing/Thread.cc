@@ -1,22 +1,35 @@
 #include "Thread.hh"
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <filesystem>
-#include <functional>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <variant>
 #include <vector>
 
 #include <elf.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/openat2.h>
+#include <linux/seccomp.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include <fmt/format.h>
 #include <fmt/std.h>
@@ -37,8 +50,8 @@
 #include "util/wrappers.hh"
 #include "versions/MetadataVersion.hh"
 
-using std::function;
 using std::optional;
+using std::pair;
 using std::shared_ptr;
 using std::string;
 using std::vector;
@@ -55,6 +68,7 @@ void Thread::syscallEntryChannel(Build& build, const IRSource& source, ssize_t c
   if (options::syscall_stats) {
     Tracer::syscall_counts[string(entry.getName()) + " (fast)"]++;
     Tracer::fast_syscall_count++;
+    startBlocked(Tracer::syscall_latency[string(entry.getName()) + " (fast)"]);
   }
 
   LOG(trace) << this << " handling " << entry.getName() << " entry via shared memory channel";
@@ -69,7 +83,7 @@ void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t ch
   ASSERT(_channel == -1) << this << " is already using a shared memory channel";
   _channel = channel;
 
-  ASSERT(!_post_syscall_handlers.empty())
+  ASSERT(_pending_syscalls > 0)
       << "Stopped on syscall exit with no available post-syscall handlers";
 
   LOG(trace) << this << " handling "
@@ -77,16 +91,69 @@ void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t ch
              << " exit via shared memory channel";
 
   // Run the post-syscall handler
-  _post_syscall_handlers.top()(build, source, Tracer::getSyscallResult(_channel));
-
-  // Remove the used post-syscall handler
-  _post_syscall_handlers.pop();
+  runPostSyscallHandler(build, source, Tracer::getSyscallResult(_channel));
 
   _channel = -1;
 }
 
+// Traced entry to a system call through a seccomp notification
+void Thread::syscallEntryNotify(Build& build,
+                                const IRSource& source,
+                                int listener,
+                                const struct seccomp_notif& notif) noexcept {
+  ASSERT(_notification == nullptr) << this << " is already blocked on a seccomp notification";
+  _notification = &notif;
+  _notify_fd = listener;
+  _notify_answered = false;
+
+  // Handlers expect register state, so fill it in from the notification
+  user_regs_struct regs = {};
+  regs.INSTRUCTION_POINTER = notif.data.instruction_pointer;
+  regs.SYSCALL_NUMBER = notif.data.nr;
+  regs.SYSCALL_ARG1 = notif.data.args[0];
+  regs.SYSCALL_ARG2 = notif.data.args[1];
+  regs.SYSCALL_ARG3 = notif.data.args[2];
+  regs.SYSCALL_ARG4 = notif.data.args[3];
+  regs.SYSCALL_ARG5 = notif.data.args[4];
+  regs.SYSCALL_ARG6 = notif.data.args[5];
+
+  const auto& entry = SyscallTable<Build>::get(notif.data.nr);
+  LOG(trace) << this << " handling " << entry.getName() << " entry via seccomp notification";
+
+  if (options::syscall_stats) {
+    startBlocked(Tracer::syscall_latency[string(entry.getName()) + " (notify)"]);
+  }
+
+  entry.runHandler(build, source, *this, regs);
+
+  // If the tracer ran the system call for this thread, the post-syscall handler can run now
+  if (_notify_result.has_value()) {
+    runPostSyscallHandler(build, source, _notify_result.value());
+    _notify_result.reset();
+  }
+
+  // The tracee stays blocked until its notification is answered
+  resume();
+
+  _notification = nullptr;
+  _notify_fd = -1;
+}
+
+// Traced exit from a notified open that a supervisor thread ran and answered
+void Thread::syscallExitNotify(Build& build, const IRSource& source, long rc) noexcept {
+  // Mark the thread as blocked on an answered notification, so the post-syscall handler's resume
+  // has nothing left to do
+  struct seccomp_notif answered = {};
+  _notification = &answered;
+  _notify_answered = true;
+
+  runPostSyscallHandler(build, source, rc);
+
+  _notification = nullptr;
+}
+
 void Thread::syscallExitPtrace(Build& build, const IRSource& source) noexcept {
-  ASSERT(!_post_syscall_handlers.empty()) << "Thread does not have a post-syscall handler";
+  ASSERT(_pending_syscalls > 0) << "Thread does not have a post-syscall handler";
 
   // Clear errno so we can check for errors
   errno = 0;
@@ -100,8 +167,14 @@ void Thread::syscallExitPtrace(Build& build, const IRSource& source) noexcept {
   FAIL_IF(info.op != PTRACE_SYSCALL_INFO_EXIT) << "Not a syscall exit";
 
   // Run the handler and remove it from the stack
-  _post_syscall_handlers.top()(build, source, info.exit.rval);
-  _post_syscall_handlers.pop();
+  runPostSyscallHandler(build, source, info.exit.rval);
+}
+
+void Thread::runPostSyscallHandler(Build& build, const IRSource& source, long rc) noexcept {
+  auto& handler = _post_syscall_handlers[_pending_syscalls - 1];
+  handler(build, source, rc);
+  handler.reset();
+  _pending_syscalls--;
 }
 
 void Thread::execPtrace(Build& build, const IRSource& source) noexcept {
@@ -166,6 +239,8 @@ Ref::ID Thread::makePathRef(Build& build,
 }
 
 user_regs_struct Thread::getRegisters() noexcept {
+  ASSERT(_notification == nullptr) << "Cannot get registers for a seccomp notification";
+
   if (_channel >= 0) {
     return Tracer::getRegisters(_channel);
   }
@@ -182,6 +257,7 @@ user_regs_struct Thread::getRegisters() noexcept {
 
 void Thread::setRegisters(user_regs_struct& regs) noexcept {
   ASSERT(_channel == -1) << "Cannot set registers when tracing through the shared memory channel";
+  ASSERT(_notification == nullptr) << "Cannot set registers for a seccomp notification";
   struct iovec io {
     .iov_base = &regs, .iov_len = sizeof(regs)
   };
@@ -201,8 +277,15 @@ void Thread::setRegisters(user_regs_struct& regs) noexcept {
 }
 
 void Thread::skip(int64_t result) noexcept {
-  // If there is a tracing channel, use it to set the syscall result
-  if (_channel != -1) {
+  stopBlocked();
+
+  // If the thread is blocked on a seccomp notification, answer it with the result
+  if (_notification != nullptr) {
+    if (!_notify_answered) Tracer::notifySkip(_notify_fd, _notification->id, result);
+    _notify_answered = true;
+
+  } else if (_channel != -1) {
+    // If there is a tracing channel, use it to set the syscall result
     Tracer::channelSkip(_channel, result);
   } else {
     // If the tracee is stopped under ptrace, just run the syscall
@@ -211,8 +294,15 @@ void Thread::skip(int64_t result) noexcept {
 }
 
 void Thread::resume() noexcept {
-  // Is this thread blocked on the shared memory channel?
-  if (_channel >= 0) {
+  stopBlocked();
+
+  // Is this thread blocked on a seccomp notification?
+  if (_notification != nullptr) {
+    if (!_notify_answered) Tracer::notifyContinue(_notify_fd, _notification->id);
+    _notify_answered = true;
+
+  } else if (_channel >= 0) {
+    // Is this thread blocked on the shared memory channel?
     Tracer::channelContinue(_channel);
   } else {
     int rc = ptrace(PTRACE_CONT, _tid, nullptr, 0);
@@ -220,11 +310,22 @@ void Thread::resume() noexcept {
   }
 }
 
-void Thread::finishSyscall(function<void(Build&, const IRSource&, long)> handler) noexcept {
-  _post_syscall_handlers.push(handler);
+void Thread::finishSyscall(PostSyscallHandler handler) noexcept {
+  stopBlocked();
 
-  // Is this thread blocked on the shared memory channel?
-  if (_channel >= 0) {
+  FAIL_IF(_pending_syscalls == MaxNestedSyscalls)
+      << this << " exceeded the maximum depth of nested system calls";
+  _post_syscall_handlers[_pending_syscalls++] = std::move(handler);
+
+  // Is this thread blocked on a seccomp notification?
+  if (_notification != nullptr) {
+    // A notified system call cannot be observed once it runs, so the tracer runs it instead
+    ASSERT(!_notify_answered) << this << " already answered its seccomp notification";
+    _notify_result = finishNotifiedOpen();
+    _notify_answered = true;
+
+  } else if (_channel >= 0) {
+    // Is this thread blocked on the shared memory channel?
     Tracer::channelFinish(_channel);
 
   } else {
@@ -235,6 +336,8 @@ void Thread::finishSyscall(function<void(Build&, const IRSource&, long)> handler
 }
 
 void Thread::forceExit(int exit_status) noexcept {
+  stopBlocked();
+
   // Is the thread blocked on a shared memory channel?
   if (_channel >= 0) {
     Tracer::channelExit(_channel, exit_status);
@@ -250,6 +353,208 @@ void Thread::forceExit(int exit_status) noexcept {
   }
 }
 
+void Thread::startBlocked(Histogram& latency) noexcept {
+  _blocked_latency = &latency;
+  _blocked_since = std::chrono::steady_clock::now();
+}
+
+void Thread::stopBlocked() noexcept {
+  if (_blocked_latency == nullptr) return;
+
+  auto elapsed = std::chrono::steady_clock::now() - _blocked_since;
+  _blocked_latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  _blocked_latency = nullptr;
+}
+
+/// Does an open fd refer to the root of a procfs mount, or to a directory inside one?
+static bool inProc(int dirfd, bool& is_root) noexcept {
+  struct statfs fs;
+  if (::fstatfs(dirfd, &fs) || fs.f_type != PROC_SUPER_MAGIC) return false;
+
+  // The root of procfs always has inode number 1
+  struct stat st;
+  is_root = ::fstat(dirfd, &st) == 0 && st.st_ino == 1;
+  return true;
+}
+
+/**
+ * Resolve a path the way the kernel would for the tracee. On success, dirfd is replaced with the
+ * directory that holds the last component, and that component is returned. Paths through
+ * /proc/self or /proc/thread-self (including /dev/fd and /dev/std*) name whichever process
+ * resolves them, so symlinks are followed here and those two are swapped for the tracee's own
+ * directories. Symlinks inside a process directory in /proc are left to the kernel, which
+ * resolves them to the tracee's files. Returns a negative errno on failure.
+ */
+static std::variant<string, long> resolveForTracee(int& dirfd,
+                                                   const string& path,
+                                                   bool follow_last,
+                                                   pid_t pid,
+                                                   pid_t tid) noexcept {
+  if (path.empty()) return -ENOENT;
+
+  // Most paths never reach /proc or /dev. The kernel can resolve those as they are, as long as it
+  // never crosses a magic link to get there.
+  int how_flags = O_PATH | O_CLOEXEC | (follow_last ? 0 : O_NOFOLLOW);
+  struct open_how how = {.flags = static_cast<uint64_t>(how_flags),
+                         .resolve = RESOLVE_NO_MAGICLINKS};
+  int fd = ::syscall(SYS_openat2, dirfd, path.c_str(), &how, sizeof(how));
+  if (fd >= 0) {
+    char buf[PATH_MAX];
+    ssize_t len = ::readlink(("/proc/self/fd/" + std::to_string(fd)).c_str(), buf, sizeof(buf));
+    ::close(fd);
+
+    string resolved(buf, std::max(len, ssize_t(0)));
+    if (len > 0 && resolved.rfind("/proc", 0) != 0 && resolved.rfind("/dev", 0) != 0) return path;
+  }
+
+  // Walk the path one component at a time
+  std::deque<string> pending;
+  auto push_path = [&](const string& p) {
+    std::deque<string> parts;
+    size_t start = 0;
+    while (start <= p.size()) {
+      size_t end = std::min(p.find('/', start), p.size());
+      auto part = p.substr(start, end - start);
+      if (!part.empty() && part != ".") parts.push_back(part);
+      start = end + 1;
+    }
+
+    // A trailing slash requires a directory, which opening "." from it will check
+    if (p.back() == '/') parts.push_back(".");
+    pending.insert(pending.begin(), parts.begin(), parts.end());
+
+    if (p.front() == '/') {
+      int root = ::open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (root < 0) return false;
+      ::close(dirfd);
+      dirfd = root;
+    }
+    return true;
+  };
+
+  if (!push_path(path)) return -errno;
+
+  // The kernel gives up after this many symlinks
+  constexpr int MaxSymlinks = 40;
+  int symlinks = 0;
+
+  while (!pending.empty()) {
+    auto name = std::move(pending.front());
+    pending.pop_front();
+
+    bool proc_root = false;
+    bool proc_dir = inProc(dirfd, proc_root) && !proc_root;
+
+    // Name the tracee's directories under /proc instead of our own
+    if (proc_root && name == "self") {
+      name = std::to_string(pid);
+    } else if (proc_root && name == "thread-self") {
+      name = std::to_string(pid);
+      pending.insert(pending.begin(), {"task", std::to_string(tid)});
+    }
+
+    bool last = pending.empty();
+    if (last && !follow_last) return name;
+
+    // Follow symlinks here unless they are magic links the kernel resolves for the tracee
+    if (!proc_dir) {
+      char buf[PATH_MAX];
+      ssize_t len = ::readlinkat(dirfd, name.c_str(), buf, sizeof(buf));
+      if (len > 0) {
+        if (++symlinks > MaxSymlinks) return -ELOOP;
+        if (!push_path(string(buf, len))) return -errno;
+        continue;
+      }
+    }
+
+    if (last) return name;
+
+    int next = ::openat(dirfd, name.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (next < 0) return -errno;
+    ::close(dirfd);
+    dirfd = next;
+  }
+
+  // The path named a directory that resolution ended in, like "/" or "a/.."
+  return string(".");
+}
+
+optional<long> Thread::finishNotifiedOpen() noexcept {
+  const auto& args = _notification->data.args;
+
+  // Unpack the arguments to whichever open call the thread made
+  int dfd = AT_FDCWD;
+  uintptr_t path_ptr;
+  int flags;
+  mode_t mode;
+
+  if (_notification->data.nr == __NR_openat) {
+    dfd = args[0];
+    path_ptr = args[1];
+    flags = args[2];
+    mode = args[3];
+#if defined(__NR_open)
+  } else if (_notification->data.nr == __NR_open) {
+    path_ptr = args[0];
+    flags = args[1];
+    mode = args[2];
+#endif
+#if defined(__NR_creat)
+  } else if (_notification->data.nr == __NR_creat) {
+    path_ptr = args[0];
+    flags = O_CREAT | O_WRONLY | O_TRUNC;
+    mode = args[1];
+#endif
+  } else {
+    FAIL << "Cannot finish " << SyscallTable<Build>::get(_notification->data.nr).getName()
+         << " for a seccomp notification";
+  }
+
+  string path = readString(path_ptr);
+
+  // The tracee may have been interrupted while we read its memory
+  if (!Tracer::notifyValid(_notify_fd, _notification->id)) return -EINTR;
+
+  // Relative paths are resolved from the tracee's working directory or directory fd
+  auto proc_dir = "/proc/" + std::to_string(_tid);
+  auto dir = dfd == AT_FDCWD ? proc_dir + "/cwd" : proc_dir + "/fd/" + std::to_string(dfd);
+
+  int dirfd = ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0) {
+    long result = dfd == AT_FDCWD || errno == ENOTDIR ? -errno : -EBADF;
+    Tracer::notifySkip(_notify_fd, _notification->id, result);
+    return result;
+  }
+
+  // Find what the path names for the tracee. An exclusive create never follows the last symlink.
+  bool exclusive = (flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL);
+  bool follow_last = (flags & O_NOFOLLOW) == 0 && !exclusive;
+  auto resolved = resolveForTracee(dirfd, path, follow_last, _process->getID(), _tid);
+  if (auto err = std::get_if<long>(&resolved)) {
+    ::close(dirfd);
+    Tracer::notifySkip(_notify_fd, _notification->id, *err);
+    return *err;
+  }
+  path = std::get<string>(std::move(resolved));
+
+  // Anything other than a regular file or directory might block until another process acts
+  struct stat st;
+  int stat_flags = follow_last ? 0 : AT_SYMLINK_NOFOLLOW;
+  bool may_block = ::fstatat(dirfd, path.c_str(), &st, stat_flags) == 0 && !S_ISREG(st.st_mode) &&
+                   !S_ISDIR(st.st_mode) && (flags & (O_NONBLOCK | O_PATH)) == 0;
+
+  // Supervisor threads run with no umask of their own, so apply the tracee's to the mode
+  _tracer.superviseOpen(Supervisor::Request{.listener = ::dup(_notify_fd),
+                                            .id = _notification->id,
+                                            .tid = _tid,
+                                            .dirfd = dirfd,
+                                            .path = std::move(path),
+                                            .flags = flags,
+                                            .mode = mode & ~_process->getUmask(),
+                                            .may_block = may_block});
+  return std::nullopt;
+}
+
 unsigned long Thread::getEventMessage() noexcept {
   FAIL_IF(_channel >= 0) << "The getEventMessage function only works for ptrace stops";
 
@@ -262,6 +567,11 @@ unsigned long Thread::getEventMessage() noexcept {
 }
 
 string Thread::readString(uintptr_t tracee_pointer) noexcept {
+  // Was this string already read along with the handler's other arguments?
+  for (const auto& [pointer, str] : _prefetched_strings) {
+    if (pointer == tracee_pointer) return str;
+  }
+
   // Strings are just char arrays terminated by '\0'
   auto data = readTerminatedArray<char, '\0'>(tracee_pointer);
 
@@ -362,13 +672,137 @@ vector<T> Thread::readTerminatedArray(uintptr_t tracee_pointer) noexcept {
 }
 
 vector<string> Thread::readArgvArray(uintptr_t tracee_pointer) noexcept {
+  // Was this array read ahead of the handler?
+  for (const auto& [pointer, strings] : _prefetched_argvs) {
+    if (pointer == tracee_pointer) return strings;
+  }
+
   auto arg_pointers = readTerminatedArray<uintptr_t, 0>(tracee_pointer);
+  return readStrings(arg_pointers);
+}
+
+vector<string> Thread::readStrings(const vector<uintptr_t>& tracee_pointers) noexcept {
+  vector<string> result(tracee_pointers.size());
+
+  // Strings in the shared memory channel buffer do not need a system call
+  vector<uintptr_t> remote_pointers = tracee_pointers;
+  for (size_t i = 0; i < tracee_pointers.size(); i++) {
+    uintptr_t p = tracee_pointers[i];
+    if (p >= TRACING_CHANNEL_BUFFER_PTR &&
+        p < TRACING_CHANNEL_BUFFER_PTR + TRACING_CHANNEL_BUFFER_SIZE) {
+      result[i] = readString(p);
+      remote_pointers[i] = 0;
+    }
+  }
+
+  vector<string> remote_strings;
+  FAIL_IF(!readTraceeStrings(_tid, remote_pointers, remote_strings))
+      << this << ": Error in readStrings(). " << ERR;
+
+  for (size_t i = 0; i < tracee_pointers.size(); i++) {
+    if (remote_pointers[i] != 0) result[i] = std::move(remote_strings[i]);
+  }
+
+  return result;
+}
+
+bool Thread::readTraceeStrings(pid_t tid,
+                               const vector<uintptr_t>& tracee_pointers,
+                               vector<string>& result) noexcept {
+  // Strings are read in chunks of at most this many bytes
+  constexpr size_t MaxChunk = 256;
+  static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+
+  result.assign(tracee_pointers.size(), string());
+
+  // Strings that still have to be read from the tracee, with the address of their next chunk
+  vector<pair<size_t, uintptr_t>> pending;
+  for (size_t i = 0; i < tracee_pointers.size(); i++) {
+    if (tracee_pointers[i] != 0) pending.emplace_back(i, tracee_pointers[i]);
+  }
+
+  vector<char> buffer;
+  vector<struct iovec> local;
+  vector<struct iovec> remote;
+  vector<pair<size_t, uintptr_t>> unfinished;
+
+  while (!pending.empty()) {
+    size_t count = std::min(pending.size(), static_cast<size_t>(IOV_MAX));
+
+    // Read the next chunk of each pending string with one system call. A chunk never crosses a
+    // page boundary, so a string that ends just before an unmapped page can still be read.
+    remote.resize(count);
+    size_t total = 0;
+    for (size_t k = 0; k < count; k++) {
+      uintptr_t p = pending[k].second;
+      size_t len = std::min(MaxChunk, page_size - p % page_size);
+      remote[k] = {.iov_base = (void*)p, .iov_len = len};
+      total += len;
+    }
+
+    buffer.resize(total);
+    local.resize(count);
+    char* pos = buffer.data();
+    for (size_t k = 0; k < count; k++) {
+      local[k] = {.iov_base = pos, .iov_len = remote[k].iov_len};
+      pos += remote[k].iov_len;
+    }
+
+    auto rc = process_vm_readv(tid, local.data(), count, remote.data(), count, 0);
+    if (rc <= 0) return false;
+
+    // Transfers stop at the first chunk that could not be read. Chunks after that are retried.
+    size_t remaining = rc;
+    unfinished.clear();
+    for (size_t k = 0; k < count; k++) {
+      auto [index, p] = pending[k];
+      size_t len = remote[k].iov_len;
+
+      if (remaining < len) {
+        unfinished.emplace_back(index, p);
+        continue;
+      }
+      remaining -= len;
+
+      auto data = static_cast<const char*>(local[k].iov_base);
+      auto end = static_cast<const char*>(memchr(data, '\0', len));
+      if (end != nullptr) {
+        result[index].append(data, end);
+      } else {
+        result[index].append(data, len);
+        unfinished.emplace_back(index, p + len);
+      }
+    }
 
-  vector<string> args;
-  for (const auto& arg_ptr : arg_pointers) {
-    args.push_back(readString(arg_ptr));
+    // Keep any strings that did not fit in this batch
+    unfinished.insert(unfinished.end(), pending.begin() + count, pending.end());
+    std::swap(pending, unfinished);
   }
-  return args;
+
+  return true;
+}
+
+bool Thread::readTraceeArgv(pid_t tid, uintptr_t tracee_pointer, vector<string>& result) noexcept {
+  constexpr size_t BatchSize = 64;
+
+  // Read the array of pointers up to its null terminator
+  vector<uintptr_t> pointers;
+  uintptr_t buffer[BatchSize];
+  while (tracee_pointer != 0) {
+    struct iovec local = {.iov_base = buffer, .iov_len = sizeof(buffer)};
+    struct iovec remote = {.iov_base = (uintptr_t*)tracee_pointer + pointers.size(),
+                           .iov_len = sizeof(buffer)};
+
+    auto rc = process_vm_readv(tid, &local, 1, &remote, 1, 0);
+    if (rc < (ssize_t)sizeof(uintptr_t)) return false;
+
+    size_t n = rc / sizeof(uintptr_t);
+    auto end = std::find(buffer, buffer + n, 0);
+    pointers.insert(pointers.end(), buffer, end);
+    if (end != buffer + n) break;
+  }
+
+  return readTraceeStrings(tid, pointers, result);
 }
 
 /****************************************************/
@@ -419,14 +853,17 @@ void Thread::_openat(Build& build,
   }
 
   // Allow the syscall to finish
-  finishSyscall([=](Build& build, const IRSource& source, long fd) {
+  finishSyscall([this, flags, mode, ref_flags, ref_id](Build& build, const IRSource& source,
+                                                       long fd) {
     // Let the process continue
     resume();
 
+    const auto& ref = getCommand()->getRef(ref_id);
+
     // Check whether the openat call succeeded or failed
     if (fd >= 0) {
-      WARN_IF(!ref->isResolved()) << "Model Mismatch: failed to locate artifact for opened file: "
-                                  << filename << " (received " << ref << " from model)";
+      WARN_IF(!ref->isResolved()) << "Model Mismatch: failed to locate artifact for opened file"
+                                  << " (received " << ref << " from model)";
 
       // The command observed a successful openat, so add this predicate to the command log
       build.expectResult(source, getCommand(), Scenario::Build, ref_id, SUCCESS);
@@ -483,7 +920,8 @@ void Thread::_mknodat(Build& build,
     auto dir_ref = makePathRef(build, source, dir, WriteAccess, dfd);
     auto entry_ref = makePathRef(build, source, filename, NoAccess, dfd);
 
-    finishSyscall([=](Build& build, const IRSource& source, long rc) {
+    finishSyscall([this, dir_ref, entry_ref, entry = std::move(entry)](
+                      Build& build, const IRSource& source, long rc) {
       // Resume the blocked thread
       resume();
 
@@ -782,17 +1220,18 @@ void Thread::_fchown(Build& build,
   ASSERT(ref->isResolved()) << "Cannot match metadata through an unresolved reference";
 
   // The command depends on the old metadata
-  auto old_metadata = ref->getArtifact()->getMetadata(getCommand());
-  build.matchMetadata(source, getCommand(), Scenario::Build, ref_id, old_metadata);
+  build.matchMetadata(source, getCommand(), Scenario::Build, ref_id,
+                      ref->getArtifact()->getMetadata(getCommand()));
 
   // Finish the sycall and resume the process
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id, user, group](Build& build, const IRSource& source, long rc) {
     resume();
 
     // If the syscall failed, there's nothing to do
     if (rc) return;
 
     // The command updates the metadata
+    auto old_metadata = getCommand()->getRef(ref_id)->getArtifact()->getMetadata(getCommand());
     build.updateMetadata(source, getCommand(), ref_id, old_metadata.chown(user, group));
   });
 }
@@ -816,12 +1255,13 @@ void Thread::_fchownat(Build& build,
 
   // Get a reference to the artifact being chowned
   auto ref_id = makePathRef(build, source, filename, AccessFlags::fromAtFlags(flags), dfd);
-  auto ref = getCommand()->getRef(ref_id);
 
   // Finish the syscall and then resume the process
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id, user, group](Build& build, const IRSource& source, long rc) {
     resume();
 
+    const auto& ref = getCommand()->getRef(ref_id);
+
     // Did the call succeed?
     if (rc >= 0) {
       // Match the old metadata
@@ -924,12 +1364,12 @@ void Thread::_read(Build& build, const IRSource& source, int fd) noexcept {
   ref->getArtifact()->beforeRead(build, source, getCommand(), ref_id);
 
   // Finish the syscall and resume
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id](Build& build, const IRSource& source, long rc) {
     resume();
 
     if (rc >= 0) {
       // Inform the artifact that the read succeeded
-      ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
+      getCommand()->getRef(ref_id)->getArtifact()->afterRead(build, source, getCommand(), ref_id);
     }
   });
 }
@@ -945,14 +1385,14 @@ void Thread::_write(Build& build, const IRSource& source, int fd) noexcept {
   ref->getArtifact()->beforeWrite(build, source, getCommand(), ref_id);
 
   // Finish the syscall and resume the process
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id](Build& build, const IRSource& source, long rc) {
     resume();
 
     // If the write syscall failed, there's no need to log a write
     if (rc < 0) return;
 
     // Inform the artifact that it was written
-    ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
+    getCommand()->getRef(ref_id)->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
   });
 }
 
@@ -985,7 +1425,7 @@ void Thread::_mmap(Build& build,
   if (writable) ref->getArtifact()->beforeWrite(build, source, getCommand(), ref_id);
 
   // Run the syscall to find out if the mmap succeeded
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, fd, ref_id, writable](Build& build, const IRSource& source, long rc) {
     resume();
 
     LOGF(trace, "{}: finished mmap({})", *this, fd);
@@ -998,6 +1438,7 @@ void Thread::_mmap(Build& build,
     }
 
     // Inform the artifact that it has been read and possibly written
+    const auto& ref = getCommand()->getRef(ref_id);
     ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
     if (writable) ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
 
@@ -1023,7 +1464,7 @@ void Thread::_truncate(Build& build,
 
   // Did the reference resolve to an artifact?
   if (!ref->isResolved()) {
-    finishSyscall([=](Build& build, const IRSource& source, long rc) {
+    finishSyscall([this, ref_id](Build& build, const IRSource& source, long rc) {
       resume();
       ASSERT(rc != 0) << "Call to truncate() succeeded, but the reference did not resolve";
 
@@ -1042,7 +1483,7 @@ void Thread::_truncate(Build& build,
       ref->getArtifact()->beforeTruncate(build, source, getCommand(), ref_id);
     }
 
-    finishSyscall([=](Build& build, const IRSource& source, long rc) {
+    finishSyscall([this, ref_id, length](Build& build, const IRSource& source, long rc) {
       resume();
 
       // We expect the reference to succeed
@@ -1050,6 +1491,7 @@ void Thread::_truncate(Build& build,
 
       // If the syscall succeeded, finish the write
       if (rc == 0) {
+        const auto& ref = getCommand()->getRef(ref_id);
         if (length > 0) {
           ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
         } else {
@@ -1075,11 +1517,12 @@ void Thread::_ftruncate(Build& build, const IRSource& source, int fd, long lengt
   }
 
   // Finish the syscall and resume the process
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id, length](Build& build, const IRSource& source, long rc) {
     resume();
 
     if (rc == 0) {
       // Record the update to the artifact contents
+      const auto& ref = getCommand()->getRef(ref_id);
       if (length > 0) {
         ref->getArtifact()->afterWrite(build, source, getCommand(), ref_id);
       } else {
@@ -1106,11 +1549,13 @@ void Thread::_tee(Build& build, const IRSource& source, int fd_in, int fd_out) n
     out_ref->getArtifact()->beforeWrite(build, source, getCommand(), out_ref_id);
 
     // Finish the syscall and resume
-    finishSyscall([=](Build& build, const IRSource& source, long rc) {
+    finishSyscall([this, in_ref_id, out_ref_id](Build& build, const IRSource& source, long rc) {
       resume();
 
       // If the call succeeds, record the read and write
       if (rc >= 0) {
+        const auto& in_ref = getCommand()->getRef(in_ref_id);
+        const auto& out_ref = getCommand()->getRef(out_ref_id);
         in_ref->getArtifact()->afterRead(build, source, getCommand(), in_ref_id);
         out_ref->getArtifact()->afterWrite(build, source, getCommand(), out_ref_id);
       }
@@ -1146,7 +1591,8 @@ void Thread::_mkdirat(Build& build,
   // Make a reference to the new directory entry that will be created
   auto entry_ref = makePathRef(build, source, pathname, NoAccess, dfd);
 
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, parent_ref, entry_ref, mode, entry = std::move(entry)](
+                    Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the syscall succeed?
@@ -1210,7 +1656,9 @@ void Thread::_renameat2(Build& build,
   // Make a reference to the new entry
   auto new_entry_ref = makePathRef(build, source, new_path, NoFollowAccess, new_dfd);
 
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, old_dir_ref, old_entry_ref, new_dir_ref, new_entry_ref, flags,
+                 old_entry = std::move(old_entry), new_entry = std::move(new_entry)](
+                    Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the syscall succeed?
@@ -1288,12 +1736,12 @@ void Thread::_getdents(Build& build, const IRSource& source, int fd) noexcept {
   ref->getArtifact()->beforeRead(build, source, getCommand(), ref_id);
 
   // Finish the syscall and resume
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id](Build& build, const IRSource& source, long rc) {
     resume();
 
     if (rc == 0) {
       // Create a dependency on the artifact's directory list
-      ref->getArtifact()->afterRead(build, source, getCommand(), ref_id);
+      getCommand()->getRef(ref_id)->getArtifact()->afterRead(build, source, getCommand(), ref_id);
     }
   });
 }
@@ -1331,7 +1779,8 @@ void Thread::_linkat(Build& build,
 
   auto target_ref = makePathRef(build, source, oldpath, target_flags, old_dfd);
 
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, dir_ref, entry_ref, target_ref, entry = std::move(entry)](
+                    Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the call succeed?
@@ -1381,7 +1830,8 @@ void Thread::_symlinkat(Build& build,
   // Get a reference to the link we are creating
   auto entry_ref = makePathRef(build, source, newpath, NoAccess, dfd);
 
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, dir_ref, entry_ref, target = std::move(target), entry = std::move(entry)](
+                    Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the syscall succeed?
@@ -1432,7 +1882,7 @@ void Thread::_readlinkat(Build& build,
   }
 
   // Finish the syscall and then resume the process
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, ref_id](Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the call succeed?
@@ -1440,6 +1890,7 @@ void Thread::_readlinkat(Build& build,
       // Yes. Record the successful reference
       build.expectResult(source, getCommand(), Scenario::Build, ref_id, SUCCESS);
 
+      const auto& ref = getCommand()->getRef(ref_id);
       ASSERT(ref->isResolved()) << "Failed to get artifact for successfully-read link";
 
       // We depend on this artifact's contents now
@@ -1480,7 +1931,8 @@ void Thread::_unlinkat(Build& build,
     entry_ref->getArtifact()->afterRead(build, source, getCommand(), entry_ref_id);
   }
 
-  finishSyscall([=](Build& build, const IRSource& source, long rc) {
+  finishSyscall([this, dir_ref_id, entry_ref_id, entry = std::move(entry)](
+                    Build& build, const IRSource& source, long rc) {
     resume();
 
     // Did the call succeed?
@@ -1658,7 +2110,7 @@ void Thread::_execveat(Build& build,
       getProcess()->waitForExit([=](int exit_code) { forceExit(exit_code); });
 
       // Ask the build to process any deferred steps now that the child command is launched
-      build.runDeferredSteps();
+      build.runDeferredSteps(child);
     }
 
   } else {
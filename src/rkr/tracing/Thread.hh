@@ -1,13 +1,16 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
-#include <functional>
 #include <memory>
+#include <optional>
 #include <ostream>
-#include <stack>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <fcntl.h>
@@ -21,6 +24,8 @@
 #include "tracing/Flags.hh"
 #include "tracing/Process.hh"
 #include "tracing/inject.h"
+#include "util/Histogram.hh"
+#include "util/InlineFunction.hh"
 #include "util/log.hh"
 
 namespace fs = std::filesystem;
@@ -29,6 +34,7 @@ class AccessFlags;
 class Build;
 class Command;
 class Tracer;
+struct seccomp_notif;
 
 class Thread {
  public:
@@ -50,6 +56,15 @@ class Thread {
   /// Traced exit from a system call through the provided shared memory channel
   void syscallExitChannel(Build& build, const IRSource& source, ssize_t channel) noexcept;
 
+  /// Traced entry to a system call through a seccomp notification received from listener
+  void syscallEntryNotify(Build& build,
+                          const IRSource& source,
+                          int listener,
+                          const struct seccomp_notif& notif) noexcept;
+
+  /// Traced exit from a notified open that a supervisor thread ran and answered
+  void syscallExitNotify(Build& build, const IRSource& source, long rc) noexcept;
+
   /// Traced exit from a system call using ptrace
   void syscallExitPtrace(Build& build, const IRSource& source) noexcept;
 
@@ -65,9 +80,17 @@ class Thread {
   /// Resume a traced thread that is currently stopped
   void resume() noexcept;
 
+  /// Start timing how long this thread is blocked in a system call. The time is recorded in the
+  /// given histogram when the thread is allowed to continue.
+  void startBlocked(Histogram& latency) noexcept;
+
+  /// A handler to run when a system call finishes. Handlers are stored inline in the thread, so
+  /// they should capture Ref::IDs rather than shared pointers or other heap-allocated state.
+  using PostSyscallHandler = InlineFunction<void(Build&, const IRSource&, long), 128>;
+
   /// Resume a thread that has stopped before a syscall, and run the provided handler when the
   /// syscall finishes
-  void finishSyscall(std::function<void(Build&, const IRSource&, long)> handler) noexcept;
+  void finishSyscall(PostSyscallHandler handler) noexcept;
 
   /// Force the tracee to exit with a given exit code. This currently only works on entry to an
   /// execve call (which is where we need it to implement skipping)
@@ -99,6 +122,33 @@ class Thread {
   /// Read a null-terminated array of strings
   std::vector<std::string> readArgvArray(uintptr_t tracee_pointer) noexcept;
 
+  /// Read several strings from this thread's memory using as few system calls as possible
+  std::vector<std::string> readStrings(const std::vector<uintptr_t>& tracee_pointers) noexcept;
+
+  /// Read strings from any tracee's memory. Returns false if the memory could not be read. This
+  /// does not touch any Thread, so it is safe to call from any thread.
+  static bool readTraceeStrings(pid_t tid,
+                                const std::vector<uintptr_t>& tracee_pointers,
+                                std::vector<std::string>& result) noexcept;
+
+  /// Read a null-terminated array of strings from any tracee's memory. Returns false if the
+  /// memory could not be read. Safe to call from any thread.
+  static bool readTraceeArgv(pid_t tid,
+                             uintptr_t tracee_pointer,
+                             std::vector<std::string>& result) noexcept;
+
+  /// Strings read from a tracee before its system call is handled, keyed by their addresses
+  struct Prefetched {
+    std::vector<std::pair<uintptr_t, std::string>> strings;
+    std::vector<std::pair<uintptr_t, std::vector<std::string>>> argvs;
+  };
+
+  /// Use strings read ahead of time for the next system call entry this thread handles
+  void setPrefetched(Prefetched&& prefetched) noexcept {
+    _prefetched_strings = std::move(prefetched.strings);
+    _prefetched_argvs = std::move(prefetched.argvs);
+  }
+
   /// Get the path associated with a file descriptor that may be AT_FDCWD
   fs::path getPath(at_fd fd) const noexcept;
 
@@ -491,6 +541,58 @@ class Thread {
 
   SyscallArgWrapper wrap(unsigned long val) noexcept { return SyscallArgWrapper(this, val); }
 
+  /// Is a handler argument of this type read from the tracee as a string?
+  template <class T>
+  static constexpr bool IsStringArg = std::is_same_v<T, fs::path> ||
+                                      std::is_same_v<T, std::string>;
+
+  /// Get a mask of the arguments a handler reads from the tracee as strings
+  template <class Output, class... Ts>
+  static constexpr uint8_t stringArgMask(void (Thread::*)(Output&, const IRSource&, Ts...)) {
+    uint8_t mask = 0;
+    size_t i = 0;
+    ((mask |= IsStringArg<Ts> ? 1 << i : 0, i++), ...);
+    return mask;
+  }
+
+  /// Get a mask of the arguments a handler reads from the tracee as argv-style string arrays
+  template <class Output, class... Ts>
+  static constexpr uint8_t argvArgMask(void (Thread::*)(Output&, const IRSource&, Ts...)) {
+    uint8_t mask = 0;
+    size_t i = 0;
+    ((mask |= std::is_same_v<Ts, std::vector<std::string>> ? 1 << i : 0, i++), ...);
+    return mask;
+  }
+
+  /// If a handler takes more than one string argument, read them all from the tracee at once
+  template <class... Ts, class... Vals>
+  void prefetchStrings(Vals... vals) noexcept {
+    // The collector thread may have read them already
+    if (!_prefetched_strings.empty()) return;
+
+    if constexpr ((IsStringArg<Ts> + ...) > 1) {
+      std::vector<uintptr_t> pointers;
+      ((IsStringArg<Ts> ? pointers.push_back(vals) : void()), ...);
+
+      auto strings = readStrings(pointers);
+      for (size_t i = 0; i < pointers.size(); i++) {
+        _prefetched_strings.emplace_back(pointers[i], std::move(strings[i]));
+      }
+    }
+  }
+
+  /// Run a system call handler, then drop the strings read ahead for it so a later system call
+  /// cannot find them. Every traced system call goes through here.
+  template <class Output, class Handler>
+  void handleSyscall(Handler handler,
+                     Output& out,
+                     const IRSource& source,
+                     const user_regs_struct& regs) {
+    invokeHandler(handler, out, source, regs);
+    _prefetched_strings.clear();
+    _prefetched_argvs.clear();
+  }
+
   template <class Output>
   void invokeHandler(void (Thread::*handler)(Output&, const IRSource&),
                      Output& out,
@@ -512,6 +614,7 @@ class Thread {
                      Output& out,
                      const IRSource& source,
                      const user_regs_struct& regs) {
+    prefetchStrings<T1, T2>(regs.SYSCALL_ARG1, regs.SYSCALL_ARG2);
     (this->*(handler))(out, source, wrap(regs.SYSCALL_ARG1), wrap(regs.SYSCALL_ARG2));
   }
 
@@ -520,6 +623,7 @@ class Thread {
                      Output& out,
                      const IRSource& source,
                      const user_regs_struct& regs) {
+    prefetchStrings<T1, T2, T3>(regs.SYSCALL_ARG1, regs.SYSCALL_ARG2, regs.SYSCALL_ARG3);
     (this->*(handler))(out, source, wrap(regs.SYSCALL_ARG1), wrap(regs.SYSCALL_ARG2),
                        wrap(regs.SYSCALL_ARG3));
   }
@@ -529,6 +633,8 @@ class Thread {
                      Output& out,
                      const IRSource& source,
                      const user_regs_struct& regs) {
+    prefetchStrings<T1, T2, T3, T4>(regs.SYSCALL_ARG1, regs.SYSCALL_ARG2, regs.SYSCALL_ARG3,
+                                    regs.SYSCALL_ARG4);
     (this->*(handler))(out, source, wrap(regs.SYSCALL_ARG1), wrap(regs.SYSCALL_ARG2),
                        wrap(regs.SYSCALL_ARG3), wrap(regs.SYSCALL_ARG4));
   }
@@ -538,6 +644,8 @@ class Thread {
                      Output& out,
                      const IRSource& source,
                      const user_regs_struct& regs) {
+    prefetchStrings<T1, T2, T3, T4, T5>(regs.SYSCALL_ARG1, regs.SYSCALL_ARG2, regs.SYSCALL_ARG3,
+                                        regs.SYSCALL_ARG4, regs.SYSCALL_ARG5);
     (this->*(handler))(out, source, wrap(regs.SYSCALL_ARG1), wrap(regs.SYSCALL_ARG2),
                        wrap(regs.SYSCALL_ARG3), wrap(regs.SYSCALL_ARG4), wrap(regs.SYSCALL_ARG5));
   }
@@ -547,6 +655,9 @@ class Thread {
                      Output& out,
                      const IRSource& source,
                      const user_regs_struct& regs) {
+    prefetchStrings<T1, T2, T3, T4, T5, T6>(regs.SYSCALL_ARG1, regs.SYSCALL_ARG2, regs.SYSCALL_ARG3,
+                                            regs.SYSCALL_ARG4, regs.SYSCALL_ARG5,
+                                            regs.SYSCALL_ARG6);
     (this->*(handler))(out, source, wrap(regs.SYSCALL_ARG1), wrap(regs.SYSCALL_ARG2),
                        wrap(regs.SYSCALL_ARG3), wrap(regs.SYSCALL_ARG4), wrap(regs.SYSCALL_ARG5),
                        wrap(regs.SYSCALL_ARG6));
@@ -562,12 +673,54 @@ class Thread {
   /// The thread's tid
   pid_t _tid;
 
+  /// Strings read ahead of a syscall handler, keyed by their address in the tracee
+  std::vector<std::pair<uintptr_t, std::string>> _prefetched_strings;
+
+  /// Argv-style string arrays read ahead of a syscall handler, keyed by their address
+  std::vector<std::pair<uintptr_t, std::vector<std::string>>> _prefetched_argvs;
+
+  /// The histogram that records this thread's current blocked time, or nullptr if it is not timed
+  Histogram* _blocked_latency = nullptr;
+
+  /// The time this thread stopped in its current system call
+  std::chrono::steady_clock::time_point _blocked_since;
+
+  /// Record how long the thread was blocked, if it is being timed
+  void stopBlocked() noexcept;
+
+  /// The deepest nesting of system calls a thread can be stopped in
+  static constexpr size_t MaxNestedSyscalls = 8;
+
   /// The stack of post-syscall handlers to invoke. System calls can nest when a signal is delivered
   /// during a blocked system call (e.g. SIGCHLD is sent to bash while it is reading)
-  std::stack<std::function<void(Build&, const IRSource&, long)>> _post_syscall_handlers;
+  std::array<PostSyscallHandler, MaxNestedSyscalls> _post_syscall_handlers;
+
+  /// The number of post-syscall handlers on the stack
+  size_t _pending_syscalls = 0;
+
+  /// Run and remove the post-syscall handler on the top of the stack
+  void runPostSyscallHandler(Build& build, const IRSource& source, long rc) noexcept;
 
   /// Which channel is this thread using for the current trace event? Set to -1 if not using one.
   ssize_t _channel = -1;
+
+  /// The seccomp notification this thread is blocked on, or nullptr if there is none
+  const struct seccomp_notif* _notification = nullptr;
+
+  /// The listener fd the current seccomp notification arrived on
+  int _notify_fd = -1;
+
+  /// Has the current seccomp notification been answered?
+  bool _notify_answered = false;
+
+  /// The result of a notified system call the tracer ran on this thread's behalf
+  std::optional<long> _notify_result;
+
+  /// Hand the open call this thread is blocked on to a supervisor thread, which runs it and
+  /// installs the resulting fd in this thread's process. Returns the system call result if the
+  /// open failed before it could be handed off, or nullopt once the supervisor will report the
+  /// result through syscallExitNotify.
+  std::optional<long> finishNotifiedOpen() noexcept;
 };
 
 template <>
@@ -1,12 +1,18 @@
 #include "Tracer.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <list>
 #include <map>
 #include <memory>
@@ -14,6 +20,7 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -21,10 +28,15 @@
 #include <linux/audit.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
+#include <poll.h>
 #include <semaphore.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -37,8 +49,11 @@
 #include "tracing/SyscallTable.hh"
 #include "tracing/Thread.hh"
 #include "tracing/inject.h"
+#include "util/SPSCQueue.hh"
 #include "util/log.hh"
+#include "util/options.hh"
 #include "util/stats.hh"
+#include "util/timeline.hh"
 #include "util/wrappers.hh"
 #include "versions/FileVersion.hh"
 
@@ -64,25 +79,377 @@ int seccomp(unsigned int operation, unsigned int flags, void* args) {
   return syscall(__NR_seccomp, operation, flags, args);
 }
 
+/**
+ * Can a system call be traced with a seccomp notification? A notified system call cannot be
+ * observed after it runs, so this only includes calls whose handlers never wait for the result.
+ * Opens are the exception: the tracer runs those on the tracee's behalf (see Thread::finishSyscall)
+ */
+static bool isNotifySafe(uint32_t nr) noexcept {
+  switch (nr) {
+#if defined(__NR_open)
+    case __NR_open:
+#endif
+#if defined(__NR_creat)
+    case __NR_creat:
+#endif
+#if defined(__NR_stat)
+    case __NR_stat:
+#endif
+#if defined(__NR_lstat)
+    case __NR_lstat:
+#endif
+#if defined(__NR_access)
+    case __NR_access:
+#endif
+    case __NR_openat:
+    case __NR_close:
+    case __NR_fstat:
+    case __NR_newfstatat:
+    case __NR_statx:
+    case __NR_faccessat:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/// Send a file descriptor over a Unix domain socket
+static bool sendFD(int sock, int fd) noexcept {
+  char data = 0;
+  struct iovec iov = {.iov_base = &data, .iov_len = 1};
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  return ::sendmsg(sock, &msg, 0) == 1;
+}
+
+/// Receive a file descriptor sent over a Unix domain socket. Returns -1 on failure.
+static int receiveFD(int sock) noexcept {
+  char data;
+  struct iovec iov = {.iov_base = &data, .iov_len = 1};
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+/// An event gathered by the collector thread, to be handled by the build thread
+struct CollectedEvent {
+  enum Type : uint8_t { Wait, Channel, Notification, ListenerClosed } type;
+
+  /// For Wait events, the child, its wait status, and its resource usage if it exited
+  pid_t pid;
+  int status;
+  struct rusage usage;
+
+  /// For Channel events, the channel and the state it was found in
+  size_t channel;
+  int state;
+
+  /// For Notification and ListenerClosed events, the listener fd and the received notification
+  int listener;
+  struct seccomp_notif notif;
+
+  /// For system call entries, the string arguments the collector read from the tracee
+  Thread::Prefetched prefetched;
+};
+
+/// Read a system call's string and argv arguments from a blocked tracee, so the build thread does
+/// not have to. Strings in the shared memory channel buffer are left for the build thread.
+static Thread::Prefetched prefetchArgs(pid_t tid, long nr, const uintptr_t (&args)[6]) noexcept {
+  Thread::Prefetched result;
+  if (nr < 0 || static_cast<size_t>(nr) >= SyscallTable<Build>::size()) return result;
+
+  const auto& entry = SyscallTable<Build>::get(nr);
+
+  auto remote = [](uintptr_t p) {
+    return p != 0 && (p < TRACING_CHANNEL_BUFFER_PTR ||
+                      p >= TRACING_CHANNEL_BUFFER_PTR + TRACING_CHANNEL_BUFFER_SIZE);
+  };
+
+  vector<uintptr_t> pointers;
+  for (size_t i = 0; i < 6; i++) {
+    if (entry.isStringArg(i) && remote(args[i])) pointers.push_back(args[i]);
+  }
+
+  vector<string> strings;
+  if (!pointers.empty() && Thread::readTraceeStrings(tid, pointers, strings)) {
+    for (size_t i = 0; i < pointers.size(); i++) {
+      result.strings.emplace_back(pointers[i], std::move(strings[i]));
+    }
+  }
+
+  for (size_t i = 0; i < 6; i++) {
+    vector<string> argv;
+    if (entry.isArgvArg(i) && remote(args[i]) && Thread::readTraceeArgv(tid, args[i], argv)) {
+      result.argvs.emplace_back(args[i], std::move(argv));
+    }
+  }
+
+  return result;
+}
+
+/// The collector yields this many times in a row with nothing to do before it starts blocking
+static constexpr size_t CollectorIdleSpins = 256;
+
+/// The longest the collector blocks before checking channels and children again, in milliseconds
+static constexpr int CollectorIdleTimeoutMs = 1;
+
+/// The state shared between the build thread and the collector thread
+struct Tracer::Collector {
+  /// The collector thread
+  std::thread thread;
+
+  /// Set by the build thread to ask the collector to exit
+  std::atomic<bool> stop = false;
+
+  /// Events gathered by the collector
+  SPSCQueue<CollectedEvent, 4096> events;
+
+  /// Listener fds the build thread has handed to the collector
+  SPSCQueue<int, 64> new_listeners;
+
+  /// The listener fds the collector polls. Only touched by the collector thread.
+  vector<int> listeners;
+
+  /// Set by the build thread while it waits on a newly launched child itself
+  std::atomic<bool> hold_waits = false;
+
+  /// Set by the collector while it may be inside wait4
+  std::atomic<bool> in_wait = false;
+
+  /// Written by the collector when it queues an event while the build thread sleeps
+  int wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  /// Set by the build thread before it sleeps on wake_fd
+  std::atomic<bool> sleeping = false;
+
+  ~Collector() noexcept { ::close(wake_fd); }
+
+  /// Wake the build thread if it is sleeping
+  void wake() noexcept {
+    if (sleeping.exchange(false)) ::eventfd_write(wake_fd, 1);
+  }
+
+  /// Keep the collector out of wait4 so it cannot take a launching child's events
+  void pauseWaits() noexcept {
+    hold_waits.store(true);
+    while (in_wait.load()) std::this_thread::yield();
+  }
+
+  /// Let the collector wait for children again
+  void resumeWaits() noexcept { hold_waits.store(false); }
+};
+
+Tracer::Tracer() noexcept {}
+
+Tracer::~Tracer() noexcept {
+  if (_collector) {
+    _collector->stop.store(true, std::memory_order_release);
+    _collector->thread.join();
+
+    // Take back any listener fds the collector still held
+    while (auto listener = _collector->new_listeners.pop()) {
+      _listeners.push_back(listener.value());
+    }
+    _listeners.insert(_listeners.end(), _collector->listeners.begin(),
+                      _collector->listeners.end());
+  }
+
+  for (int listener : _listeners) {
+    ::close(listener);
+  }
+}
+
 shared_ptr<Process> Tracer::start(Build& build, const shared_ptr<Command>& cmd) noexcept {
+  ScopedTimer timer(Timer::Tracing);
+
   // Launch the command with tracing
-  return launchTraced(build, cmd);
+  auto proc = launchTraced(build, cmd);
+  timeline::nameTrack(proc->getID(), cmd->getShortName());
+
+  // Start the collector after the first launch, once the shared memory channels are set up
+  if (options::tracer_thread && !_collector) startCollector();
+
+  return proc;
 }
 
-optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
-  // Check if any queued events are ready to be processed
-  for (auto iter = _event_queue.cbegin(); iter != _event_queue.cend(); iter++) {
-    auto [child, wait_status] = *iter;
+void Tracer::startCollector() noexcept {
+  _collector = std::make_unique<Collector>();
+
+  // The collector polls the listener fds from now on
+  _collector->listeners.assign(_listeners.begin(), _listeners.end());
+  _listeners.clear();
+
+  _collector->thread = std::thread([c = _collector.get()] {
+    vector<struct pollfd> fds;
 
-    // If the current entry's pid is now a known process, process it
-    if (_threads.find(child) != _threads.end()) {
-      // Drop the event from the queue
-      _event_queue.erase(iter);
+    // The number of passes in a row that found nothing
+    size_t idle = 0;
 
-      // Return the event
-      return tuple{child, wait_status};
+    while (!c->stop.load(std::memory_order_acquire)) {
+      bool found = false;
+
+      // Queue an event, waiting for space if the build thread has fallen behind
+      auto send = [&](CollectedEvent&& e) {
+        while (!c->events.push(std::move(e))) {
+          if (c->stop.load(std::memory_order_acquire)) return;
+          std::this_thread::yield();
+        }
+        c->wake();
+        found = true;
+      };
+
+      // Pick up any new listener fds
+      while (auto listener = c->new_listeners.pop()) {
+        c->listeners.push_back(listener.value());
+      }
+
+      // Check the shared memory channels
+      if (_shmem != nullptr) {
+        for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+          auto state = __atomic_load_n(&_shmem->channels[i].state, __ATOMIC_ACQUIRE);
+
+          if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT ||
+              state == CHANNEL_STATE_POST_SYSCALL_NOTIFY ||
+              state == CHANNEL_STATE_POST_SYSCALL_WAIT) {
+            // Reset the state so we don't report this event again
+            _shmem->channels[i].state = CHANNEL_STATE_OBSERVED;
+            CollectedEvent e{.type = CollectedEvent::Channel, .channel = i, .state = state};
+
+            // The tracee waits for its answer, so its arguments can be read now
+            if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT) {
+              const auto& regs = Tracer::getRegisters(i);
+              uintptr_t args[6] = {regs.SYSCALL_ARG1, regs.SYSCALL_ARG2, regs.SYSCALL_ARG3,
+                                   regs.SYSCALL_ARG4, regs.SYSCALL_ARG5, regs.SYSCALL_ARG6};
+              e.prefetched = prefetchArgs(_shmem->channels[i].tid, regs.SYSCALL_NUMBER, args);
+            }
+            send(std::move(e));
+          }
+        }
+      }
+
+      // Check for seccomp notifications
+      if (!c->listeners.empty()) {
+        fds.clear();
+        for (int listener : c->listeners) {
+          fds.push_back({.fd = listener, .events = POLLIN});
+        }
+
+        if (::poll(fds.data(), fds.size(), 0) > 0) {
+          for (const auto& pfd : fds) {
+            if (pfd.revents & POLLIN) {
+              CollectedEvent e{.type = CollectedEvent::Notification, .listener = pfd.fd};
+              memset(&e.notif, 0, sizeof(e.notif));
+              if (::ioctl(pfd.fd, SECCOMP_IOCTL_NOTIF_RECV, &e.notif) == 0) {
+                uintptr_t args[6];
+                std::copy(std::begin(e.notif.data.args), std::end(e.notif.data.args), args);
+                e.prefetched = prefetchArgs(e.notif.pid, e.notif.data.nr, args);
+                send(std::move(e));
+              }
+
+            } else if (pfd.revents & (POLLHUP | POLLERR)) {
+              // The build thread closes the fd, after it answers anything still queued for it
+              c->listeners.erase(std::find(c->listeners.begin(), c->listeners.end(), pfd.fd));
+              send(CollectedEvent{.type = CollectedEvent::ListenerClosed, .listener = pfd.fd});
+            }
+          }
+        }
+      }
+
+      // Check for a child, but do not block. Stay out of wait4 while a child is launching.
+      c->in_wait.store(true);
+      if (!c->hold_waits.load()) {
+        int wait_status;
+        struct rusage usage;
+        pid_t child = ::wait4(-1, &wait_status, WNOHANG, &usage);
+        if (child > 0) {
+          send(CollectedEvent{
+              .type = CollectedEvent::Wait, .pid = child, .status = wait_status, .usage = usage});
+        }
+      }
+      c->in_wait.store(false);
+
+      // Spin for a little while after the last event, since another one usually follows soon.
+      // After that, block until a listener has a notification or a short timeout passes. Channels
+      // and child events cannot wake a poll, so the timeout bounds how long they wait when idle.
+      if (found) {
+        idle = 0;
+      } else if (++idle < CollectorIdleSpins) {
+        std::this_thread::yield();
+      } else {
+        fds.clear();
+        for (int listener : c->listeners) {
+          fds.push_back({.fd = listener, .events = POLLIN});
+        }
+        ::poll(fds.data(), fds.size(), CollectorIdleTimeoutMs);
+      }
+    }
+  });
+}
+
+void Tracer::handleChannel(Build& build, size_t i, int state) noexcept {
+  // Find the thread using this channel
+  auto iter = _threads.find(_shmem->channels[i].tid);
+  if (iter != _threads.end()) {
+    if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT) {
+      iter->second.syscallEntryChannel(build, TracedIRSource(), i);
+    } else if (state == CHANNEL_STATE_POST_SYSCALL_NOTIFY) {
+      FAIL << "Channel is in post-syscall notify state, which is not yet handled";
+    } else if (state == CHANNEL_STATE_POST_SYSCALL_WAIT) {
+      iter->second.syscallExitChannel(build, TracedIRSource(), i);
     }
+  } else {
+    WARN << "Tracing channel is owned by unrecognized thread " << _shmem->channels[i].tid;
   }
+}
+
+optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
+  // Return events that arrived for threads before they were known
+  if (!_ready_events.empty()) {
+    auto e = _ready_events.front();
+    _ready_events.pop_front();
+    return e;
+  }
+
+  // Retry notifications from threads that were not known when they arrived
+  for (auto iter = _notify_queue.begin(); iter != _notify_queue.end();) {
+    auto& [listener, notif] = *iter;
+    auto thread_iter = _threads.find(notif.pid);
+    if (thread_iter != _threads.end()) {
+      thread_iter->second.syscallEntryNotify(build, TracedIRSource(), listener, notif);
+      iter = _notify_queue.erase(iter);
+    } else {
+      iter++;
+    }
+  }
+
+  // If a collector thread is running, it gathers events for us
+  if (_collector) return getCollectedEvent(build);
 
   // size_t spin_count = 0;
 
@@ -99,28 +466,21 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
           // Reset the state so we don't try to handle this event again later
           _shmem->channels[i].state = CHANNEL_STATE_OBSERVED;
 
-          // Find the thread using this channel
-          auto iter = _threads.find(_shmem->channels[i].tid);
-          if (iter != _threads.end()) {
-            if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT) {
-              iter->second.syscallEntryChannel(build, TracedIRSource(), i);
-            } else if (state == CHANNEL_STATE_POST_SYSCALL_NOTIFY) {
-              FAIL << "Channel is in post-syscall notify state, which is not yet handled";
-            } else if (state == CHANNEL_STATE_POST_SYSCALL_WAIT) {
-              iter->second.syscallExitChannel(build, TracedIRSource(), i);
-            }
-          } else {
-            WARN << "Tracing channel is owned by unrecognized thread " << _shmem->channels[i].tid;
-          }
+          handleChannel(build, i, state);
         }
       }
     }
 
+    // Check for seccomp notifications, and opens that supervisor threads have finished
+    if (!_listeners.empty()) handleNotifications(build);
+    handleSupervisedOpens(build);
+
     // Check for a child, but do not block
     int wait_status;
-    pid_t child = ::waitpid(-1, &wait_status, WNOHANG);
+    struct rusage usage;
+    pid_t child = ::wait4(-1, &wait_status, WNOHANG, &usage);
 
-    // Did waitpid return an error?
+    // Did wait4 return an error?
     if (child == -1) {
       // If errno is ECHILD, we're done and can return with no event
       if (errno == ECHILD)
@@ -129,15 +489,18 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
         FAIL << "Error while waiting: " << ERR;
 
     } else if (child > 0) {
-      // A child responded to waitpid. Handle its event now
+      // A child responded to wait4. Handle its event now
 
       // Count the ptrace stop for this event
       stats::ptrace_stops++;
 
+      // Keep the resource usage of an exited child until its exit is handled
+      if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) _exit_usage[child] = usage;
+
       // Does this event refer to a process we don't know about yet?
       if (_threads.find(child) == _threads.end()) {
-        // Yes. Queue the event so we can try another one.
-        _event_queue.emplace_back(child, wait_status);
+        // Yes. Hold the event until the thread is created so we can try another one.
+        _pending_events[child].push_back(wait_status);
       } else {
         // No. The event is for a known process. Return it now.
         return tuple{child, wait_status};
@@ -153,6 +516,78 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
   }
 }
 
+optional<tuple<pid_t, int>> Tracer::getCollectedEvent(Build& build) noexcept {
+  while (true) {
+    // The collector cannot tell when the last traced thread has exited, but we can
+    if (_threads.empty()) return nullopt;
+
+    handleSupervisedOpens(build);
+
+    auto e = _collector->events.pop();
+    if (!e.has_value()) {
+      waitForCollector();
+      continue;
+    }
+
+    // Hand a thread the strings the collector read for its system call
+    auto prefetched = [&](pid_t tid) {
+      auto iter = _threads.find(tid);
+      if (iter != _threads.end()) iter->second.setPrefetched(std::move(e->prefetched));
+    };
+
+    if (e->type == CollectedEvent::Channel) {
+      if (e->state == CHANNEL_STATE_PRE_SYSCALL_WAIT) prefetched(_shmem->channels[e->channel].tid);
+      handleChannel(build, e->channel, e->state);
+
+    } else if (e->type == CollectedEvent::Notification) {
+      prefetched(e->notif.pid);
+      handleNotification(build, e->listener, e->notif);
+
+    } else if (e->type == CollectedEvent::ListenerClosed) {
+      closeListener(e->listener);
+
+    } else if (e->type == CollectedEvent::Wait) {
+      // Count the ptrace stop for this event
+      stats::ptrace_stops++;
+
+      // Keep the resource usage of an exited child until its exit is handled
+      if (WIFEXITED(e->status) || WIFSIGNALED(e->status)) _exit_usage[e->pid] = e->usage;
+
+      // Queue events for processes we don't know about yet
+      if (_threads.find(e->pid) == _threads.end()) {
+        _pending_events[e->pid].push_back(e->status);
+      } else {
+        return tuple{e->pid, e->status};
+      }
+    }
+  }
+}
+
+void Tracer::waitForCollector() noexcept {
+  // Announce that we are going to sleep, then check once more in case the collector queued an
+  // event before it could see that
+  _collector->sleeping.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!_collector->events.empty()) {
+    _collector->sleeping.store(false);
+    return;
+  }
+
+  // Sleep until the collector queues an event or a supervisor thread finishes an open. A negative
+  // fd is ignored by poll.
+  struct pollfd fds[2] = {
+      {.fd = _collector->wake_fd, .events = POLLIN},
+      {.fd = _supervisor ? _supervisor->getEventFD() : -1, .events = POLLIN},
+  };
+  ::poll(fds, 2, -1);
+  _collector->sleeping.store(false);
+
+  // Reset both eventfds. Neither blocks, and a stale wakeup only costs one extra pass.
+  eventfd_t count;
+  ::eventfd_read(_collector->wake_fd, &count);
+  if (_supervisor) ::eventfd_read(_supervisor->getEventFD(), &count);
+}
+
 void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
   if (p) {
     LOG(exec) << "Waiting for " << p;
@@ -160,10 +595,16 @@ void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
     LOG(exec) << "Waiting for all remaining processes";
   }
 
+  // If we're waiting for a specific process, stop once that process has exited
+  waitUntil(build, [&] { return p && p->hasExited(); });
+}
+
+void Tracer::waitUntil(Build& build, std::function<bool()> done) noexcept {
+  ScopedTimer timer(Timer::Tracing);
+
   // Process tracaing events
   while (true) {
-    // If we're waiting for a specific process, and that process has exited, return now
-    if (p && p->hasExited()) return;
+    if (done()) return;
 
     auto e = getEvent(build);
     if (!e.has_value()) return;
@@ -171,6 +612,8 @@ void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
     auto [child, wait_status] = e.value();
 
     auto& thread = _threads.at(child);
+    thread.getCommand()->countPtraceStop();
+    if (timeline::enabled) timeline::instant("tracer", "ptrace stop", child);
 
     if (WIFSTOPPED(wait_status)) {
       int status = wait_status >> 8;
@@ -185,8 +628,7 @@ void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
         handleFork(build, thread);
 
       } else if (status == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
-        auto regs = thread.getRegisters();
-        handleClone(build, thread, regs.SYSCALL_ARG1);
+        handleClone(build, thread);
 
       } else if (status == (SIGTRAP | 0x80)) {
         // This is a stop at the end of a system call that was resumed.
@@ -229,7 +671,20 @@ void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
   }
 }
 
-void Tracer::handleClone(Build& build, Thread& t, int flags) noexcept {
+void Tracer::addThread(pid_t tid, shared_ptr<Process> proc) noexcept {
+  _threads.emplace(tid, Thread(*this, proc, tid));
+
+  // Any events the new thread produced before we saw it created can be handled now
+  auto iter = _pending_events.find(tid);
+  if (iter != _pending_events.end()) {
+    for (int wait_status : iter->second) {
+      _ready_events.emplace_back(tid, wait_status);
+    }
+    _pending_events.erase(iter);
+  }
+}
+
+void Tracer::handleClone(Build& build, Thread& t) noexcept {
   // NOTE: This is not truly a syscall trap. Instead, it's a ptrace event. This handler runs after
   // the syscall has done most of the work
 
@@ -237,10 +692,10 @@ void Tracer::handleClone(Build& build, Thread& t, int flags) noexcept {
   pid_t new_tid = t.getEventMessage();
   t.resume();
 
-  // TODO: Handle flags
+  // TODO: Handle clone flags. Read them from the thread's registers before it is resumed.
 
   // Threads in the same process just appear as pid references to the same process
-  _threads.emplace(new_tid, Thread(*this, t.getProcess(), new_tid));
+  addThread(new_tid, t.getProcess());
 }
 
 void Tracer::handleFork(Build& build, Thread& t) noexcept {
@@ -256,10 +711,11 @@ void Tracer::handleFork(Build& build, Thread& t) noexcept {
 
   // Create a new process running the same command
   auto new_proc = t.getProcess()->fork(build, TracedIRSource(), new_pid);
+  timeline::nameTrack(new_pid, new_proc->getCommand()->getShortName());
 
   // Record a new thread running in this process. It is the main thread, so pid and tid will be
   // equal
-  _threads.emplace(new_pid, Thread(*this, new_proc, new_pid));
+  addThread(new_pid, new_proc);
 }
 
 void Tracer::handleExit(Build& build, Thread& t, int exit_status) noexcept {
@@ -269,10 +725,32 @@ void Tracer::handleExit(Build& build, Thread& t, int exit_status) noexcept {
   auto proc = t.getProcess();
   if (t.getID() == proc->getID()) {
     LOGF(trace, "{}: exited", proc);
-    proc->exit(build, TracedIRSource(), exit_status);
+
+    // Measure the run of the command the process was running when it exited
+    const auto& cmd = proc->getCommand();
+    auto usage = cmd->getUsage();
+    usage.wall_ns = cmd->getElapsedTime();
+    usage.start_ns = cmd->getStartOffset();
+    auto iter = _exit_usage.find(t.getID());
+    if (iter != _exit_usage.end()) {
+      const auto& ru = iter->second;
+      usage.cpu_ns = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+                     (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+      usage.max_rss_kb = ru.ru_maxrss;
+    }
+
+    // Show the command's run on its process' track
+    if (timeline::enabled) {
+      auto end = timeline::clock::now();
+      auto start = end - std::chrono::nanoseconds(usage.wall_ns);
+      timeline::span("command", cmd->getShortName(), proc->getID(), start, end);
+    }
+
+    proc->exit(build, TracedIRSource(), exit_status, usage);
     _exited.emplace(proc->getID(), proc);
   }
 
+  _exit_usage.erase(t.getID());
   _threads.erase(t.getID());
 }
 
@@ -396,6 +874,7 @@ void Tracer::handleSyscall(Build& build, Thread& t) noexcept {
          << findLibraryOffset(t.getProcess()->getID(), regs.INSTRUCTION_POINTER) << ")";
       Tracer::syscall_counts[ss.str()]++;
       Tracer::ptrace_syscall_count++;
+      t.startBlocked(Tracer::syscall_latency[string(entry.getName()) + " (ptrace)"]);
     }
 
     // Run the system call handler
@@ -406,6 +885,93 @@ void Tracer::handleSyscall(Build& build, Thread& t) noexcept {
   }
 }
 
+void Tracer::handleNotifications(Build& build) noexcept {
+  // Check every listener without blocking
+  vector<struct pollfd> fds;
+  for (int listener : _listeners) {
+    fds.push_back({.fd = listener, .events = POLLIN});
+  }
+
+  if (::poll(fds.data(), fds.size(), 0) <= 0) return;
+
+  for (const auto& pfd : fds) {
+    if (pfd.revents & POLLIN) {
+      // The kernel requires a zeroed buffer
+      struct seccomp_notif notif;
+      memset(&notif, 0, sizeof(notif));
+
+      // The notification may be gone already if the tracee was interrupted
+      if (::ioctl(pfd.fd, SECCOMP_IOCTL_NOTIF_RECV, &notif)) {
+        LOG(trace) << "Failed to receive seccomp notification: " << ERR;
+        continue;
+      }
+
+      handleNotification(build, pfd.fd, notif);
+
+    } else if (pfd.revents & (POLLHUP | POLLERR)) {
+      // Every process using this filter has exited
+      closeListener(pfd.fd);
+    }
+  }
+}
+
+void Tracer::handleNotification(Build& build,
+                                int listener,
+                                const struct seccomp_notif& notif) noexcept {
+  if (options::syscall_stats) {
+    Tracer::syscall_counts[string(SyscallTable<Build>::get(notif.data.nr).getName()) +
+                           " (notify)"]++;
+    Tracer::notify_syscall_count++;
+  }
+
+  auto iter = _threads.find(notif.pid);
+  if (iter != _threads.end()) {
+    iter->second.syscallEntryNotify(build, TracedIRSource(), listener, notif);
+  } else {
+    // The tracee stays blocked until we see its creation and can answer
+    _notify_queue.emplace_back(listener, notif);
+  }
+}
+
+void Tracer::superviseOpen(Supervisor::Request request) noexcept {
+  // A few threads are enough to keep the filesystem busy. Opens that may block get their own.
+  if (!_supervisor) {
+    size_t threads = std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+    _supervisor = std::make_unique<Supervisor>(threads);
+  }
+  _supervisor->open(std::move(request));
+}
+
+void Tracer::handleSupervisedOpens(Build& build) noexcept {
+  if (!_supervisor) return;
+
+  while (auto result = _supervisor->getResult()) {
+    // The thread is gone if the tracee was killed while its open ran
+    auto iter = _threads.find(result->tid);
+    if (iter != _threads.end()) {
+      iter->second.syscallExitNotify(build, TracedIRSource(), result->rc);
+    }
+  }
+}
+
+void Tracer::addListener(int listener) noexcept {
+  if (_collector) {
+    while (!_collector->new_listeners.push(listener)) {
+      std::this_thread::yield();
+    }
+  } else {
+    _listeners.push_back(listener);
+  }
+}
+
+void Tracer::closeListener(int listener) noexcept {
+  // Nothing can still be waiting on this listener, so drop anything queued for it
+  _notify_queue.remove_if([=](const auto& entry) { return entry.first == listener; });
+
+  ::close(listener);
+  _listeners.remove(listener);
+}
+
 // Launch a program fully set up with ptrace and seccomp to be traced by the current process.
 // launch_traced will return the PID of the newly created process, which should be running (or at
 // least ready to be waited on) upon return.
@@ -511,6 +1077,17 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
 
   // If the bpf program hasn't been generated yet, do that now
   if (bpf.size() == 0) {
+    // Make sure the kernel's notification structures match the ones we were built with
+    if (options::seccomp_notify) {
+      struct seccomp_notif_sizes sizes;
+      if (seccomp(SECCOMP_GET_NOTIF_SIZES, 0, &sizes) ||
+          sizes.seccomp_notif > sizeof(struct seccomp_notif) ||
+          sizes.seccomp_notif_resp > sizeof(struct seccomp_notif_resp)) {
+        WARN << "Seccomp notifications are not supported. Tracing with ptrace instead.";
+        options::seccomp_notify = false;
+      }
+    }
+
     // Compute the offset of the instruction pointer in the seccomp_data struct
     uint32_t ip_offset = offsetof(struct seccomp_data, instruction_pointer);
 
@@ -553,7 +1130,13 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
         bpf.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
 
       } else {
-        if (SyscallTable<Build>::get(i).isTraced()) {
+        if (SyscallTable<Build>::get(i).isTraced() && options::seccomp_notify &&
+            isNotifySafe(i)) {
+          // Check if the syscall matches the current entry. If it matches, notify the tracer.
+          bpf.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, i, 0, 1));
+          bpf.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF));
+
+        } else if (SyscallTable<Build>::get(i).isTraced()) {
           // Check if the syscall matches the current entry. If it matches, trace the syscall.
           bpf.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, i, 0, 1));
           bpf.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
@@ -570,6 +1153,16 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
     bpf.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
   }
 
+  // The child sends its seccomp notification fd back over this socket pair
+  int notify_sock[2] = {-1, -1};
+  if (options::seccomp_notify) {
+    FAIL_IF(::socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, notify_sock))
+        << "Failed to create socket for seccomp notifications: " << ERR;
+  }
+
+  // We wait on the new child directly until it reaches exec, so the collector must not
+  if (_collector) _collector->pauseWaits();
+
   // Launch a child process
   pid_t child_pid = fork();
   FAIL_IF(child_pid == -1) << "Failed to fork: " << ERR;
@@ -604,21 +1197,6 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
 
     // TODO: Change to the appropriate root directory
 
-    // Lock down the process so that we are allowed to
-    // use seccomp without special permissions
-    FAIL_IF(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) << "Failed to allow seccomp: " << ERR;
-
-    struct sock_fprog bpf_program;
-    bpf_program.filter = bpf.data();
-    bpf_program.len = bpf.size();
-
-    // Actually enable the filter
-    FAIL_IF(seccomp(SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_SPEC_ALLOW, &bpf_program) != 0)
-        << "Error enabling seccomp: " << ERR;
-
-    // Raise SIGSTOP so the parent can resume this process once ptrace is all set up
-    // raise(SIGSTOP);
-
     vector<const char*> args;
     for (const auto& s : cmd->getArguments()) {
       args.push_back(s.c_str());
@@ -650,6 +1228,37 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
     auto exe = cmd->getRef(Ref::Exe)->getArtifact();
     auto exe_path = exe->getCommittedPath();
     ASSERT(exe_path.has_value()) << "Executable has no committed path";
+
+    // Enable tracing last. A notified system call would block until the tracer polls for it, which
+    // it does not do until this process reaches exec.
+
+    // Lock down the process so that we are allowed to
+    // use seccomp without special permissions
+    FAIL_IF(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) << "Failed to allow seccomp: " << ERR;
+
+    struct sock_fprog bpf_program;
+    bpf_program.filter = bpf.data();
+    bpf_program.len = bpf.size();
+
+    if (options::seccomp_notify) {
+      // Enable the filter and get a notification fd for it
+      int listener = seccomp(SECCOMP_SET_MODE_FILTER,
+                             SECCOMP_FILTER_FLAG_SPEC_ALLOW | SECCOMP_FILTER_FLAG_NEW_LISTENER,
+                             &bpf_program);
+      FAIL_IF(listener < 0) << "Error enabling seccomp: " << ERR;
+
+      // Hand the notification fd to the tracer. It is close-on-exec, so it will not leak.
+      FAIL_IF(!sendFD(notify_sock[1], listener)) << "Failed to send seccomp notification fd";
+
+    } else {
+      // Actually enable the filter
+      FAIL_IF(seccomp(SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_SPEC_ALLOW, &bpf_program) != 0)
+          << "Error enabling seccomp: " << ERR;
+    }
+
+    // Raise SIGSTOP so the parent can resume this process once ptrace is all set up
+    // raise(SIGSTOP);
+
     execv(exe_path.value().c_str(), (char* const*)args.data());
 
     // This is unreachable, unless execv fails
@@ -681,17 +1290,29 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
   FAIL_IF(!WIFSTOPPED(wstatus) || (wstatus >> 8) != (SIGTRAP | (PTRACE_EVENT_EXEC << 8)))
       << "Unexpected stop from child. Expected EXEC";
 
+  // Collect the child's seccomp notification fd
+  if (options::seccomp_notify) {
+    int listener = receiveFD(notify_sock[0]);
+    FAIL_IF(listener < 0) << "Failed to receive seccomp notification fd: " << ERR;
+    addListener(listener);
+
+    ::close(notify_sock[0]);
+    ::close(notify_sock[1]);
+  }
+
   // Now the tracee can run the launched command
   FAIL_IF(ptrace(PTRACE_CONT, child_pid, nullptr, 0)) << "Failed to resume child: " << ERR;
 
-  map<int, Process::FileDescriptor> fds;
+  if (_collector) _collector->resumeWaits();
+
+  FDTable fds;
   for (auto& [fd, ref] : cmd->getInitialFDs()) {
-    fds[fd] = Process::FileDescriptor{ref, false};
+    fds.set(fd, ref, false);
   }
 
   auto proc =
       make_shared<Process>(build, TracedIRSource(), cmd, child_pid, Ref::Cwd, Ref::Root, fds);
-  _threads.emplace(child_pid, Thread(*this, proc, child_pid));
+  addThread(child_pid, proc);
 
   // The process is the primary process for its command
   proc->setPrimary();
@@ -705,17 +1326,69 @@ void Tracer::printSyscallStats() noexcept {
   std::sort(sorted.begin(), sorted.end(),
             [](const auto& a, const auto& b) { return a.second > b.second; });
 
+  // Rare system calls are left out to keep the report short, unless --syscall-stats-min says
+  // otherwise. The CSV file includes all of them.
   std::cout << "System Call Stats:" << std::endl;
   for (const auto& [name, count] : sorted) {
-    if (count > 100) std::cout << "  " << name << ": " << count << std::endl;
+    if (count > options::syscall_stats_min) std::cout << "  " << name << ": " << count << std::endl;
   }
 
   std::cout << std::endl;
 
-  size_t total_syscalls = Tracer::fast_syscall_count + Tracer::ptrace_syscall_count;
+  size_t total_syscalls = Tracer::fast_syscall_count + Tracer::ptrace_syscall_count +
+                          Tracer::notify_syscall_count;
   size_t percent_fast = (100 * Tracer::fast_syscall_count) / total_syscalls;
   std::cout << Tracer::fast_syscall_count << "/" << total_syscalls << " (" << percent_fast
             << "%) syscalls handed by fast tracing" << std::endl;
+
+  if (options::seccomp_notify) {
+    size_t percent_notify = (100 * Tracer::notify_syscall_count) / total_syscalls;
+    std::cout << Tracer::notify_syscall_count << "/" << total_syscalls << " (" << percent_notify
+              << "%) syscalls handled by seccomp notification" << std::endl;
+  }
+
+  // Print the time tracees spent blocked in each system call, slowest total first
+  vector<std::pair<std::string, const Histogram*>> latencies;
+  for (const auto& [name, h] : Tracer::syscall_latency) {
+    if (h.count() > options::syscall_stats_min) latencies.emplace_back(name, &h);
+  }
+  std::sort(latencies.begin(), latencies.end(), [](const auto& a, const auto& b) {
+    return a.second->mean() * a.second->count() > b.second->mean() * b.second->count();
+  });
+
+  std::cout << std::endl << "System Call Latency (us):" << std::endl;
+  std::cout << "  " << std::left << std::setw(32) << "syscall" << std::right << std::setw(10)
+            << "count" << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10)
+            << "p99" << std::setw(10) << "max" << std::endl;
+  for (const auto& [name, h] : latencies) {
+    std::cout << "  " << std::left << std::setw(32) << name << std::right << std::setw(10)
+              << h->count() << std::fixed << std::setprecision(1) << std::setw(10)
+              << h->percentile(50) / 1e3 << std::setw(10) << h->percentile(90) / 1e3
+              << std::setw(10) << h->percentile(99) / 1e3 << std::setw(10) << h->max() / 1e3
+              << std::endl;
+  }
+
+  if (!options::syscall_stats_csv.empty()) writeSyscallLatencyCSV(options::syscall_stats_csv);
+}
+
+void Tracer::writeSyscallLatencyCSV(const std::string& path) noexcept {
+  std::ofstream out(path);
+  if (!out) {
+    WARN << "Unable to write system call latencies to " << path;
+    return;
+  }
+
+  out << "syscall,path,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << std::endl;
+  for (const auto& [key, h] : Tracer::syscall_latency) {
+    // Keys are formatted as "name (path)"
+    auto split = key.find(" (");
+    auto name = key.substr(0, split);
+    auto via = key.substr(split + 2, key.size() - split - 3);
+
+    out << name << "," << via << "," << h.count() << "," << h.mean() << "," << h.percentile(50)
+        << "," << h.percentile(90) << "," << h.percentile(99) << "," << h.percentile(99.9) << ","
+        << h.max() << std::endl;
+  }
 }
 
 // Get the system call being traced through the specified shared memory channel
@@ -788,3 +1461,63 @@ void Tracer::channelSkip(ssize_t i, long result) noexcept {
 void* Tracer::channelGetBuffer(ssize_t i) noexcept {
   return _shmem->channels[i].buffer;
 }
+
+// Let a tracee blocked on a seccomp notification run its system call
+void Tracer::notifyContinue(int listener, uint64_t id) noexcept {
+  struct seccomp_notif_resp resp = {};
+  resp.id = id;
+  resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+
+  // The notification is gone if the tracee was interrupted, so there is nothing to resume
+  if (::ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp)) {
+    FAIL_IF(errno != ENOENT) << "Failed to resume system call for seccomp notification: " << ERR;
+  }
+}
+
+// Answer a seccomp notification with the provided result instead of running the system call
+void Tracer::notifySkip(int listener, uint64_t id, long result) noexcept {
+  struct seccomp_notif_resp resp = {};
+  resp.id = id;
+  if (result < 0) {
+    resp.error = result;
+  } else {
+    resp.val = result;
+  }
+
+  if (::ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp)) {
+    FAIL_IF(errno != ENOENT) << "Failed to answer seccomp notification: " << ERR;
+  }
+}
+
+// Install a file descriptor in a tracee blocked on a seccomp notification
+long Tracer::notifyAddFD(int listener, uint64_t id, int fd, bool cloexec) noexcept {
+  struct seccomp_notif_addfd addfd = {};
+  addfd.id = id;
+  addfd.flags = SECCOMP_ADDFD_FLAG_SEND;
+  addfd.srcfd = fd;
+  addfd.newfd_flags = cloexec ? O_CLOEXEC : 0;
+
+  // Install the fd and answer the notification in one step
+  int newfd = ::ioctl(listener, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd);
+  if (newfd >= 0) return newfd;
+
+  // Kernels before 5.14 cannot install and answer at once. Do the two steps separately.
+  if (errno == EINVAL) {
+    addfd.flags = 0;
+    newfd = ::ioctl(listener, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd);
+    if (newfd >= 0) {
+      notifySkip(listener, id, newfd);
+      return newfd;
+    }
+  }
+
+  // The tracee does not have the file open, so report the failure
+  long result = -errno;
+  if (errno != ENOENT) notifySkip(listener, id, result);
+  return result;
+}
+
+// Check whether the tracee is still blocked on a seccomp notification
+bool Tracer::notifyValid(int listener, uint64_t id) noexcept {
+  return ::ioctl(listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &id) == 0;
+}
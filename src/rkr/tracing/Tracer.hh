@@ -1,15 +1,22 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <list>
 #include <memory>
 #include <optional>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
 
+#include <linux/seccomp.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 
+#include "tracing/Supervisor.hh"
 #include "tracing/Thread.hh"
 #include "tracing/inject.h"
+#include "util/Histogram.hh"
 
 class Build;
 class Command;
@@ -20,7 +27,10 @@ class Tracer {
 
  public:
   /// Create a tracer linked to a specific rebuild environment
-  Tracer() noexcept {}
+  Tracer() noexcept;
+
+  /// Stop the collector thread, if there is one, and close any remaining notification fds
+  ~Tracer() noexcept;
 
   // Disallow copy
   Tracer(const Tracer&) = delete;
@@ -32,9 +42,15 @@ class Tracer {
   /// Wait for a specific process to exit, or all processes if unspecified
   void wait(Build& build, std::shared_ptr<Process> p = nullptr) noexcept;
 
+  /// Handle tracing events until done returns true, or until all processes have exited
+  void waitUntil(Build& build, std::function<bool()> done) noexcept;
+
   /// Claim a process from the set of exited processes
   std::shared_ptr<Process> getExited(pid_t pid) noexcept;
 
+  /// Hand a notified open to a supervisor thread
+  void superviseOpen(Supervisor::Request request) noexcept;
+
  private:
   /// Get the next available traced event
   std::optional<std::tuple<pid_t, int>> getEvent(Build& build) noexcept;
@@ -45,8 +61,38 @@ class Tracer {
   /// Called when we catch a system call in the traced process
   void handleSyscall(Build& build, Thread& t) noexcept;
 
+  /// Get the next traced event gathered by the collector thread
+  std::optional<std::tuple<pid_t, int>> getCollectedEvent(Build& build) noexcept;
+
+  /// Sleep until the collector thread or a supervisor thread has something for us
+  void waitForCollector() noexcept;
+
+  /// Start a thread to gather tracing events so this thread only has to handle them
+  void startCollector() noexcept;
+
+  /// Handle a system call entry or exit reported through a shared memory channel
+  void handleChannel(Build& build, size_t channel, int state) noexcept;
+
+  /// Receive and handle any pending seccomp notifications
+  void handleNotifications(Build& build) noexcept;
+
+  /// Handle a seccomp notification received from a listener fd
+  void handleNotification(Build& build, int listener, const struct seccomp_notif& notif) noexcept;
+
+  /// Finish the notified opens supervisor threads have answered
+  void handleSupervisedOpens(Build& build) noexcept;
+
+  /// Start polling a new seccomp notification fd
+  void addListener(int listener) noexcept;
+
+  /// Close a seccomp notification fd that no tracee uses anymore
+  void closeListener(int listener) noexcept;
+
+  /// Start tracking a new thread, and release any events that arrived before it was known
+  void addThread(pid_t tid, std::shared_ptr<Process> proc) noexcept;
+
   /// Called after a traced process issues a clone system call
-  void handleClone(Build& build, Thread& t, int flags) noexcept;
+  void handleClone(Build& build, Thread& t) noexcept;
 
   /// Called after a traced process issues a fork system call
   void handleFork(Build& build, Thread& t) noexcept;
@@ -59,11 +105,16 @@ class Tracer {
 
  public:
   inline static std::map<std::string, size_t> syscall_counts;
+  inline static std::map<std::string, Histogram> syscall_latency;
   inline static size_t ptrace_syscall_count = 0;
   inline static size_t fast_syscall_count = 0;
+  inline static size_t notify_syscall_count = 0;
 
   static void printSyscallStats() noexcept;
 
+  /// Write system call latency percentiles to a CSV file
+  static void writeSyscallLatencyCSV(const std::string& path) noexcept;
+
   /// Get the system call being traced through the specified shared memory channel
   static long getSyscallNumber(ssize_t channel) noexcept;
 
@@ -91,6 +142,19 @@ class Tracer {
   /// Get the data buffer associated with a shared memory channel
   static void* channelGetBuffer(ssize_t channel) noexcept;
 
+  /// Let a tracee blocked on a seccomp notification run its system call
+  static void notifyContinue(int listener, uint64_t id) noexcept;
+
+  /// Answer a seccomp notification with the provided result instead of running the system call
+  static void notifySkip(int listener, uint64_t id, long result) noexcept;
+
+  /// Install a file descriptor in a tracee blocked on a seccomp notification. The new fd number is
+  /// returned to the tracee as the system call result, and to the caller.
+  static long notifyAddFD(int listener, uint64_t id, int fd, bool cloexec) noexcept;
+
+  /// Check whether the tracee is still blocked on a seccomp notification
+  static bool notifyValid(int listener, uint64_t id) noexcept;
+
  private:
   /// A map from thread IDs to threads
   std::unordered_map<pid_t, Thread> _threads;
@@ -99,8 +163,27 @@ class Tracer {
   std::unordered_map<pid_t, std::shared_ptr<Process>> _exited;
 
   /// Some tracing events appear before we can process them (e.g. in a child process before we've
-  /// seen its creation. Store them here.
-  std::list<std::tuple<pid_t, int>> _event_queue;
+  /// seen its creation). Their wait statuses are stored here, in order, keyed by thread id.
+  std::unordered_map<pid_t, std::deque<int>> _pending_events;
+
+  /// Events released from _pending_events once their threads became known
+  std::deque<std::tuple<pid_t, int>> _ready_events;
+
+  /// The resource usage reported by wait4 for threads that have exited, until the exit is handled
+  std::unordered_map<pid_t, struct rusage> _exit_usage;
+
+  /// The seccomp notification fds for all launched commands. Owned by the collector if it runs.
+  std::list<int> _listeners;
+
+  /// State shared with the collector thread, if one is running
+  struct Collector;
+  std::unique_ptr<Collector> _collector;
+
+  /// Seccomp notifications from threads we have not seen created yet, with their listener fds
+  std::list<std::pair<int, struct seccomp_notif>> _notify_queue;
+
+  /// Supervisor threads that run notified opens, started on first use
+  std::unique_ptr<Supervisor> _supervisor;
 
   /// The file descriptor for the shared memory tracing channels
   inline static int _trace_data_fd = -1;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -25,3 +26,15 @@ void do_graph(std::vector<std::string> args,
               bool no_render) noexcept;
 
 void do_stats(std::vector<std::string> args, bool list_artifacts) noexcept;
+
+void do_profile(std::vector<std::string> args, size_t limit) noexcept;
+
+void do_daemon(std::vector<std::string> args) noexcept;
+
+/// Ask a running build daemon whether the last build is still up to date
+bool daemon_reports_up_to_date() noexcept;
+
+void do_bench_trace(std::vector<std::string> args,
+                    size_t iterations,
+                    size_t commands,
+                    size_t inputs) noexcept;
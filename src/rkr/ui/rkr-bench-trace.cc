@@ -0,0 +1,95 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "data/ReadWriteCombiner.hh"
+#include "data/SyntheticTrace.hh"
+#include "data/Trace.hh"
+#include "runtime/Build.hh"
+#include "runtime/env.hh"
+#include "ui/commands.hh"
+#include "util/constants.hh"
+#include "util/stats.hh"
+
+using std::cout;
+using std::endl;
+using std::function;
+using std::optional;
+using std::string;
+using std::vector;
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Run the `bench-trace` subcommand
+ * \param iterations  The number of times each phase is repeated
+ * \param commands    If nonzero, benchmark a synthetic trace with this many commands
+ * \param inputs      The number of inputs each command in a synthetic trace reads
+ */
+void do_bench_trace(vector<string> args,
+                    size_t iterations,
+                    size_t commands,
+                    size_t inputs) noexcept {
+  // Get a fresh reader for the trace being measured
+  auto get_trace = [&]() -> TraceReader {
+    if (commands > 0) {
+      TraceWriter writer;
+      SyntheticTrace(commands, inputs).sendTo(writer);
+      return writer.getReader();
+    }
+
+    auto trace = TraceReader::load(constants::DatabaseFilename);
+    FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
+    return std::move(trace.value());
+  };
+
+  if (commands > 0) {
+    cout << "Synthetic trace: " << commands << " commands, " << inputs << " inputs" << endl;
+  } else {
+    cout << "Trace: " << constants::DatabaseFilename.string() << endl;
+  }
+
+  // Time one phase of trace handling, sending a fresh trace to the sink produced by run
+  auto measure = [&](string name, function<void(TraceReader&)> run) {
+    size_t records = 0;
+    clock_type::duration elapsed{0};
+
+    for (size_t i = 0; i < iterations; i++) {
+      auto trace = get_trace();
+
+      auto start = clock_type::now();
+      run(trace);
+      elapsed += clock_type::now() - start;
+
+      records += trace.getRecordCount();
+    }
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double ms_per_pass = seconds * 1000 / iterations;
+
+    cout << "  " << std::left << std::setw(10) << name << std::right << std::setw(14)
+         << std::fixed << std::setprecision(0) << (seconds > 0 ? records / seconds : 0)
+         << " records/sec" << std::setw(12) << std::setprecision(3) << ms_per_pass
+         << " ms/pass (" << records / iterations << " records)" << endl;
+  };
+
+  // Decode records without doing anything with them
+  measure("decode", [](TraceReader& trace) { trace.sendTo(IRSink()); });
+
+  // Emulate the trace, then drop the emulated state so the next pass starts fresh
+  measure("emulate", [](TraceReader& trace) {
+    reset_stats();
+    trace.sendTo(Build());
+    env::rollback();
+  });
+
+  // Filter the trace through the read/write combiners
+  measure("combine", [](TraceReader& trace) { trace.sendTo(ReadWriteCombiner<IRSink>()); });
+
+  // Write the trace back out to a temporary file
+  measure("encode", [](TraceReader& trace) { trace.sendTo(TraceWriter()); });
+}
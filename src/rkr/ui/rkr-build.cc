@@ -5,16 +5,22 @@
 #include <string>
 #include <vector>
 
+#include <time.h>
+
 #include "data/DefaultTrace.hh"
 #include "data/PostBuildChecker.hh"
 #include "data/ReadWriteCombiner.hh"
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
 #include "runtime/env.hh"
+#include "runtime/jobserver.hh"
+#include "runtime/summary.hh"
 #include "tracing/Tracer.hh"
 #include "ui/commands.hh"
 #include "util/constants.hh"
+#include "util/options.hh"
 #include "util/stats.hh"
+#include "util/timeline.hh"
 
 namespace fs = std::filesystem;
 
@@ -34,12 +40,31 @@ void do_build(vector<string> args,
               optional<fs::path> stats_log_path,
               string command_output,
               bool refresh) noexcept {
+  // Stats, timings, and timelines describe a full emulation, so never skip one when they are on
+  bool reporting = stats_log_path.has_value() || options::syscall_stats ||
+                   options::timing_stats || !options::timeline.empty();
+
+  // If a build daemon is watching this build and has seen no changes, there is nothing to do
+  if (!refresh && !reporting && daemon_reports_up_to_date()) {
+    LOG(phase) << "Build daemon reports the build is up to date";
+    return;
+  }
+
+  // If nothing the last up-to-date build depended on has changed, there is nothing to do
+  if (!refresh && !reporting && summary::isUpToDate(args)) return;
+
+  // The summary may not hold after this build runs
+  summary::remove();
+
   // Make sure the output directory exists
   fs::create_directories(constants::OutputDir);
 
   // Also ensure that the cache directory exists
   fs::create_directory(constants::CacheDir);
 
+  // Join an enclosing make's jobserver, or create one if a job limit was requested
+  jobserver::init(options::jobs);
+
   // Set up an ostream to print to if necessary
   unique_ptr<ostream> print_to;
   if (command_output != "-") {
@@ -49,6 +74,9 @@ void do_build(vector<string> args,
   // Build stats
   optional<string> stats;
 
+  // Start recording a timeline if one was requested
+  if (!options::timeline.empty()) timeline::open(options::timeline);
+
   // Reset the statistics counters
   reset_stats();
 
@@ -59,6 +87,11 @@ void do_build(vector<string> args,
   shared_ptr<Command> root_cmd;
 
   LOG(phase) << "Starting build phase 0";
+  auto phase_start = timeline::clock::now();
+
+  // Record when the build started. Paths modified after this cannot appear in a build summary.
+  struct timespec build_start;
+  ::clock_gettime(CLOCK_REALTIME, &build_start);
 
   // Is there a trace to load?
   if (auto loaded = TraceReader::load(constants::DatabaseFilename); loaded && !refresh) {
@@ -70,7 +103,10 @@ void do_build(vector<string> args,
 
     // Evaluate the loaded trace
     Build eval(output, print_to ? *print_to : std::cout);
-    loaded->sendTo(eval);
+    {
+      ScopedTimer timer(Timer::Emulation);
+      loaded->sendTo(eval);
+    }
 
     // The output now holds the next input. Save it
     input = output.getReader();
@@ -87,7 +123,10 @@ void do_build(vector<string> args,
 
     // Evaluate the default trace
     Build eval(output, print_to ? *print_to : std::cout);
-    def.sendTo(eval);
+    {
+      ScopedTimer timer(Timer::Emulation);
+      def.sendTo(eval);
+    }
 
     // The output now holds the next input. Save it
     input = output.getReader();
@@ -97,6 +136,7 @@ void do_build(vector<string> args,
   root_cmd->planBuild();
 
   LOG(phase) << "Finished build phase 0";
+  timeline::span("phase", "phase 0", timeline::BuildTrack, phase_start, timeline::clock::now());
 
   // Write stats out to CSV & reset counters
   gather_stats(stats_log_path, stats, 0);
@@ -113,11 +153,18 @@ void do_build(vector<string> args,
     // Revert the environment to committed state
     env::rollback();
 
+    // Hash outputs with deferred fingerprints before the commands that wrote them run again
+    env::resolvePendingHashes();
+
     LOGF(phase, "Starting build phase {}", iteration);
+    timeline::Span phase_span("phase", "phase " + std::to_string(iteration));
 
     // Run the trace and send the new trace to output
     Build build(output, print_to ? *print_to : std::cout);
-    input.sendTo(build);
+    {
+      ScopedTimer timer(Timer::Emulation);
+      input.sendTo(build);
+    }
 
     // Plan the next iteration
     root_cmd->planBuild();
@@ -137,11 +184,16 @@ void do_build(vector<string> args,
 
   // Commit anything left in the environment
   LOG(phase) << "Committing environment changes";
-  env::commitAll();
+  {
+    timeline::Span commit_span("phase", "commit");
+    env::commitAll();
+  }
 
   // If more than one phase of the build ran, then we know the trace could have changed
   if (iteration > 1) {
     LOG(phase) << "Starting post-build checks";
+    timeline::Span phase_span("phase", "post-build checks");
+    ScopedTimer timer(Timer::PostBuild);
 
     // Run the post-build checks and send the resulting trace directly to output
     PostBuildChecker<TraceWriter> output(constants::DatabaseFilename);
@@ -154,6 +206,10 @@ void do_build(vector<string> args,
     input.sendTo(build);
 
     LOG(phase) << "Finished post-build checks";
+
+  } else {
+    // No commands ran, so save a summary that lets the next build skip emulation
+    summary::save(args, build_start);
   }
 
   gather_stats(stats_log_path, stats, iteration);
@@ -162,4 +218,11 @@ void do_build(vector<string> args,
   if (options::syscall_stats) {
     Tracer::printSyscallStats();
   }
+
+  if (options::timing_stats) {
+    print_timers(std::cout);
+  }
+
+  timeline::close();
+  jobserver::shutdown();
 }
@@ -0,0 +1,249 @@
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "artifacts/Artifact.hh"
+#include "artifacts/DirArtifact.hh"
+#include "data/Trace.hh"
+#include "runtime/Build.hh"
+#include "runtime/Command.hh"
+#include "runtime/env.hh"
+#include "ui/commands.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+/// Requests and replies exchanged with the build daemon. Each is a single byte.
+enum : char { DaemonStatusRequest = 'S', DaemonUpToDate = 'C', DaemonOutOfDate = 'D' };
+
+/// Events that may change the outcome of a build
+constexpr uint32_t WatchEvents = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                 IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+                                 IN_MOVED_TO;
+
+/// The maximum number of times the daemon re-checks a build that changes while it is checked
+constexpr int MaxCheckAttempts = 3;
+
+/// The inotify instance watching the build's inputs and outputs
+static int _inotify = -1;
+
+/// Watched directories, indexed by watch descriptor
+static map<int, fs::path> _watches;
+
+/// The set of watched directories
+static set<fs::path> _watched;
+
+/// The absolute path to the build's output directory
+static fs::path _output_dir;
+
+/// Set when the last build may no longer be up to date
+static bool _stale = true;
+
+/// Start watching a directory. Returns true if the directory was not already watched.
+static bool watch(const fs::path& dir) noexcept {
+  if (_watched.find(dir) != _watched.end()) return false;
+
+  int wd = inotify_add_watch(_inotify, dir.c_str(), WatchEvents | IN_ONLYDIR);
+  if (wd < 0) {
+    LOG(phase) << "Unable to watch " << dir << ": " << ERR;
+    return false;
+  }
+
+  _watches[wd] = dir;
+  _watched.insert(dir);
+  return true;
+}
+
+/// Read all pending inotify events and mark the build stale if any of them matter
+static void drainEvents() noexcept {
+  alignas(struct inotify_event) char buf[4096];
+
+  ssize_t len;
+  while ((len = ::read(_inotify, buf, sizeof(buf))) > 0) {
+    for (char* p = buf; p < buf + len;) {
+      auto event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      // If events were dropped we cannot know what changed
+      if (event->mask & IN_Q_OVERFLOW) {
+        _stale = true;
+        continue;
+      }
+
+      auto iter = _watches.find(event->wd);
+      if (iter == _watches.end()) continue;
+
+      // The kernel removed this watch, so the directory must be watched again after a check
+      if (event->mask & IN_IGNORED) {
+        _watched.erase(iter->second);
+        _watches.erase(iter);
+        _stale = true;
+        continue;
+      }
+
+      // In the output directory, only a new trace matters. Ignore the cache and temporary files.
+      if (iter->second == _output_dir) {
+        if (event->len == 0 || event->name != constants::DatabaseFilename.filename()) continue;
+      }
+
+      LOG(phase) << "Build daemon saw a change in " << iter->second;
+      _stale = true;
+    }
+  }
+}
+
+/**
+ * Emulate the saved trace against the filesystem to decide whether a build has any work to do.
+ * Every directory the build depends on is watched before the result is trusted.
+ */
+static bool check() noexcept {
+  for (int attempt = 0; attempt < MaxCheckAttempts; attempt++) {
+    _stale = false;
+
+    // Start from a fresh model of the filesystem
+    env::reset();
+
+    auto trace = TraceReader::load(constants::DatabaseFilename);
+    if (!trace) break;
+    auto root_cmd = trace->getRootCommand();
+
+    // Emulate the trace and plan the next build
+    trace->sendTo(Build());
+    root_cmd->planBuild();
+
+    bool up_to_date = root_cmd->collectMustRun().empty();
+
+    // Watch every directory reached during emulation, and look for changes the build would commit
+    bool new_watches = false;
+    for (const auto& weak_artifact : env::getArtifacts()) {
+      auto a = weak_artifact.lock();
+      if (!a) continue;
+
+      auto path = a->getPath();
+      if (!path.has_value()) continue;
+
+      // A build would have to commit this artifact's content or its link into place
+      if (a->hasUncommittedContent() || a->getCommittedPath() != path) up_to_date = false;
+
+      if (a->as<DirArtifact>()) {
+        new_watches |= watch(path.value());
+      } else {
+        new_watches |= watch(path.value().parent_path());
+      }
+    }
+
+    // Pick up any changes that happened while the trace was emulated
+    drainEvents();
+
+    if (!up_to_date) break;
+
+    // The result only holds if nothing changed in a watched directory while we were checking
+    if (!new_watches && !_stale) return true;
+
+    LOG(phase) << "Build daemon is checking the build again";
+  }
+
+  _stale = true;
+  return false;
+}
+
+/**
+ * Run the `daemon` subcommand
+ */
+void do_daemon(vector<string> args) noexcept {
+  FAIL_IF(!fs::exists(constants::DatabaseFilename))
+      << "A trace could not be loaded. Run a full build first.";
+
+  _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  FAIL_IF(_inotify < 0) << "Failed to initialize inotify: " << ERR;
+
+  // Watch the output directory so we see when a build saves a new trace
+  _output_dir = fs::absolute(constants::OutputDir);
+  watch(_output_dir);
+
+  // Listen for requests from builds
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  constants::DaemonSocket.string().copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+  int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  FAIL_IF(sock < 0) << "Failed to create daemon socket: " << ERR;
+
+  ::unlink(constants::DaemonSocket.c_str());
+  FAIL_IF(::bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || ::listen(sock, 16))
+      << "Failed to listen on " << constants::DaemonSocket << ": " << ERR;
+
+  check();
+
+  cout << "Build daemon listening on " << constants::DaemonSocket.string() << endl;
+
+  while (true) {
+    struct pollfd fds[] = {{.fd = _inotify, .events = POLLIN}, {.fd = sock, .events = POLLIN}};
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      FAIL << "Build daemon failed to wait for events: " << ERR;
+    }
+
+    if (fds[0].revents & POLLIN) drainEvents();
+
+    if (fds[1].revents & POLLIN) {
+      int client = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0) continue;
+
+      char request;
+      if (::read(client, &request, 1) == 1 && request == DaemonStatusRequest) {
+        // Make sure every change made before the request arrived is accounted for
+        drainEvents();
+
+        bool up_to_date = !_stale || check();
+        char reply = up_to_date ? DaemonUpToDate : DaemonOutOfDate;
+        if (::write(client, &reply, 1) != 1) {
+          LOG(phase) << "Failed to reply to a build: " << ERR;
+        }
+      }
+
+      ::close(client);
+    }
+  }
+}
+
+bool daemon_reports_up_to_date() noexcept {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  constants::DaemonSocket.string().copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+  int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) return false;
+
+  // If no daemon is running, fall back to a normal build
+  if (::connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+    ::close(sock);
+    return false;
+  }
+
+  char request = DaemonStatusRequest;
+  char reply = DaemonOutOfDate;
+  if (::write(sock, &request, 1) != 1 || ::read(sock, &reply, 1) != 1) {
+    reply = DaemonOutOfDate;
+  }
+  ::close(sock);
+
+  return reply == DaemonUpToDate;
+}
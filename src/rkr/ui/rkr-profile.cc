@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "data/Trace.hh"
+#include "runtime/Build.hh"
+#include "runtime/Command.hh"
+#include "runtime/CommandGraph.hh"
+#include "ui/commands.hh"
+#include "util/constants.hh"
+#include "util/options.hh"
+#include "util/stats.hh"
+
+using std::cout;
+using std::endl;
+using std::pair;
+using std::string;
+using std::vector;
+
+/// Format a duration in nanoseconds with a unit that suits its size
+static string format_time(uint64_t ns) noexcept {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1);
+  if (ns >= 1000000000) {
+    ss << ns / 1e9 << " s";
+  } else if (ns >= 1000000) {
+    ss << ns / 1e6 << " ms";
+  } else {
+    ss << ns / 1e3 << " us";
+  }
+  return ss.str();
+}
+
+/**
+ * Run the `profile` subcommand
+ * \param limit  The number of commands to list by self time
+ */
+void do_profile(vector<string> args, size_t limit) noexcept {
+  // Load the serialized build trace
+  auto trace = TraceReader::load(constants::DatabaseFilename);
+  FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
+  auto root_cmd = trace->getRootCommand();
+
+  // Emulate the trace. This is the work a build does for every command it does not rerun.
+  reset_stats();
+  auto start = std::chrono::steady_clock::now();
+  trace->sendTo(Build());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  uint64_t emulate_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+  CommandGraph graph(root_cmd);
+
+  // A command's recorded time includes the children it waited for. Subtract the time while any
+  // child was running to find the time the command spent on its own. Children that run in
+  // parallel overlap, so their wall time is merged rather than added. CPU time adds up.
+  vector<uint64_t> self_wall(graph.size());
+  vector<uint64_t> self_cpu(graph.size());
+  Command::Usage total;
+  vector<pair<uint64_t, uint64_t>> intervals;
+  for (uint32_t i = 0; i < graph.size(); i++) {
+    const auto& c = graph.getCommand(i);
+    const auto& usage = c->getLastUsage();
+
+    uint64_t child_cpu = 0;
+    intervals.clear();
+    for (const auto& child : c->getChildren()) {
+      const auto& child_usage = child->getLastUsage();
+      child_cpu += child_usage.cpu_ns;
+
+      // Only the part of a child's run inside this command's run counts against it
+      uint64_t start = std::min(child_usage.start_ns, usage.wall_ns);
+      uint64_t end = std::min(child_usage.start_ns + child_usage.wall_ns, usage.wall_ns);
+      if (end > start) intervals.emplace_back(start, end);
+    }
+
+    // Add up the length of the union of the children's runs
+    std::sort(intervals.begin(), intervals.end());
+    uint64_t child_wall = 0;
+    uint64_t covered = 0;
+    for (auto [start, end] : intervals) {
+      start = std::max(start, covered);
+      if (end > start) child_wall += end - start;
+      covered = std::max(covered, end);
+    }
+
+    self_wall[i] = usage.wall_ns - child_wall;
+    self_cpu[i] = usage.cpu_ns > child_cpu ? usage.cpu_ns - child_cpu : 0;
+
+    total.wall_ns += self_wall[i];
+    total.cpu_ns += self_cpu[i];
+    total.syscalls += usage.syscalls;
+    total.ptrace_stops += usage.ptrace_stops;
+  }
+
+  // Find the critical path. Self time is used so commands are not charged for their children.
+  auto path = graph.longestPaths(self_wall);
+
+  cout << "Build Profile:" << endl;
+  cout << "  Commands: " << graph.size() << endl;
+  cout << "  Command time: " << format_time(total.wall_ns) << " (" << format_time(total.cpu_ns)
+       << " CPU)" << endl;
+  cout << "  Emulation time: " << format_time(emulate_ns) << " (" << stats::emulated_steps
+       << " steps)" << endl;
+  cout << "  Traced syscalls: " << total.syscalls << endl;
+  cout << "  Ptrace stops: " << total.ptrace_stops << endl;
+
+  if (graph.size() == 0) return;
+
+  // Follow the critical path from the command where it is longest
+  uint32_t i = std::max_element(path.begin(), path.end()) - path.begin();
+  cout << endl;
+  cout << "Critical Path: " << format_time(path[i]) << endl;
+
+  vector<bool> visited(graph.size(), false);
+  while (true) {
+    visited[i] = true;
+    cout << "  " << std::setw(10) << format_time(self_wall[i]) << "  "
+         << graph.getCommand(i)->getShortName(options::command_length) << endl;
+
+    // Continue with the user of this command's output that has the longest path of its own
+    int64_t next = -1;
+    graph.outputUsedBy().forEach(i, [&](uint32_t d) {
+      if (visited[d] || path[d] == 0) return;
+      if (next < 0 || path[d] > path[next]) next = d;
+    });
+
+    if (next < 0) break;
+    i = next;
+  }
+
+  // List the commands that spent the most time on their own
+  vector<uint32_t> order(graph.size());
+  for (uint32_t j = 0; j < graph.size(); j++) order[j] = j;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](uint32_t a, uint32_t b) { return self_wall[a] > self_wall[b]; });
+  if (order.size() > limit) order.resize(limit);
+
+  cout << endl;
+  cout << "Commands by Self Time:" << endl;
+  cout << "  " << std::setw(10) << "Self" << std::setw(11) << "Wall" << std::setw(11) << "CPU"
+       << std::setw(10) << "RSS" << std::setw(10) << "Syscalls" << std::setw(8) << "Stops"
+       << "  Command" << endl;
+  for (uint32_t j : order) {
+    const auto& c = graph.getCommand(j);
+    const auto& usage = c->getLastUsage();
+    cout << "  " << std::setw(10) << format_time(self_wall[j]) << std::setw(11)
+         << format_time(usage.wall_ns) << std::setw(11) << format_time(self_cpu[j])
+         << std::setw(7) << usage.max_rss_kb / 1024 << " MB" << std::setw(10) << usage.syscalls
+         << std::setw(8) << usage.ptrace_stops << "  "
+         << c->getShortName(options::command_length) << endl;
+  }
+}
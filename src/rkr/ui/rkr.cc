@@ -16,6 +16,7 @@
 #include "ui/commands.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/stats.hh"
 
 namespace fs = std::filesystem;
 
@@ -36,6 +37,9 @@ static bool stderr_supports_colors() noexcept {
  * This is the entry point for the rkr command line tool
  */
 int main(int argc, char* argv[]) noexcept {
+  // This thread runs the build, so it is the one that records build timers
+  ScopedTimer::enableOnThisThread();
+
   // Set color output based on TERM setting (can be overridden with command line option)
   if (!stderr_supports_colors()) options::disable_color = true;
 
@@ -109,6 +113,11 @@ int main(int argc, char* argv[]) noexcept {
       ->description("Disable the build cache")
       ->group("Optimizations");
 
+  app.add_option("--remote-cache", options::remote_cache_socket,
+                 "Share cached files with a cache daemon listening on a Unix socket")
+      ->type_name("SOCKET")
+      ->group("Optimizations");
+
   /************* Build Subcommand *************/
   auto build = app.add_subcommand("build", "Perform a build (default)");
 
@@ -126,7 +135,37 @@ int main(int argc, char* argv[]) noexcept {
       "--no-inject", []() { options::inject_tracing_lib = false; },
       "Do not inject the faster shared memory tracing library");
 
+  build->add_flag("--seccomp-notify", options::seccomp_notify,
+                  "Handle common system calls with seccomp notifications instead of ptrace");
+
+  build->add_flag("--tracer-thread", options::tracer_thread,
+                  "Gather tracing events on a separate thread");
+
   build->add_flag("--syscall-stats", options::syscall_stats, "Collect system call statistics");
+
+  build
+      ->add_option_function<string>(
+          "--syscall-stats-csv",
+          [](const string& path) {
+            options::syscall_stats = true;
+            options::syscall_stats_csv = path;
+          },
+          "Collect system call statistics and write latency percentiles to a CSV file")
+      ->type_name("FILE");
+
+  build
+      ->add_option("--syscall-stats-min", options::syscall_stats_min,
+                   "Leave system calls made this many times or fewer out of the printed stats "
+                   "(default: 100)")
+      ->type_name("N");
+
+  build->add_flag("--timing-stats", options::timing_stats,
+                  "Report the time spent in each part of the build");
+
+  build
+      ->add_option("--timeline", options::timeline,
+                   "Write a Chrome trace-event timeline of the build to a JSON file")
+      ->type_name("FILE");
   
   bool refresh = false;
   build->add_flag("--fresh", refresh, "Run full build");
@@ -146,6 +185,11 @@ int main(int argc, char* argv[]) noexcept {
       // Hide the --no-wrapper flag if it is disabled by default
       ->group(options::parallel_wrapper ? "Options" : "");
 
+  build
+      ->add_option("-j,--jobs", options::jobs,
+                   "Limit the number of commands and compiler jobs that run at once")
+      ->type_name("N");
+
   string command_output = "-";
   build->add_option("-o,--output", command_output,
                     "Output file where commands should be printed (default: -)");
@@ -184,6 +228,34 @@ int main(int argc, char* argv[]) noexcept {
   auto stats = app.add_subcommand("stats", "Print build statistics");
   stats->add_flag("-a,--artifacts", list_artifacts, "Print a list of artifacts and their versions");
 
+  /************* Profile Subcommand *************/
+  size_t profile_limit = 20;
+
+  auto profile =
+      app.add_subcommand("profile", "Report the critical path and where build time is spent");
+  profile->add_option("-n,--limit", profile_limit,
+                      "Number of commands to list by self time (default: 20)");
+
+  /************* Daemon Subcommand *************/
+  auto daemon = app.add_subcommand(
+      "daemon", "Watch the build's inputs and answer no-op builds without emulating the trace");
+
+  /************* Bench-Trace Subcommand *************/
+  size_t bench_iterations = 5;
+  size_t bench_commands = 0;
+  size_t bench_inputs = 8;
+
+  auto bench_trace =
+      app.add_subcommand("bench-trace", "Measure trace decoding, emulation, and encoding speed");
+  bench_trace
+      ->add_option("-n,--iterations", bench_iterations,
+                   "Passes over the trace for each phase (default: 5)")
+      ->check(CLI::PositiveNumber);
+  bench_trace->add_option("-s,--synthetic", bench_commands,
+                          "Measure a synthetic trace with this many commands instead of .rkr/db");
+  bench_trace->add_option("-i,--inputs", bench_inputs,
+                          "Inputs read by each command in a synthetic trace (default: 8)");
+
   /************* Rikerfile Arguments ***********/
   vector<string> args;
   app.add_option("--args", args, "Arguments to pass to Rikerfile")->group("");  // hidden from help
@@ -206,6 +278,13 @@ int main(int argc, char* argv[]) noexcept {
   graph->final_callback([&] { do_graph(args, graph_output, graph_type, show_all, no_render); });
   // stats subcommand
   stats->final_callback([&] { do_stats(args, list_artifacts); });
+  // profile subcommand
+  profile->final_callback([&] { do_profile(args, profile_limit); });
+  // daemon subcommand
+  daemon->final_callback([&] { do_daemon(args); });
+  // bench-trace subcommand
+  bench_trace->final_callback(
+      [&] { do_bench_trace(args, bench_iterations, bench_commands, bench_inputs); });
 
   /************* Argument Parsing *************/
 
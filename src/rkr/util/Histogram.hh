@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A histogram of latencies in nanoseconds, with log-linear buckets in the style of an HDR
+ * histogram. Each power-of-two range of values is split into SubBuckets equal buckets, so every
+ * recorded value is kept to within 1/SubBuckets of its magnitude in fixed space.
+ */
+class Histogram {
+ public:
+  /// Record a single value
+  void record(uint64_t ns) noexcept {
+    _counts[bucketFor(ns)]++;
+    _total++;
+    _sum += ns;
+    _max = std::max(_max, ns);
+  }
+
+  /// Get the number of recorded values
+  size_t count() const noexcept { return _total; }
+
+  /// Get the largest recorded value
+  uint64_t max() const noexcept { return _max; }
+
+  /// Get the mean of all recorded values
+  uint64_t mean() const noexcept { return _total == 0 ? 0 : _sum / _total; }
+
+  /// Get the value at a percentile between 0 and 100. The result is the upper bound of the bucket
+  /// that holds the value, and is never larger than the largest recorded value.
+  uint64_t percentile(double p) const noexcept {
+    if (_total == 0) return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(p / 100 * _total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Buckets; i++) {
+      seen += _counts[i];
+      if (seen >= rank) return std::min(upperBound(i), _max);
+    }
+    return _max;
+  }
+
+ private:
+  /// The number of bits of precision kept for each value
+  static constexpr size_t SubBucketBits = 4;
+
+  /// The number of buckets in each power-of-two range
+  static constexpr size_t SubBuckets = size_t(1) << SubBucketBits;
+
+  /// The total number of buckets needed to cover every 64-bit value
+  static constexpr size_t Buckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+  /// Get the index of the bucket that holds a value
+  static size_t bucketFor(uint64_t v) noexcept {
+    if (v < SubBuckets) return v;
+    size_t exp = 63 - __builtin_clzll(v);
+    size_t sub = (v >> (exp - SubBucketBits)) & (SubBuckets - 1);
+    return (exp - SubBucketBits + 1) * SubBuckets + sub;
+  }
+
+  /// Get the largest value that falls in a bucket
+  static uint64_t upperBound(size_t i) noexcept {
+    if (i < SubBuckets) return i;
+    size_t shift = i / SubBuckets - 1;
+    uint64_t lower = uint64_t(SubBuckets + i % SubBuckets) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+  }
+
+  /// The number of values recorded in each bucket
+  std::array<uint64_t, Buckets> _counts = {};
+
+  /// The number of recorded values
+  uint64_t _total = 0;
+
+  /// The sum of all recorded values
+  uint64_t _sum = 0;
+
+  /// The largest recorded value
+  uint64_t _max = 0;
+};
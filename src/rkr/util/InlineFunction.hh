@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <class Signature, size_t Capacity>
+class InlineFunction;
+
+/**
+ * A move-only callable wrapper that stores its target in a fixed-size buffer inside the wrapper.
+ * Unlike std::function, wrapping a callable never allocates. Callables that do not fit in the
+ * buffer are rejected at compile time.
+ */
+template <class R, class... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+ public:
+  /// Create an empty function
+  InlineFunction() noexcept = default;
+
+  /// Wrap a callable in this function
+  template <class F,
+            class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+  InlineFunction(F&& f) noexcept {
+    using Fn = std::decay_t<F>;
+    static_assert(sizeof(Fn) <= Capacity, "Callable is too large for InlineFunction storage");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t), "Callable is over-aligned");
+    static_assert(std::is_nothrow_move_constructible_v<Fn>, "Callable must be nothrow-movable");
+
+    new (&_storage) Fn(std::forward<F>(f));
+    _ops = &OpsFor<Fn>;
+  }
+
+  /// Move a function into a new wrapper, leaving the original empty
+  InlineFunction(InlineFunction&& other) noexcept { takeFrom(other); }
+
+  /// Move a function into this wrapper, leaving the original empty
+  InlineFunction& operator=(InlineFunction&& other) noexcept {
+    if (this != &other) {
+      reset();
+      takeFrom(other);
+    }
+    return *this;
+  }
+
+  // Disallow copying
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  /// Destroy the wrapped callable, if there is one
+  ~InlineFunction() noexcept { reset(); }
+
+  /// Check if this wrapper holds a callable
+  explicit operator bool() const noexcept { return _ops != nullptr; }
+
+  /// Call the wrapped callable
+  R operator()(Args... args) noexcept {
+    return _ops->invoke(&_storage, std::forward<Args>(args)...);
+  }
+
+  /// Destroy the wrapped callable and leave this wrapper empty
+  void reset() noexcept {
+    if (_ops != nullptr) {
+      _ops->destroy(&_storage);
+      _ops = nullptr;
+    }
+  }
+
+ private:
+  /// Type-erased operations on the stored callable
+  struct Ops {
+    R (*invoke)(void* fn, Args&&... args) noexcept;
+    void (*move)(void* dest, void* src) noexcept;
+    void (*destroy)(void* fn) noexcept;
+  };
+
+  /// The operations for a specific callable type
+  template <class Fn>
+  static constexpr Ops OpsFor = {
+      [](void* fn, Args&&... args) noexcept -> R {
+        return (*static_cast<Fn*>(fn))(std::forward<Args>(args)...);
+      },
+      [](void* dest, void* src) noexcept {
+        new (dest) Fn(std::move(*static_cast<Fn*>(src)));
+        static_cast<Fn*>(src)->~Fn();
+      },
+      [](void* fn) noexcept { static_cast<Fn*>(fn)->~Fn(); }};
+
+  /// Move the callable out of another wrapper. This wrapper must be empty.
+  void takeFrom(InlineFunction& other) noexcept {
+    if (other._ops != nullptr) {
+      other._ops->move(&_storage, &other._storage);
+      _ops = other._ops;
+      other._ops = nullptr;
+    }
+  }
+
+  /// The storage for the wrapped callable
+  alignas(std::max_align_t) unsigned char _storage[Capacity];
+
+  /// The operations for the wrapped callable, or nullptr if this wrapper is empty
+  const Ops* _ops = nullptr;
+};
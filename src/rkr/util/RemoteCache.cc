@@ -0,0 +1,280 @@
+#include "RemoteCache.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "blake3.h"
+#include "util/cache-protocol.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+
+using std::pair;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+static_assert(CACHE_HASH_LEN == BLAKE3_OUT_LEN, "Remote cache hash length does not match BLAKE3");
+
+namespace remote_cache {
+  /// The connection to the cache daemon, or -1 if not connected
+  static int _sock = -1;
+
+  /// Set when the daemon could not be reached or misbehaved. The remote tier stays off after that.
+  static bool _disabled = false;
+
+  /// Files waiting to be uploaded on the next flush
+  static vector<pair<FileVersion::Hash, fs::path>> _pending;
+
+  /// Hashes already queued, uploaded, or fetched in this build. Each is sent at most once.
+  static set<FileVersion::Hash> _known;
+
+  /// Serializes use of the connection, since files may be cached and staged on worker threads
+  static std::mutex _lock;
+
+  /// Stop using the remote cache for the remainder of this build
+  static void disable(string reason) noexcept {
+    WARN << "Disabling remote cache at " << options::remote_cache_socket << ": " << reason;
+    if (_sock >= 0) ::close(_sock);
+    _sock = -1;
+    _disabled = true;
+    _pending.clear();
+  }
+
+  /// Connect to the cache daemon if we have not already
+  static bool connect() noexcept {
+    if (_sock >= 0) return true;
+    if (_disabled || options::remote_cache_socket.empty()) return false;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (options::remote_cache_socket.size() >= sizeof(addr.sun_path)) {
+      disable("socket path is too long");
+      return false;
+    }
+    options::remote_cache_socket.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    _sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_sock < 0) {
+      disable("unable to create socket: " + string(strerror(errno)));
+      return false;
+    }
+
+    if (::connect(_sock, (struct sockaddr*)&addr, sizeof(addr))) {
+      disable("unable to connect: " + string(strerror(errno)));
+      return false;
+    }
+
+    LOG(cache) << "Connected to remote cache at " << options::remote_cache_socket;
+    return true;
+  }
+
+  /// Send an entire buffer to the daemon
+  static bool sendAll(const void* data, size_t len) noexcept {
+    auto p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+      ssize_t rc = ::send(_sock, p, len, MSG_NOSIGNAL);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) return false;
+      p += rc;
+      len -= rc;
+    }
+    return true;
+  }
+
+  /// Receive exactly len bytes from the daemon
+  static bool recvAll(void* data, size_t len) noexcept {
+    auto p = static_cast<uint8_t*>(data);
+    while (len > 0) {
+      ssize_t rc = ::recv(_sock, p, len, 0);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) return false;
+      p += rc;
+      len -= rc;
+    }
+    return true;
+  }
+
+  bool enabled() noexcept {
+    std::lock_guard guard(_lock);
+    return connect();
+  }
+
+  void put(const FileVersion::Hash& hash, fs::path cache_file) noexcept {
+    std::lock_guard guard(_lock);
+    if (!connect()) return;
+    if (!_known.insert(hash).second) return;
+    _pending.emplace_back(hash, cache_file);
+  }
+
+  /// Stream a single file to the daemon
+  static bool upload(const FileVersion::Hash& hash, const fs::path& cache_file) noexcept {
+    int fd = ::open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      LOG(cache) << "Unable to open " << cache_file << " for upload: " << ERR;
+      return true;
+    }
+
+    struct stat statbuf;
+    if (::fstat(fd, &statbuf)) {
+      LOG(cache) << "Unable to stat " << cache_file << " for upload: " << ERR;
+      ::close(fd);
+      return true;
+    }
+
+    uint8_t op = CACHE_OP_PUT;
+    uint64_t len = statbuf.st_size;
+    if (!sendAll(&op, sizeof(op)) || !sendAll(hash.data(), hash.size()) ||
+        !sendAll(&len, sizeof(len))) {
+      ::close(fd);
+      return false;
+    }
+
+    // Stream the file contents straight from the page cache into the socket
+    off_t offset = 0;
+    while ((uint64_t)offset < len) {
+      ssize_t rc = ::sendfile(_sock, fd, &offset, len - offset);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        ::close(fd);
+        return false;
+      }
+    }
+    ::close(fd);
+
+    uint8_t status;
+    if (!recvAll(&status, sizeof(status))) return false;
+    if (status != CACHE_PRESENT) {
+      LOG(cache) << "Remote cache did not accept " << cache_file;
+    } else {
+      LOG(cache) << "Uploaded " << cache_file << " to remote cache";
+    }
+
+    return true;
+  }
+
+  void flush() noexcept {
+    std::lock_guard guard(_lock);
+    while (!_pending.empty() && connect()) {
+      // Take up to one batch of pending uploads
+      size_t count = std::min(_pending.size(), (size_t)CACHE_MAX_BATCH);
+      vector<pair<FileVersion::Hash, fs::path>> batch(_pending.end() - count, _pending.end());
+      _pending.resize(_pending.size() - count);
+
+      // Ask which of these hashes the daemon already has
+      uint8_t op = CACHE_OP_HAS;
+      uint32_t n = count;
+      bool ok = sendAll(&op, sizeof(op)) && sendAll(&n, sizeof(n));
+      for (size_t i = 0; ok && i < count; i++) {
+        ok = sendAll(batch[i].first.data(), batch[i].first.size());
+      }
+
+      vector<uint8_t> status(count);
+      if (!ok || !recvAll(status.data(), status.size())) {
+        disable("lost connection during existence check");
+        return;
+      }
+
+      // Upload the files that are missing
+      for (size_t i = 0; i < count; i++) {
+        if (status[i] == CACHE_PRESENT) continue;
+        if (!upload(batch[i].first, batch[i].second)) {
+          disable("lost connection during upload");
+          return;
+        }
+      }
+    }
+  }
+
+  bool fetch(const FileVersion::Hash& hash, fs::path dest) noexcept {
+    std::lock_guard guard(_lock);
+    if (!connect()) return false;
+
+    uint8_t op = CACHE_OP_GET;
+    uint8_t status;
+    if (!sendAll(&op, sizeof(op)) || !sendAll(hash.data(), hash.size()) ||
+        !recvAll(&status, sizeof(status))) {
+      disable("lost connection during fetch");
+      return false;
+    }
+
+    if (status != CACHE_PRESENT) {
+      LOG(cache) << "Remote cache miss for " << dest;
+      return false;
+    }
+
+    // The daemon has this content, so it never needs to be uploaded again
+    _known.insert(hash);
+
+    uint64_t len;
+    if (!recvAll(&len, sizeof(len))) {
+      disable("lost connection during fetch");
+      return false;
+    }
+
+    // Stream the content into a temporary file next to the destination. Even if we cannot write
+    // the file we must drain the content from the socket to keep the connection usable.
+    fs::path tmp = dest;
+    tmp += ".fetch";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) LOG(cache) << "Unable to create " << tmp << ": " << ERR;
+
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+
+    bool written = fd >= 0;
+    uint8_t buf[CACHE_CHUNK_SIZE];
+    while (len > 0) {
+      size_t chunk = std::min(len, (uint64_t)sizeof(buf));
+      if (!recvAll(buf, chunk)) {
+        if (fd >= 0) ::close(fd);
+        ::unlink(tmp.c_str());
+        disable("lost connection during fetch");
+        return false;
+      }
+      blake3_hasher_update(&hasher, buf, chunk);
+      if (written && ::write(fd, buf, chunk) != (ssize_t)chunk) {
+        LOG(cache) << "Failed to write " << tmp << ": " << ERR;
+        written = false;
+      }
+      len -= chunk;
+    }
+
+    if (fd >= 0) ::close(fd);
+
+    // Make sure we received the content we asked for before moving it into place
+    FileVersion::Hash received;
+    blake3_hasher_finalize(&hasher, received.data(), received.size());
+
+    if (!written || received != hash) {
+      WARN_IF(written) << "Remote cache returned corrupt content for " << dest;
+      ::unlink(tmp.c_str());
+      return false;
+    }
+
+    if (::rename(tmp.c_str(), dest.c_str())) {
+      LOG(cache) << "Failed to move fetched file into " << dest << ": " << ERR;
+      ::unlink(tmp.c_str());
+      return false;
+    }
+
+    LOG(cache) << "Fetched " << dest << " from remote cache";
+    return true;
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+
+#include "versions/FileVersion.hh"
+
+namespace fs = std::filesystem;
+
+/**
+ * The remote cache is an optional second tier behind the local cache in .rkr/cache. Riker talks to
+ * a cache daemon over a Unix domain socket (see util/cache-protocol.hh). Any failure to reach the
+ * daemon disables the remote tier for the rest of the build; it never causes a build to fail.
+ */
+namespace remote_cache {
+  /// Is a remote cache configured and reachable?
+  bool enabled() noexcept;
+
+  /// Queue a locally-cached file to be uploaded on the next flush, unless its hash was already
+  /// queued, uploaded, or fetched during this build
+  void put(const FileVersion::Hash& hash, fs::path cache_file) noexcept;
+
+  /// Upload all queued files the remote cache does not already have, using one batched HAS query
+  void flush() noexcept;
+
+  /**
+   * Fetch content from the remote cache into a local path. The content is streamed into a
+   * temporary file, checked against the requested hash, and renamed into place.
+   * \returns true if the file was fetched and verified
+   */
+  bool fetch(const FileVersion::Hash& hash, fs::path dest) noexcept;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+/**
+ * A bounded, lock-free queue with one producer thread and one consumer thread. Each thread only
+ * writes its own index, so pushing and popping never wait on each other. Capacity must be a power
+ * of two.
+ */
+template <class T, size_t Capacity>
+class SPSCQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+ public:
+  /// Add a value to the queue. Returns false if the queue is full. Only call from the producer.
+  bool push(const T& value) noexcept {
+    T copy = value;
+    return push(std::move(copy));
+  }
+
+  /// Move a value into the queue. Returns false, leaving value alone, if the queue is full.
+  bool push(T&& value) noexcept {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity) return false;
+
+    _slots[tail & (Capacity - 1)] = std::move(value);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Check whether the queue is empty. Only call from the consumer.
+  bool empty() const noexcept {
+    return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+  }
+
+  /// Take the oldest value from the queue, if there is one. Only call from the consumer.
+  std::optional<T> pop() noexcept {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) return std::nullopt;
+
+    T value = std::move(_slots[head & (Capacity - 1)]);
+    _head.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+ private:
+  /// The storage for queued values
+  std::array<T, Capacity> _slots;
+
+  /// The number of values popped so far. Written only by the consumer.
+  alignas(64) std::atomic<size_t> _head = 0;
+
+  /// The number of values pushed so far. Written only by the producer.
+  alignas(64) std::atomic<size_t> _tail = 0;
+};
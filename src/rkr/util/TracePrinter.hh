@@ -61,7 +61,7 @@ class TracePrinter : public IRSink {
 
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& c,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override {
     _out << SymlinkRefPrinter{c, target, output} << std::endl;
   }
@@ -76,7 +76,7 @@ class TracePrinter : public IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override {
     _out << PathRefPrinter{c, base, path, flags, output} << std::endl;
@@ -115,7 +115,7 @@ class TracePrinter : public IRSink {
                              const std::shared_ptr<Command>& c,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     _out << MatchMetadataPrinter{c, scenario, ref, expected} << std::endl;
   }
 
@@ -123,21 +123,21 @@ class TracePrinter : public IRSink {
                             const std::shared_ptr<Command>& c,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     _out << MatchContentPrinter{c, scenario, ref, expected} << std::endl;
   }
 
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& c,
                               Ref::ID ref,
-                              MetadataVersion written) noexcept override {
+                              const MetadataVersion& written) noexcept override {
     _out << UpdateMetadataPrinter{c, ref, written} << std::endl;
   }
 
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& c,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> written) noexcept override {
+                             const std::shared_ptr<ContentVersion>& written) noexcept override {
     _out << UpdateContentPrinter{c, ref, written} << std::endl;
   }
 
@@ -145,7 +145,7 @@ class TracePrinter : public IRSink {
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& c,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override {
     _out << AddEntryPrinter{c, dir, name, target} << std::endl;
   }
@@ -154,7 +154,7 @@ class TracePrinter : public IRSink {
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& c,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override {
     _out << RemoveEntryPrinter{c, dir, name, target} << std::endl;
   }
@@ -162,7 +162,7 @@ class TracePrinter : public IRSink {
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& c,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override {
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override {
     _out << LaunchPrinter{c, child, refs} << std::endl;
   }
 
@@ -175,7 +175,8 @@ class TracePrinter : public IRSink {
 
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& c,
-                    int exit_status) noexcept override {
+                    int exit_status,
+                    const Command::Usage& usage) noexcept override {
     _out << ExitPrinter{c, exit_status} << std::endl;
   }
 
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Wire format for the remote cache protocol. Riker talks to a local cache daemon over a Unix
+ * domain socket. Every request starts with a one-byte opcode, and content is addressed by its
+ * BLAKE3 hash. Integers are sent in host byte order; the daemon is always on the local machine,
+ * and is responsible for any translation if it forwards requests to other hosts.
+ *
+ *   HAS: op, uint32_t count, count * hash        -> count * status
+ *   GET: op, hash                                -> status [, uint64_t length, content]
+ *   PUT: op, hash, uint64_t length, content      -> status
+ */
+
+/// The number of bytes in a content hash (BLAKE3_OUT_LEN)
+#define CACHE_HASH_LEN 32
+
+/// The maximum number of hashes in a single HAS request
+#define CACHE_MAX_BATCH 1024
+
+/// The size of the chunks used to stream content
+#define CACHE_CHUNK_SIZE 65536
+
+enum cache_op : uint8_t {
+  CACHE_OP_HAS = 'H',  //< Batched existence check
+  CACHE_OP_GET = 'G',  //< Fetch content by hash
+  CACHE_OP_PUT = 'P'   //< Store content under a hash
+};
+
+enum cache_status : uint8_t {
+  CACHE_MISSING = 0,  //< The cache does not have the requested content
+  CACHE_PRESENT = 1,  //< The cache has (or now has) the requested content
+  CACHE_ERROR = 2     //< The cache could not complete the request
+};
@@ -20,4 +20,13 @@ namespace constants {
 
   /// Where are cached files saved?
   const fs::path NewCacheDir = OutputDir / "newcache";
+
+  /// Where does a running build daemon listen for requests?
+  const fs::path DaemonSocket = OutputDir / "daemon.sock";
+
+  /// Where is the summary of the last up-to-date build stored?
+  const fs::path BuildSummary = OutputDir / "summary";
+
+  /// Where is the FIFO for a jobserver created by rkr?
+  const fs::path JobserverFifo = OutputDir / "jobserver";
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+
 enum class FingerprintLevel { None, Local, All };
 
 // Namespace to contain global flags that control build behavior
@@ -28,6 +31,19 @@ namespace options {
   /// When set, gather system call stats and report them at the end of a build
   inline bool syscall_stats = false;
 
+  /// When set, write system call latency percentiles to this CSV file at the end of a build
+  inline std::string syscall_stats_csv;
+
+  /// System calls made this many times or fewer are left out of the printed stats. The CSV file
+  /// always includes every system call.
+  inline size_t syscall_stats_min = 100;
+
+  /// When set, report the time spent in each part of the build at the end of a build
+  inline bool timing_stats = false;
+
+  /// When set, write a Chrome trace-event timeline of the build to this file
+  inline std::string timeline;
+
   /****** Optimization ******/
   /// Enable file-staging cache
   inline bool enable_cache = true;
@@ -35,6 +51,18 @@ namespace options {
   /// Inject the shared memory tracing library
   inline bool inject_tracing_lib = true;
 
+  /// Handle common system calls through seccomp notifications instead of ptrace stops
+  inline bool seccomp_notify = false;
+
+  /// Gather tracing events on a separate thread, leaving the build thread to handle them
+  inline bool tracer_thread = false;
+
   /// Use the parallel compiler wrapper
   inline bool parallel_wrapper = true;
+
+  /// The number of jobs to run at once through a jobserver, or zero for no limit
+  inline size_t jobs = 0;
+
+  /// Path to a remote cache daemon's Unix socket. The remote cache is disabled when empty.
+  inline std::string remote_cache_socket;
 }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Call f(i) for every i in [0, n) using a pool of worker threads, and return once every call has
+ * finished. The calling thread takes part in the work. Calls may run in any order, so f must be
+ * safe to run concurrently for different indices.
+ */
+template <class F>
+void parallel_for(size_t n, F f) noexcept {
+  // Each worker claims the next unclaimed index until none are left
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+    for (size_t i = next++; i < n; i = next++) f(i);
+  };
+
+  size_t threads = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.emplace_back(work);
+  }
+
+  work();
+
+  for (auto& t : workers) t.join();
+}
@@ -2,12 +2,17 @@
 
 #include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <optional>
+#include <ostream>
 #include <string>
 
+#include "util/timeline.hh"
+
 using std::endl;
 using std::fstream;
 using std::optional;
+using std::ostream;
 using std::string;
 using std::to_string;
 
@@ -19,6 +24,79 @@ namespace fs = std::filesystem;
         "artifacts", "versions", "ptrace_stops", "syscalls", "elapsed_ns"              \
   }
 
+string getTimerName(Timer t) noexcept {
+  switch (t) {
+    case Timer::TraceLoad:
+      return "trace_load";
+    case Timer::Emulation:
+      return "emulation";
+    case Timer::Tracing:
+      return "tracing";
+    case Timer::Fingerprint:
+      return "fingerprint";
+    case Timer::Cache:
+      return "cache";
+    case Timer::Stage:
+      return "stage";
+    case Timer::Commit:
+      return "commit";
+    case Timer::PostBuild:
+      return "post_build";
+    case Timer::TraceWrite:
+      return "trace_write";
+    case Timer::Count:
+      break;
+  }
+  return "unknown";
+}
+
+ScopedTimer::ScopedTimer(Timer t) noexcept : _timer(t), _outer(nullptr) {
+  // Timer totals are shared, so only the build thread records them
+  if (!_enabled) return;
+
+  _outer = _current;
+  charge();
+  _current = this;
+  if (timeline::enabled) _start = std::chrono::steady_clock::now();
+
+  stats::timers[static_cast<size_t>(t)].calls++;
+  stats::build_timers[static_cast<size_t>(t)].calls++;
+}
+
+ScopedTimer::~ScopedTimer() noexcept {
+  if (!_enabled) return;
+
+  charge();
+  _current = _outer;
+
+  if (timeline::enabled) {
+    timeline::span("timer", getTimerName(_timer), timeline::BuildTrack, _start,
+                   std::chrono::steady_clock::now());
+  }
+}
+
+void ScopedTimer::charge() noexcept {
+  auto now = std::chrono::steady_clock::now();
+
+  if (_current != nullptr) {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _resumed).count();
+    stats::timers[static_cast<size_t>(_current->_timer)].ns += ns;
+    stats::build_timers[static_cast<size_t>(_current->_timer)].ns += ns;
+  }
+
+  _resumed = now;
+}
+
+void print_timers(ostream& out) noexcept {
+  out << "Time by Subsystem:" << endl;
+  for (size_t i = 0; i < static_cast<size_t>(Timer::Count); i++) {
+    const auto& total = stats::build_timers[i];
+    out << "  " << std::left << std::setw(12) << getTimerName(static_cast<Timer>(i)) << std::right
+        << std::setw(12) << std::fixed << std::setprecision(3) << total.ns / 1e6 << " ms"
+        << std::setw(10) << total.calls << " calls" << endl;
+  }
+}
+
 /**
  * Quote string.
  */
@@ -54,6 +132,12 @@ int stats_header(string& header) {
   }
   generate_row(arr, stats_len, header);
 
+  // Add a time and call count column for each timer
+  for (size_t t = 0; t < static_cast<size_t>(Timer::Count); t++) {
+    header += "," + q(getTimerName(static_cast<Timer>(t)) + "_ns");
+    header += "," + q(getTimerName(static_cast<Timer>(t)) + "_calls");
+  }
+
   return stats_len;
 }
 
@@ -106,5 +190,10 @@ void gather_stats(optional<fs::path> p, optional<string>& stats_opt, int phase)
     stats_opt.value() += q(to_string(stats::ptrace_stops)) + ",";
     stats_opt.value() += q(std::to_string(stats::syscalls)) + ",";
     stats_opt.value() += q(std::to_string((end_time - stats::start_time).count()));
+
+    for (const auto& total : stats::timers) {
+      stats_opt.value() += "," + q(to_string(total.ns));
+      stats_opt.value() += "," + q(to_string(total.calls));
+    }
   }
 }
@@ -1,14 +1,47 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
+#include <ostream>
 #include <string>
 
 namespace fs = std::filesystem;
 
+/// The parts of a build that are timed separately in the build statistics
+enum class Timer : uint8_t {
+  TraceLoad,
+  Emulation,
+  Tracing,
+  Fingerprint,
+  Cache,
+  Stage,
+  Commit,
+  PostBuild,
+  TraceWrite,
+  Count
+};
+
+/// Get the name of a timer, as used in statistics output
+std::string getTimerName(Timer t) noexcept;
+
 namespace stats {
+  /// The total time and number of entries recorded for a single timer
+  struct TimerTotal {
+    uint64_t ns = 0;
+    size_t calls = 0;
+  };
+
+  /// Timer totals for the current phase. Time spent in a nested timer is not charged to the
+  /// timer that encloses it, so these totals never overlap.
+  inline std::array<TimerTotal, static_cast<size_t>(Timer::Count)> timers;
+
+  /// Timer totals for the entire build. These are not cleared by reset_stats
+  inline std::array<TimerTotal, static_cast<size_t>(Timer::Count)> build_timers;
+
   /// The time set when the stats counters were last reset
   inline std::chrono::time_point start_time = std::chrono::high_resolution_clock::now();
 
@@ -48,8 +81,58 @@ inline static void reset_stats() noexcept {
   stats::versions = 0;
   stats::ptrace_stops = 0;
   stats::syscalls = 0;
+  stats::timers = {};
 }
 
+/**
+ * Charge the time spent in a scope to one of the build timers. While a nested ScopedTimer is
+ * active, time is charged to the nested timer instead. Timers only record on the build thread,
+ * which enables them once at startup. On any other thread a ScopedTimer does nothing, so time
+ * spent there is charged to the timer the build thread holds while it waits.
+ */
+class ScopedTimer {
+ public:
+  /// Start charging time to a timer
+  ScopedTimer(Timer t) noexcept;
+
+  /// Stop charging time to this timer and resume the enclosing one
+  ~ScopedTimer() noexcept;
+
+  // Disallow copy
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  /// Record timers on the calling thread. Only the build thread should call this.
+  static void enableOnThisThread() noexcept { _enabled = true; }
+
+ private:
+  /// Charge time since the last switch to the running timer, if there is one
+  static void charge() noexcept;
+
+  /// The timer this scope charges
+  Timer _timer;
+
+  /// The scope that was active when this one started
+  ScopedTimer* _outer;
+
+  /// When this scope started, if a timeline is being recorded
+  std::chrono::steady_clock::time_point _start;
+
+  /// The innermost active timer scope on this thread
+  inline static thread_local ScopedTimer* _current = nullptr;
+
+  /// The time when the innermost timer on this thread last started or resumed
+  inline static thread_local std::chrono::steady_clock::time_point _resumed;
+
+  /// Is timing enabled on this thread?
+  inline static thread_local bool _enabled = false;
+};
+
+/**
+ * Print the build-wide timer totals as a table
+ */
+void print_timers(std::ostream& out) noexcept;
+
 /**
  * Write stats to CSV.
  */
@@ -0,0 +1,117 @@
+#include "timeline.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include <unistd.h>
+
+#include "util/log.hh"
+
+using std::ofstream;
+using std::string;
+
+namespace fs = std::filesystem;
+
+namespace timeline {
+  /// The file the timeline is written to
+  static ofstream _out;
+
+  /// Timestamps are measured from when the timeline was opened
+  static clock::time_point _origin;
+
+  /// Every event is recorded as part of rkr's own process
+  static pid_t _pid;
+
+  /// Has an event been written yet? Events after the first need a separator.
+  static bool _started = false;
+
+  /// Write a string as a quoted JSON string
+  static void writeString(const string& s) noexcept {
+    _out << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        _out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        _out << buf;
+      } else {
+        _out << c;
+      }
+    }
+    _out << '"';
+  }
+
+  /// Write a time in microseconds since the timeline was opened
+  static void writeTime(clock::duration d) noexcept {
+    _out << std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  /// Begin a new event with its common fields, leaving the object open for more fields
+  static void beginEvent(const char* phase, const string& name, pid_t track) noexcept {
+    _out << (_started ? ",\n" : "\n");
+    _started = true;
+
+    _out << "{\"name\":";
+    writeString(name);
+    _out << ",\"ph\":\"" << phase << "\",\"pid\":" << _pid << ",\"tid\":" << track;
+  }
+
+  void open(const fs::path& path) noexcept {
+    _out.open(path);
+    FAIL_IF(!_out) << "Failed to open timeline file " << path;
+
+    _out << std::fixed << std::setprecision(3) << "[";
+    _origin = clock::now();
+    _pid = ::getpid();
+    _started = false;
+    enabled = true;
+
+    nameTrack(BuildTrack, "rkr");
+  }
+
+  void close() noexcept {
+    if (!enabled) return;
+    enabled = false;
+
+    _out << "\n]\n";
+    _out.close();
+  }
+
+  void nameTrack(pid_t track, const string& name) noexcept {
+    if (!enabled) return;
+
+    beginEvent("M", "thread_name", track);
+    _out << ",\"args\":{\"name\":";
+    writeString(name);
+    _out << "}}";
+  }
+
+  void span(const char* category,
+            const string& name,
+            pid_t track,
+            clock::time_point start,
+            clock::time_point end) noexcept {
+    if (!enabled) return;
+
+    beginEvent("X", name, track);
+    _out << ",\"cat\":\"" << category << "\",\"ts\":";
+    writeTime(start - _origin);
+    _out << ",\"dur\":";
+    writeTime(end - start);
+    _out << "}";
+  }
+
+  void instant(const char* category, const string& name, pid_t track) noexcept {
+    if (!enabled) return;
+
+    beginEvent("i", name, track);
+    _out << ",\"cat\":\"" << category << "\",\"s\":\"t\",\"ts\":";
+    writeTime(clock::now() - _origin);
+    _out << "}";
+  }
+}
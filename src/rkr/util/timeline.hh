@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * Record a timeline of the build as Chrome trace-event JSON, which can be opened in Perfetto or
+ * chrome://tracing. Events are recorded between timeline::open and timeline::close, and only from
+ * the build thread.
+ */
+namespace timeline {
+  using clock = std::chrono::steady_clock;
+
+  /// The track for work done by rkr itself. Each traced process has a track named by its pid.
+  constexpr pid_t BuildTrack = 0;
+
+  /// Is a timeline being recorded?
+  inline bool enabled = false;
+
+  /// Start recording a timeline to a file
+  void open(const fs::path& path) noexcept;
+
+  /// Finish the timeline and close its file
+  void close() noexcept;
+
+  /// Give a track a name to show in the viewer
+  void nameTrack(pid_t track, const std::string& name) noexcept;
+
+  /// Record a span of time on a track
+  void span(const char* category,
+            const std::string& name,
+            pid_t track,
+            clock::time_point start,
+            clock::time_point end) noexcept;
+
+  /// Record an event at the current time on a track
+  void instant(const char* category, const std::string& name, pid_t track) noexcept;
+
+  /// Record a span on the build track that lasts as long as this object
+  class Span {
+   public:
+    /// Start a span
+    Span(const char* category, std::string name) noexcept :
+        _category(category), _name(std::move(name)) {
+      if (enabled) _start = clock::now();
+    }
+
+    /// End the span
+    ~Span() noexcept {
+      if (enabled) span(_category, _name, BuildTrack, _start, clock::now());
+    }
+
+    // Disallow copy
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+   private:
+    const char* _category;
+    std::string _name;
+    clock::time_point _start;
+  };
+}
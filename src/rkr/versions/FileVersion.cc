@@ -1,12 +1,16 @@
 #include "FileVersion.hh"
 
+#include <atomic>
 #include <cerrno>
 #include <filesystem>
 #include <iomanip>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <tuple>
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -15,9 +19,11 @@
 #include <unistd.h>
 
 #include "blake3.h"
+#include "util/RemoteCache.hh"
 #include "util/constants.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/stats.hh"
 #include "util/wrappers.hh"
 
 using std::nullopt;
@@ -32,6 +38,17 @@ namespace fs = std::filesystem;
 // The number of bytes read from a file at once when using read() for blake3 hashing
 enum : size_t { BLAKE3BUFSZ = 65536 };
 
+/// Identifies the state of a file whose hash was deferred: inode, size, and mtime
+using PendingKey = std::tuple<ino_t, off_t, time_t, long>;
+
+/// Hashes taken for deferred fingerprints. Every version loaded with the same pending state refers
+/// to the same file contents, so versions read from later traces can pick up a hash taken after
+/// the file was overwritten.
+static std::map<PendingKey, FileVersion::Hash> resolved_hashes;
+
+/// Guards resolved_hashes, since final state may be applied to files on worker threads
+static std::mutex resolved_hashes_lock;
+
 /// Convert a BLAKE3 byte array to a hexadecimal string
 static string b3hex(FileVersion::Hash b3hash) noexcept {
   stringstream ss;
@@ -93,6 +110,64 @@ static optional<FileVersion::Hash> blake3(fs::path path, struct stat& statbuf) n
   return output;
 }
 
+/// Copy a file to a new file at dest while hashing its contents, so the source is only read once.
+/// Returns the hash of the copied contents, or nullopt if the copy failed.
+static optional<FileVersion::Hash> copy_and_hash(fs::path src, fs::path dest) noexcept {
+  int src_fd = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    LOG(artifact) << "Unable to open file " << src << " for caching: " << ERR;
+    return nullopt;
+  }
+
+  int dst_fd = ::open(dest.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+  if (dst_fd < 0) {
+    WARN << "Unable to create file " << dest << ": " << ERR;
+    ::close(src_fd);
+    return nullopt;
+  }
+
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+
+  // Feed each chunk to the hasher and write it out before reading the next one
+  char buf[BLAKE3BUFSZ];
+  ssize_t n;
+  bool ok = true;
+  while (ok && (n = ::read(src_fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      WARN << "Read failed while caching " << src << ": " << ERR;
+      ok = false;
+      break;
+    }
+
+    blake3_hasher_update(&hasher, buf, n);
+
+    for (ssize_t written = 0; written < n;) {
+      ssize_t rc = ::write(dst_fd, buf + written, n - written);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        WARN << "Write failed while caching " << src << " in " << dest << ": " << ERR;
+        ok = false;
+        break;
+      }
+      written += rc;
+    }
+  }
+
+  ::close(src_fd);
+  ::close(dst_fd);
+
+  if (!ok) {
+    ::unlink(dest.c_str());
+    return nullopt;
+  }
+
+  FileVersion::Hash output;
+  blake3_hasher_finalize(&hasher, output.data(), BLAKE3_OUT_LEN);
+  return output;
+}
+
 /// Generate a path from a hash value. The result does not include the cache directory path.
 static fs::path hashPath(FileVersion::Hash& hash) noexcept {
   // We use a three-level directory prefix scheme to store cached files
@@ -197,6 +272,14 @@ void FileVersion::fingerprint(fs::path path, FingerprintType type) noexcept {
   // If a full fingerprint was requested and we already have an mtime and hash, return immediately
   if (type == FingerprintType::Full && _mtime.has_value() && _hash.has_value()) return;
 
+  // If the hash was deferred, take it now if the file still holds this version
+  if (type == FingerprintType::Full && _hash_pending) {
+    resolvePendingHash(path);
+    if (_hash.has_value()) return;
+  }
+
+  ScopedTimer timer(Timer::Fingerprint);
+
   // Stat the file to get mtime, empty, and size
   struct stat statbuf;
   int rc = ::lstat(path.c_str(), &statbuf);
@@ -218,11 +301,72 @@ void FileVersion::fingerprint(fs::path path, FingerprintType type) noexcept {
 
     // finally save hash
     _hash = blake3(path, statbuf);
+    _hash_pending = false;
 
     LOG(cache) << "Collected full fingerprint for version " << this << " at path " << path << ".";
   }
 }
 
+/// Save a quick fingerprint now and defer the hash until it is needed
+void FileVersion::deferFingerprint(fs::path path) noexcept {
+  // Nothing to defer if this version already has a hash
+  if (_hash.has_value()) return;
+
+  ScopedTimer timer(Timer::Fingerprint);
+
+  struct stat statbuf;
+  if (::lstat(path.c_str(), &statbuf)) {
+    LOG(cache) << "Failed stat call in FileVersion::deferFingerprint(" << path << "): " << ERR;
+    return;
+  }
+
+  _empty = statbuf.st_size == 0;
+  _mtime = statbuf.st_mtim;
+
+  // Only regular files are hashed, and empty files do not need a hash
+  if (!S_ISREG(statbuf.st_mode) || _empty) return;
+
+  _hash_pending = true;
+  _size = statbuf.st_size;
+  _inode = statbuf.st_ino;
+
+  LOG(cache) << "Deferred full fingerprint for version " << this << " at path " << path << ".";
+}
+
+/// Take a pending hash if the file still holds this version
+void FileVersion::resolvePendingHash(fs::path path) noexcept {
+  // The hash may already have been taken through another version with the same state
+  takeResolvedHash();
+  if (!_hash_pending) return;
+
+  // Whatever happens below, the hash cannot be taken later
+  _hash_pending = false;
+
+  struct stat statbuf;
+  if (::lstat(path.c_str(), &statbuf)) return;
+
+  // If the file has changed since the fingerprint was deferred, its hash is lost. Comparisons
+  // against this version fall back to the mtime, which may cause extra reruns but never misses a
+  // change.
+  bool changed = !_mtime.has_value() || statbuf.st_mtim.tv_sec != _mtime->tv_sec ||
+                 statbuf.st_mtim.tv_nsec != _mtime->tv_nsec || statbuf.st_size != _size ||
+                 statbuf.st_ino != _inode;
+  if (changed) {
+    LOG(cache) << "Dropped pending fingerprint for version " << this << ": " << path
+               << " has changed.";
+    return;
+  }
+
+  ScopedTimer timer(Timer::Fingerprint);
+  _hash = blake3(path, statbuf);
+  if (_hash.has_value()) {
+    std::lock_guard guard(resolved_hashes_lock);
+    resolved_hashes.emplace(PendingKey(_inode, _size, _mtime->tv_sec, _mtime->tv_nsec), *_hash);
+  }
+
+  LOG(cache) << "Collected pending fingerprint for version " << this << " at path " << path << ".";
+}
+
 void FileVersion::makeEmptyFingerprint() noexcept {
   // it is not necessary to fingerprint or cache empty files
   _empty = true;
@@ -302,9 +446,17 @@ bool FileVersion::stage(fs::path path, mode_t mode) noexcept {
   ASSERT(_hash.has_value()) << "Un-hashed file version " << this << " cannot be staged from cache";
   ASSERT(_cached) << "Attempted to stage un-cached file version " << this << " from cache.";
 
+  ScopedTimer timer(Timer::Stage);
+
   // Path to cached file
   fs::path hash_file = constants::CacheDir / hashPath(_hash.value());
 
+  // If the local cache does not have the file, try to fetch it from the remote cache
+  if (!fileExists(hash_file) && remote_cache::enabled()) {
+    fs::create_directories(hash_file.parent_path());
+    remote_cache::fetch(_hash.value(), hash_file);
+  }
+
   // Copy the cached file into place
   FAIL_IF(!fast_copy(hash_file, path, mode)) << "Failed to stage file " << path << " from cache";
 
@@ -321,6 +473,8 @@ void FileVersion::cache(fs::path path) noexcept {
     return;
   }
 
+  ScopedTimer timer(Timer::Cache);
+
   // Don't cache if this file is empty
   if (_empty) {
     LOG(artifact) << "Not caching version " << this << " at path " << path
@@ -328,6 +482,9 @@ void FileVersion::cache(fs::path path) noexcept {
     return;
   }
 
+  // If this version has not been hashed yet, hash it while copying it into the cache
+  if (!_hash.has_value() && cacheAndHash(path)) return;
+
   // Make sure we have a full fingerprint for this version
   fingerprint(path, FingerprintType::Full);
 
@@ -344,6 +501,7 @@ void FileVersion::cache(fs::path path) noexcept {
   // Is the cache file already in the current cache?  If so, we're done.
   if (fileExists(hash_file)) {
     _cached = true;
+    remote_cache::put(_hash.value(), hash_file);
     return;
   }
 
@@ -356,7 +514,61 @@ void FileVersion::cache(fs::path path) noexcept {
   if (fast_copy(path, hash_file)) {
     LOG(artifact) << "Cached file version at path " << path << " in " << hash_file;
     _cached = true;
+    remote_cache::put(_hash.value(), hash_file);
+  }
+}
+
+bool FileVersion::cacheAndHash(fs::path path) noexcept {
+  // Only regular files are hashed
+  struct stat statbuf;
+  if (::lstat(path.c_str(), &statbuf) || !S_ISREG(statbuf.st_mode)) return false;
+
+  // Record the fields a quick fingerprint would collect
+  _empty = statbuf.st_size == 0;
+  _mtime = statbuf.st_mtim;
+
+  // Copy into a temporary file in the cache, since the content address is not known yet
+  static std::atomic<size_t> next_tmp = 0;
+  auto tmp_file = constants::CacheDir /
+                  (".tmp." + std::to_string(::getpid()) + "." + std::to_string(next_tmp++));
+  fs::create_directories(constants::CacheDir);
+
+  auto hash = copy_and_hash(path, tmp_file);
+  if (!hash.has_value()) return false;
+  _hash = hash;
+  _hash_pending = false;
+
+  LOG(cache) << "Collected full fingerprint for version " << this << " at path " << path << ".";
+
+  // Move the copy to its content-addressed location, unless the cache already has this content
+  fs::path hash_file = constants::CacheDir / hashPath(_hash.value());
+  fs::create_directories(hash_file.parent_path());
+
+  if (fileExists(hash_file)) {
+    ::unlink(tmp_file.c_str());
+  } else if (::rename(tmp_file.c_str(), hash_file.c_str())) {
+    WARN << "Unable to move cached file into place at " << hash_file << ": " << ERR;
+    ::unlink(tmp_file.c_str());
+    return true;
+  } else {
+    LOG(artifact) << "Cached file version at path " << path << " in " << hash_file;
   }
+
+  _cached = true;
+  remote_cache::put(_hash.value(), hash_file);
+  return true;
+}
+
+/// Pick up the hash for a deferred fingerprint if another version with the same state took it
+void FileVersion::takeResolvedHash() noexcept {
+  if (!_hash_pending || !_mtime.has_value()) return;
+
+  std::lock_guard guard(resolved_hashes_lock);
+  auto iter = resolved_hashes.find(PendingKey(_inode, _size, _mtime->tv_sec, _mtime->tv_nsec));
+  if (iter == resolved_hashes.end()) return;
+
+  _hash = iter->second;
+  _hash_pending = false;
 }
 
 /// Compare to another fingerprint instance
@@ -406,6 +618,7 @@ ostream& FileVersion::print(ostream& o) const noexcept {
 
   // has hash
   if (_hash.has_value()) o << "b3hash=" << b3hex(_hash.value()) << " ";
+  if (_hash_pending) o << "b3hash=pending ";
 
   // has cached copy
   o << "cached=" << (_cached ? "true" : "false");
@@ -422,12 +635,18 @@ bool FileVersion::matches(shared_ptr<ContentVersion> other) noexcept {
   if (!other_file) return false;
   if (other_file.get() == this) return true;
 
+  // Use the hashes of deferred fingerprints if they have been taken
+  takeResolvedHash();
+  other_file->takeResolvedHash();
+
   if (fingerprints_match(other_file)) {
     // If either version is hashed, propagate that to the other version
     if (_hash.has_value()) {
       other_file->_hash = _hash;
+      other_file->_hash_pending = false;
     } else if (other_file->_hash.has_value()) {
       _hash = other_file->_hash;
+      _hash_pending = false;
     }
 
     // If either file version is cached, propagate that to the other version
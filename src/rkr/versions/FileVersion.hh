@@ -32,8 +32,17 @@ class FileVersion final : public ContentVersion {
   FileVersion(bool empty,
               bool cached,
               std::optional<struct timespec> mtime,
-              std::optional<Hash> hash) noexcept :
-      _empty(empty), _cached(cached), _mtime(mtime), _hash(hash) {}
+              std::optional<Hash> hash,
+              bool hash_pending = false,
+              off_t size = 0,
+              ino_t inode = 0) noexcept :
+      _empty(empty),
+      _cached(cached),
+      _mtime(mtime),
+      _hash(hash),
+      _hash_pending(hash_pending),
+      _size(size),
+      _inode(inode) {}
 
   /// Get the name for this type of version
   virtual std::string getTypeName() const noexcept override {
@@ -55,6 +64,13 @@ class FileVersion final : public ContentVersion {
   /// Save a fingerprint of this version
   void fingerprint(fs::path path, FingerprintType type) noexcept;
 
+  /// Save a quick fingerprint of this version now, and take its hash only when a comparison needs
+  /// it. The file's size and inode are recorded so the hash is never taken from different content.
+  void deferFingerprint(fs::path path) noexcept;
+
+  /// Take the hash of a deferred fingerprint if the file at path still holds this version
+  void resolvePendingHash(fs::path path) noexcept;
+
   /// Save an empty fingerprint of this version
   void makeEmptyFingerprint() noexcept;
 
@@ -85,6 +101,15 @@ class FileVersion final : public ContentVersion {
   /// Get this version's hash
   const std::optional<Hash>& getHash() const noexcept { return _hash; }
 
+  /// Is this version's hash waiting to be taken?
+  bool hasPendingHash() const noexcept { return _hash_pending; }
+
+  /// Get the size of the file recorded with a pending hash
+  off_t getSize() const noexcept { return _size; }
+
+  /// Get the inode of the file recorded with a pending hash
+  ino_t getInode() const noexcept { return _inode; }
+
  private:
   /// Compare to another fingerprint instance
   bool fingerprints_match(std::shared_ptr<FileVersion> other) const noexcept;
@@ -95,6 +120,13 @@ class FileVersion final : public ContentVersion {
   /// Restore a cached copy to the given path
   bool stage(fs::path path, mode_t mode) noexcept;
 
+  /// Take the hash for a pending fingerprint if it was collected through another version
+  void takeResolvedHash() noexcept;
+
+  /// Hash and cache the file at path in a single pass. Returns false if the file could not be
+  /// read, in which case nothing is cached.
+  bool cacheAndHash(fs::path path) noexcept;
+
  private:
   /// Is this an empty file?
   bool _empty = false;
@@ -108,6 +140,15 @@ class FileVersion final : public ContentVersion {
   /// What is the has of this file version's contents?
   std::optional<Hash> _hash;
 
+  /// Is the hash of this version's contents still waiting to be taken?
+  bool _hash_pending = false;
+
+  /// The size of the file holding this version, recorded when its hash is deferred
+  off_t _size = 0;
+
+  /// The inode of the file holding this version, recorded when its hash is deferred
+  ino_t _inode = 0;
+
   /// Transient field: has this version been linked into the new cache directory?
   bool _linked = false;
 };
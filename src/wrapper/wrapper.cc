@@ -4,9 +4,11 @@
 #include <vector>
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -137,8 +139,326 @@ bool has_suffix(const string& str, const std::initializer_list<string>& suffixes
   return false;
 }
 
+typedef long (*syscall_fn_t)(long, long, long, long, long, long, long);
+
+/// Get the injected library's function for system calls rkr does not trace, if it is loaded
+syscall_fn_t get_syscall_untraced() {
+  static syscall_fn_t _fn = reinterpret_cast<syscall_fn_t>(dlsym(RTLD_NEXT, "syscall_untraced"));
+  return _fn;
+}
+
+/// Make an untraced system call. Jobserver traffic is not part of the build, so rkr should not
+/// see it.
+long syscall_untraced(long nr, long a1 = 0, long a2 = 0, long a3 = 0) {
+  // Try to get the untraced syscall function from the injected library
+  syscall_fn_t fn = get_syscall_untraced();
+
+  if (fn) {
+    return fn(nr, a1, a2, a3, 0, 0, 0);
+  } else {
+    return syscall(nr, a1, a2, a3);
+  }
+}
+
+/// The non-blocking read end of a jobserver's token pool, or -1 if there is no jobserver
+int jobserver_read = -1;
+
+/// The write end of the jobserver's token pool
+int jobserver_write = -1;
+
+/// Tokens taken from the jobserver. They must be returned exactly as they were read.
+vector<char> jobserver_tokens;
+
+/// Open a path for the jobserver without tracing
+int open_untraced(const string& path, int flags) {
+  return syscall_untraced(SYS_openat, AT_FDCWD, (long)path.c_str(), flags | O_CLOEXEC);
+}
+
+/// Connect to a jobserver advertised by make in MAKEFLAGS, or by rkr in RKR_JOBSERVER
+void init_jobserver() {
+  // Without the injected library, rkr would trace token reads and writes as inputs and outputs of
+  // this command. Their timing changes from build to build, so use a local job limit instead.
+  if (get_syscall_untraced() == nullptr) return;
+
+  for (const char* var : {"MAKEFLAGS", "RKR_JOBSERVER"}) {
+    char* flags_str = getenv(var);
+    if (flags_str == NULL) continue;
+
+    // Find the last jobserver option in the flags
+    string flags(flags_str);
+    size_t pos = string::npos;
+    for (const string option : {"--jobserver-auth=", "--jobserver-fds="}) {
+      pos = flags.rfind(option);
+      if (pos != string::npos) {
+        pos += option.size();
+        break;
+      }
+    }
+    if (pos == string::npos) continue;
+
+    string auth = flags.substr(pos, flags.find(' ', pos) - pos);
+
+    if (has_prefix(auth, {"fifo:"})) {
+      // Connect to a named pipe
+      auto fifo = auth.substr(5);
+      jobserver_read = open_untraced(fifo, O_RDONLY | O_NONBLOCK);
+      if (jobserver_read != -1) jobserver_write = open_untraced(fifo, O_WRONLY);
+
+    } else if (int r, w; sscanf(auth.c_str(), "%d,%d", &r, &w) == 2) {
+      // Make closes the pipe for commands it does not consider recursive
+      if (syscall_untraced(SYS_fcntl, r, F_GETFD) == -1) continue;
+      if (syscall_untraced(SYS_fcntl, w, F_GETFD) == -1) continue;
+
+      // Reopen the read end so it can be made non-blocking without affecting other jobs
+      jobserver_read = open_untraced("/proc/self/fd/" + std::to_string(r), O_RDONLY | O_NONBLOCK);
+      jobserver_write = w;
+    }
+
+    if (jobserver_read != -1 && jobserver_write != -1) return;
+
+    // Could not connect. Fall back on a local job limit.
+    jobserver_read = jobserver_write = -1;
+  }
+}
+
+/// Try to take a job token without blocking
+bool acquire_token() {
+  char token;
+  if (syscall_untraced(SYS_read, jobserver_read, (long)&token, 1) != 1) return false;
+  jobserver_tokens.push_back(token);
+  return true;
+}
+
+/// Return a job token if this process holds one
+void release_token() {
+  if (jobserver_tokens.empty()) return;
+  syscall_untraced(SYS_write, jobserver_write, (long)&jobserver_tokens.back(), 1);
+  jobserver_tokens.pop_back();
+}
+
+optional<int> link(vector<string> args, vector<string>& tempfiles) {
+  // Create a child process to run the linking step
+  pid_t child_id = fork();
+
+  // Check the return value from fork()
+  if (child_id == -1) {
+    perror("fork failed");
+    return EXIT_FAILURE;
+
+  } else if (child_id == 0) {
+    // In the child. Use execvp to run the linker
+    execvp_untraced(args);
+
+    // Print an error message if the linker did not exec
+    fprintf(stderr, "rkr-wrapper failed to launch %s: ", args[0].c_str());
+    perror("");
+
+    exit(EXIT_FAILURE);
+
+  } else {
+    // In the parent. Wait for the linking stage to finish
+    int status;
+    pid_t rc = wait(&status);
+    if (rc == -1) {
+      perror("wait failed");
+      return EXIT_FAILURE;
+    } else {
+      return WEXITSTATUS(status);
+    }
+  }
+}
+
+/// Run commands in parallel, taking a token for each extra job if there is a jobserver. Returns
+/// an exit code if any of the commands failed.
+optional<int> run_jobs(const vector<vector<string>>& commands) {
+  size_t launched = 0;
+  size_t finished = 0;
+  size_t jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  optional<int> exit_code = nullopt;
+
+  // Set when a job could not be started. Jobs that are already running are still waited for.
+  bool stopped = false;
+
+  while (finished < launched || (!stopped && launched < commands.size())) {
+    // Can we launch a job now? One job can always run on the token this process was started
+    // with. Any more need a token from the jobserver, or room under the local job limit.
+    bool can_launch = false;
+    if (!stopped && launched < commands.size()) {
+      if (launched == finished) {
+        can_launch = true;
+      } else if (jobserver_read != -1) {
+        can_launch = acquire_token();
+      } else {
+        can_launch = launched - finished < jobs;
+      }
+    }
+
+    if (can_launch) {
+      const auto& new_args = commands[launched];
+
+      pid_t child_id = fork();
+      if (child_id == -1) {
+        perror("fork failed");
+        exit_code = EXIT_FAILURE;
+        stopped = true;
+
+        // Give back the token taken for this job, if there was one
+        if (launched != finished) release_token();
+
+      } else if (child_id == 0) {
+        // In the child
+        execvp_untraced(new_args);
+
+        // Print an error message if the tool did not exec
+        fprintf(stderr, "rkr-wrapper failed to launch %s: ", new_args[0].c_str());
+        perror("");
+
+        exit(EXIT_FAILURE);
+
+      } else {
+        // One more job is launched
+        launched++;
+      }
+
+    } else {
+      // We've hit the maximum number of simultaneous jobs. Wait for one
+      int status;
+      if (wait(&status) == -1) {
+        perror("wait failed");
+        exit_code = EXIT_FAILURE;
+        break;
+      }
+
+      // If the child failed, the wrapper should fail too
+      if (WEXITSTATUS(status) != 0) {
+        exit_code = WEXITSTATUS(status);
+      }
+
+      // One more job is finished, and its token can go back to the jobserver
+      finished++;
+      release_token();
+    }
+  }
+
+  // Make sure every token goes back, even if waiting failed
+  while (!jobserver_tokens.empty()) release_token();
+
+  return exit_code;
+}
+
+/// Create an empty temporary file for an intermediate object, named after the file it comes from
+optional<string> make_tempfile(const string& source) {
+  string tempname = fs::path(source).filename().stem().string() + "-XXXXXX.o";
+  string output = (fs::temp_directory_path() / tempname).string();
+  int rc = mkstemps(output.data(), 2);
+  if (rc == -1) {
+    perror("Failed to create temporary file");
+    return nullopt;
+  }
+  close(rc);
+  return output;
+}
+
+/**
+ * Split an assembler invocation with several input files into one parallel job per file, then
+ * combine the objects with `ld -r`. GNU as treats its inputs as one concatenated source, so this
+ * matches only when each file stands on its own; splitting only happens when RKR_SPLIT_AS=1 is
+ * set. Invocations that read stdin, use response files, write dependency files, or pass a target
+ * option ld has no matching emulation for are passed through unchanged.
+ */
 optional<int> assemble(vector<string>& args, vector<string>& tempfiles) {
-  return nullopt;
+  vector<string> as_args;
+  vector<string> source_files;
+
+  // The path to the output file. The assembler writes a.out by default.
+  string output = "a.out";
+
+  // Is it safe to split this invocation? Only try when the user asks for it.
+  const char* split_as = getenv("RKR_SPLIT_AS");
+  bool split = split_as != NULL && string(split_as) == "1";
+
+  // Options ld needs to link objects for the same target the assembler writes
+  vector<string> ld_target;
+
+  // Save the assembler name first
+  as_args.push_back(args[0]);
+
+  for (size_t i = 1; i < args.size(); i++) {
+    const auto& arg = args[i];
+
+    if (arg == "-o" && i + 1 < args.size()) {
+      output = args[++i];
+
+    } else if (one_of(arg, {"-I", "--defsym"}) && i + 1 < args.size()) {
+      // Keep options that take a separate value along with their value
+      as_args.push_back(arg);
+      as_args.push_back(args[++i]);
+
+    } else if (one_of(arg, {"--32", "--x32", "--64"})) {
+      // Select the ld emulation that matches the x86 output format
+      as_args.push_back(arg);
+      if (arg == "--32") {
+        ld_target = {"-m", "elf_i386"};
+      } else if (arg == "--x32") {
+        ld_target = {"-m", "elf32_x86_64"};
+      } else {
+        ld_target = {"-m", "elf_x86_64"};
+      }
+
+    } else if (one_of(arg, {"-EB", "-EL"})) {
+      // Both tools take the same endianness options
+      as_args.push_back(arg);
+      ld_target.push_back(arg);
+
+    } else if (arg == "-" || has_prefix(arg, {"@", "-MD", "--MD"})) {
+      split = false;
+
+    } else if (has_prefix(arg, {"-m"}) && !has_prefix(arg, {"-march=", "-mtune="})) {
+      // Other machine options may change the object format in ways ld can't be told about
+      as_args.push_back(arg);
+      split = false;
+
+    } else if (arg.size() > 0 && arg[0] != '-') {
+      source_files.push_back(arg);
+
+    } else {
+      as_args.push_back(arg);
+    }
+  }
+
+  // Run the assembler in place of this wrapper if there is nothing to split
+  if (!split || source_files.size() < 2) {
+    execvp_untraced(args);
+
+    fprintf(stderr, "rkr-wrapper failed to launch %s: ", args[0].c_str());
+    perror("");
+    return EXIT_FAILURE;
+  }
+
+  // Assemble each source file to its own temporary object
+  vector<vector<string>> jobs;
+  vector<string> objects;
+  for (const auto& source : source_files) {
+    auto object = make_tempfile(source);
+    if (!object.has_value()) return EXIT_FAILURE;
+    tempfiles.push_back(object.value());
+    objects.push_back(object.value());
+
+    vector<string> new_args = as_args;
+    new_args.push_back("-o");
+    new_args.push_back(object.value());
+    new_args.push_back(source);
+    jobs.push_back(new_args);
+  }
+
+  if (auto exit_code = run_jobs(jobs); exit_code.has_value()) return exit_code;
+
+  // Combine the objects into the requested output
+  vector<string> ld_args = {"ld"};
+  ld_args.insert(ld_args.end(), ld_target.begin(), ld_target.end());
+  ld_args.insert(ld_args.end(), {"-r", "-o", output});
+  ld_args.insert(ld_args.end(), objects.begin(), objects.end());
+  return link(ld_args, tempfiles);
 }
 
 optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
@@ -186,19 +506,15 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
       source_files.push_back(arg);
 
       // Create a temporary .o file path
-      string tempname = fs::path(arg).filename().stem().string() + "-XXXXXX.o";
-      string output = (fs::temp_directory_path() / tempname).string();
-      int rc = mkstemps(output.data(), 2);
-      if (rc == -1) {
-        perror("Failed to create temporary file");
-        return EXIT_FAILURE;
-      }
-      close(rc);
+      auto output = make_tempfile(arg);
+      if (!output.has_value()) return EXIT_FAILURE;
 
-      output_files.push_back(output);
+      // The file exists now, so remove it at exit whether or not it ends up being used
+      tempfiles.push_back(output.value());
+      output_files.push_back(output.value());
 
       // Change the args so the linker stage uses the .o file instead of the source file
-      *arg_iter = output;
+      *arg_iter = output.value();
 
     } else {
       compile_args.push_back(arg);
@@ -229,57 +545,19 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
     }
   }
 
-  size_t launched = 0;
-  size_t finished = 0;
-  size_t jobs = 12;
-  optional<int> exit_code = nullopt;
-
-  while (finished < source_files.size()) {
-    // Can we launch a job now?
-    if (launched < source_files.size() && launched - finished < jobs) {
-      vector<string> new_args = compile_args;
-      new_args.push_back("-o");
-      new_args.push_back(output_files[launched]);
-      new_args.push_back("-c");
-      new_args.push_back(source_files[launched]);
-
-      pid_t child_id = fork();
-      if (child_id == -1) {
-        perror("fork failed");
-        return EXIT_FAILURE;
-
-      } else if (child_id == 0) {
-        // In the child
-        execvp_untraced(new_args);
-
-        // Print an error message if the compiler did not exec
-        fprintf(stderr, "rkr-wrapper failed to launch %s: ", new_args[0].c_str());
-        perror("");
-
-        exit(EXIT_FAILURE);
-      }
-
-      // One more job is launched
-      launched++;
-
-    } else {
-      // We've hit the maximum number of simultaneous jobs. Wait for one
-      int status;
-      if (wait(&status) == -1) {
-        perror("wait failed");
-        return EXIT_FAILURE;
-      }
-
-      // If the child failed, the compiler wrapper should fail too
-      if (WEXITSTATUS(status) != 0) {
-        exit_code = WEXITSTATUS(status);
-      }
-
-      // One more job is finished
-      finished++;
-    }
+  // Compile each source file as a separate job
+  vector<vector<string>> jobs;
+  for (size_t i = 0; i < source_files.size(); i++) {
+    vector<string> new_args = compile_args;
+    new_args.push_back("-o");
+    new_args.push_back(output_files[i]);
+    new_args.push_back("-c");
+    new_args.push_back(source_files[i]);
+    jobs.push_back(new_args);
   }
 
+  optional<int> exit_code = run_jobs(jobs);
+
   // If the -c flag was passed in, exit with success unless there was some prior error
   if (compile_flag && !exit_code.has_value()) {
     exit_code = 0;
@@ -288,38 +566,6 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
   return exit_code;
 }
 
-optional<int> link(vector<string> args, vector<string>& tempfiles) {
-  // Create a child process to run the linking step
-  pid_t child_id = fork();
-
-  // Check the return value from fork()
-  if (child_id == -1) {
-    perror("fork failed");
-    return EXIT_FAILURE;
-
-  } else if (child_id == 0) {
-    // In the child. Use execvp to run the linker
-    execvp_untraced(args);
-
-    // Print an error message if the linker did not exec
-    fprintf(stderr, "rkr-wrapper failed to launch %s: ", args[0].c_str());
-    perror("");
-
-    exit(EXIT_FAILURE);
-
-  } else {
-    // In the parent. Wait for the linking stage to finish
-    int status;
-    pid_t rc = wait(&status);
-    if (rc == -1) {
-      perror("wait failed");
-      return EXIT_FAILURE;
-    } else {
-      return WEXITSTATUS(status);
-    }
-  }
-}
-
 /// Break the wrapped compilation into separate, parallel steps
 int main(int argc, char* argv[]) {
   // Process the PATH environment variable. Remove this wrapper from the PATH.
@@ -328,28 +574,39 @@ int main(int argc, char* argv[]) {
   // Make a vector of args
   vector<string> args(argv, argv + argc);
 
+  // Which tool does this wrapper stand in for?
+  string tool = fs::path(args[0]).filename().string();
+
   // Is this a wrapper around clang?
-  is_clang = (args[0] == "clang" || args[0] == "clang++");
+  is_clang = (tool == "clang" || tool == "clang++");
 
   // TODO: if cc or c++ is a link to clang we'd want to detect that
 
+  // Share job slots with make or rkr if either one advertises a jobserver
+  init_jobserver();
+
   // Set up a container for temporary file paths we need to clean up
   vector<string> tempfiles;
 
-  // Run assembly commands
-  optional<int> exit_code = assemble(args, tempfiles);
+  optional<int> exit_code;
+  if (tool == "as") {
+    // Run assembly commands
+    exit_code = assemble(args, tempfiles);
 
-  // Run compilation steps unless assembly exited
-  if (!exit_code.has_value()) {
+  } else {
+    // Run compilation steps
     exit_code = compile(args, tempfiles);
-  }
 
-  // Run the linking step unless compilation exited
-  if (!exit_code.has_value()) {
-    exit_code = link(args, tempfiles);
+    // Run the linking step unless compilation exited
+    if (!exit_code.has_value()) {
+      exit_code = link(args, tempfiles);
+    }
   }
 
-  // TODO: clean up temporary files
+  // Clean up intermediate files
+  for (const auto& f : tempfiles) {
+    unlink(f.c_str());
+  }
 
   // Exit with the provided exit code (or 0 by default)
   return exit_code.value_or(0);
@@ -0,0 +1,32 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output
+
+Make sure the Rikerfile is executable
+  $ chmod u+x Rikerfile
+
+Run the build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+
+Benchmark the saved trace
+  $ rkr bench-trace -n 2
+  Trace: .rkr/db
+    decode   .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    emulate  .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    combine  .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    encode   .* records/sec .* ms/pass \([0-9]+ records\) (re)
+
+Benchmark a synthetic trace
+  $ rkr bench-trace -n 1 --synthetic 20 --inputs 4
+  Synthetic trace: 20 commands, 4 inputs
+    decode   .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    emulate  .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    combine  .* records/sec .* ms/pass \([0-9]+ records\) (re)
+    encode   .* records/sec .* ms/pass \([0-9]+ records\) (re)
+
+Clean up
+  $ rm -rf .rkr output
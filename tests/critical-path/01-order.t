@@ -0,0 +1,42 @@
+Record how long each command runs, and start the command on the longest chain first
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr input *.start
+  $ echo one > input
+
+Run the first build
+  $ rkr
+
+The trace records the run time of each command
+  $ rkr profile | grep "sleep 0.5"
+   +[5-9][0-9]{2}\.[0-9] ms +[5-9][0-9]{2}\.[0-9] ms .*  sleep 0.5 (re)
+
+Change the input both scripts read, so both must run again
+  $ echo two > input
+
+Rebuild with one job slot. The Rikerfile launches ./fast first, but ./slow has the longer
+recorded run time, so it starts first.
+  $ rkr -j1
+  $ test $(cat slow.start) -lt $(cat fast.start) && echo "slow started first"
+  slow started first
+
+The recorded run time carries over to the new trace
+  $ rkr profile | grep "sleep 0.5"
+   +[5-9][0-9]{2}\.[0-9] ms +[5-9][0-9]{2}\.[0-9] ms .*  sleep 0.5 (re)
+
+A trace written by a different version of rkr is discarded, and the build starts over
+  $ rm -f *.start
+  $ printf "old trace" > .rkr/db
+  $ rkr
+  $ ls *.start
+  fast.start
+  slow.start
+
+The new trace loads, so the next build does nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr input *.start
@@ -17,6 +17,10 @@ Look at the first column of the output
   "1"
   "2"
 
+Check that the header includes a call count column for each timer
+  $ head -n 1 stats.csv | tr ',' '\n' | grep -c '_calls"$'
+  9
+
 Run a rebuild
   $ rkr --show --stats stats.csv
 
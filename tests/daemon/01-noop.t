@@ -0,0 +1,47 @@
+This test keeps a build daemon running between builds and checks that it notices changes.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Make sure the Rikerfile is executable
+  $ chmod u+x Rikerfile
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+Start the daemon and wait for its socket to appear
+  $ rkr daemon > /dev/null 2>&1 &
+  $ while [ ! -S .rkr/daemon.sock ]; do sleep 0.1; done
+
+A no-op build does nothing
+  $ rkr --show
+  $ cat output
+  Hello
+
+Change the input. The daemon must not report the build as up to date.
+  $ echo "Goodbye" > input
+  $ rkr --show
+  Rikerfile
+  cat input
+  $ cat output
+  Goodbye
+
+Remove the output. The build must restore it.
+  $ rm output
+  $ rkr --show
+  $ cat output
+  Goodbye
+
+Stop the daemon
+  $ kill $!
+
+Clean up
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
@@ -0,0 +1,48 @@
+Rewrite an uncached output with identical content. With caching off, the output's hash is
+deferred at the end of the build, and must be taken before the rerun overwrites the file.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr input out final
+  $ echo "hello world" > input
+
+Run the first build
+  $ rkr --show --no-caching
+  rkr-launch
+  Rikerfile
+  ./gen
+  cut -c1-5 input
+  cat out
+
+Check the output
+  $ cat final
+  hello
+
+Change the part of the input that cut drops, so the rerun writes the same content
+  $ echo "hello there" > input
+
+Run a rebuild. The consumer of an uncached output must run too.
+  $ rkr --show --no-caching
+  cut -c1-5 input
+  cat out
+
+Check the output
+  $ cat final
+  hello
+
+Run another rebuild, which should do nothing
+  $ rkr --show --no-caching
+
+Touch the output without changing it. Its deferred hash is lost, so cut runs to restore it.
+  $ touch out
+  $ rkr --show --no-caching
+  cut -c1-5 input
+  cat out
+
+Run another rebuild, which should do nothing
+  $ rkr --show --no-caching
+
+Clean up
+  $ rm -rf .rkr input out final
@@ -0,0 +1,68 @@
+Rerun the top-level command while its descendants are skipped. The steps of skipped descendants
+are deferred until the rerun command launches them, and must be replayed in their original order.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr banner a-out b-out both
+  $ echo "hello" > config
+  $ echo "A" > a
+  $ echo "B" > b
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  ./outer
+  cat a
+  ./inner
+  cat b
+  cat a-out b-out
+
+Check the output
+  $ cat banner both
+  hello
+  A
+  B
+
+Change the input read by the top-level command
+  $ echo "goodbye" > config
+
+Run a rebuild, which should run only the top-level command
+  $ rkr --show
+  Rikerfile
+
+Check the output
+  $ cat banner both
+  goodbye
+  A
+  B
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Change the top-level input and an input read by a nested command
+  $ echo "hello" > config
+  $ echo "C" > b
+
+Run a rebuild, which should run the nested command and the command that uses its output
+  $ rkr --show
+  Rikerfile
+  cat b
+  cat a-out b-out
+
+Check the output
+  $ cat banner both
+  hello
+  A
+  C
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr banner a-out b-out both
+  $ echo "hello" > config
+  $ echo "A" > a
+  $ echo "B" > b
@@ -0,0 +1,20 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf jobs .rkr Rikerfile
+  $ cp basic-Rikerfile Rikerfile
+
+Run riker with a job limit
+  $ rkr -j4
+
+Commands can find the jobserver rkr created
+  $ cat jobs
+  -j4
+
+The jobserver is removed at the end of the build
+  $ test -e .rkr/jobserver
+  [1]
+
+Cleanup
+  $ rm -rf jobs .rkr Rikerfile
@@ -0,0 +1,32 @@
+Run a three-command pipeline with two job slots. The pipeline moves more data than a pipe can
+buffer, so every stage must run at once.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf input output .rkr Rikerfile
+  $ cp pipeline-Rikerfile Rikerfile
+  $ seq 100000 > input
+
+Run the first build
+  $ rkr -j2
+
+Check the output
+  $ wc -l < output
+  100000
+
+Change the input so the pipeline reruns from an emulated Rikerfile, which holds its commands
+until they get a job slot
+  $ seq 100001 > input
+  $ rkr -j2 --show
+  cat input
+  tr 0-9 a-j
+  sort
+
+Check the output
+  $ wc -l < output
+  100001
+
+Cleanup
+  $ rm -rf input output .rkr Rikerfile
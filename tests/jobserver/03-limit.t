@@ -0,0 +1,24 @@
+Check that a job limit bounds the number of commands running at once
+
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf input *.start *.end .rkr Rikerfile
+  $ cp limit-Rikerfile Rikerfile
+  $ echo one > input
+
+Run the first build
+  $ rkr
+
+Change the input so all four jobs rerun from an emulated Rikerfile
+  $ echo two > input
+  $ rkr -j2
+
+Count the most jobs that ran at the same time
+  $ for i in 1 2 3 4; do echo "$(cat $i.start) 1"; echo "$(cat $i.end) -1"; done |
+  >   sort -n | awk '{ n += $2; if (n > max) max = n } END { print max }'
+  2
+
+Cleanup
+  $ rm -rf input *.start *.end .rkr Rikerfile
@@ -0,0 +1,23 @@
+Compile through the parallel wrapper without the injected library. The wrapper cannot hide job
+token traffic from rkr then, so it must not use the jobserver at all.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf *.o .rkr Rikerfile
+  $ cp compile-Rikerfile Rikerfile
+
+Run the first build
+  $ rkr -j2 --no-inject --wrapper
+
+Both objects were compiled
+  $ nm one.o two.o | grep " T "
+  0000000000000000 T one
+  0000000000000000 T two
+
+Nothing reruns, so the compile did not depend on the jobserver
+  $ rkr -j2 --no-inject --wrapper --show
+
+Cleanup
+  $ rm -rf *.o .rkr Rikerfile
@@ -0,0 +1,31 @@
+Restore many outputs from the cache at once, which commits them on worker threads
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr out
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir -p out
+
+Remove every output file
+  $ rm out/*
+
+Run a rebuild with timing stats, which should only restore the files from the cache
+  $ rkr --show --timing-stats | grep -v "^  "
+  Time by Subsystem:
+
+The output files should be back
+  $ cat out/1 out/8 out/16
+  file 1
+  file 8
+  file 16
+  $ ls out | wc -l
+  16
+
+Clean up
+  $ rm -rf .rkr out
@@ -0,0 +1,30 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output copy Rikerfile
+  $ cp basic-Rikerfile Rikerfile
+
+Run the build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat output
+
+Profile the saved trace
+  $ rkr profile | head -n 8
+  Build Profile:
+    Commands: [0-9]+ (re)
+    Command time: .* \(.* CPU\) (re)
+    Emulation time: .* \([0-9]+ steps\) (re)
+    Traced syscalls: [0-9]+ (re)
+    Ptrace stops: [0-9]+ (re)
+  
+  Critical Path: .* (re)
+
+List only the two slowest commands
+  $ rkr profile -n 2 | sed -n '/^Commands by Self Time:/,$p' | wc -l | tr -d ' '
+  4
+
+Clean up
+  $ rm -rf .rkr output copy Rikerfile
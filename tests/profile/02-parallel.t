@@ -0,0 +1,19 @@
+Children that run in parallel are only subtracted once from their parent's self time
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr Rikerfile
+  $ cp parallel-Rikerfile Rikerfile
+
+Run the build
+  $ rkr
+
+The Rikerfile spent about 0.3 seconds on its own, even though its children's run times add up to
+more than its own
+  $ rkr profile | sed -n '/^Commands by Self Time:/,$p' | grep " Rikerfile$"
+   +[2-4][0-9]{2}\.[0-9] ms .*  Rikerfile (re)
+
+Clean up
+  $ rm -rf .rkr Rikerfile
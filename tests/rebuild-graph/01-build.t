@@ -0,0 +1,94 @@
+Run rebuilds over a diamond of commands followed by a chain. The top command reads input, two
+commands summarize its output, one command joins the summaries, and two commands copy the result.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr top left right bottom chain1 chain2
+  $ echo "hello" > input
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+  grep -c l top
+  wc -c
+  cat left right
+  cat bottom
+  cat chain1
+
+Check the output
+  $ cat chain2
+  1
+  6
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Change the input without changing either summary
+  $ echo "hallo" > input
+
+Run a rebuild, which should stop at the two sides of the diamond
+  $ rkr --show
+  cat input
+  grep -c l top
+  wc -c
+
+Check the output
+  $ cat chain2
+  1
+  6
+
+Change the input so only one summary changes
+  $ echo "hell" > input
+
+Run a rebuild, which should run the join and the whole chain after it
+  $ rkr --show
+  cat input
+  grep -c l top
+  wc -c
+  cat left right
+  cat bottom
+  cat chain1
+
+Check the output
+  $ cat chain2
+  1
+  5
+
+Change the input so both summaries change
+  $ echo "abc" > input
+
+Run a rebuild, which should run the join and the chain only once
+  $ rkr --show
+  cat input
+  grep -c l top
+  wc -c
+  cat left right
+  cat bottom
+  cat chain1
+
+Check the output
+  $ cat chain2
+  0
+  4
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Remove an output from the middle of the chain
+  $ rm chain1
+
+Run a rebuild, which should only restore the output from the cache
+  $ rkr --show
+
+Check the output
+  $ cat chain1
+  0
+  4
+
+Clean up
+  $ rm -rf .rkr top left right bottom chain1 chain2
+  $ echo "hello" > input
@@ -0,0 +1,47 @@
+Run rebuilds over the same graph with caching disabled. Uncached outputs turn every consumer of a
+command that must run into a command that must run, so the whole graph runs.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr top left right bottom chain1 chain2
+  $ echo "hello" > input
+
+Run the first build
+  $ rkr --show --no-caching
+  rkr-launch
+  Rikerfile
+  cat input
+  grep -c l top
+  wc -c
+  cat left right
+  cat bottom
+  cat chain1
+
+Run a rebuild, which should do nothing
+  $ rkr --show --no-caching
+
+Change the input without changing either summary
+  $ echo "hallo" > input
+
+Run a rebuild, which should run every command below the input once
+  $ rkr --show --no-caching
+  cat input
+  grep -c l top
+  wc -c
+  cat left right
+  cat bottom
+  cat chain1
+
+Check the output
+  $ cat chain2
+  1
+  6
+
+Run a rebuild, which should do nothing
+  $ rkr --show --no-caching
+
+Clean up
+  $ rm -rf .rkr top left right bottom chain1 chain2
+  $ echo "hello" > input
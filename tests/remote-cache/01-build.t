@@ -0,0 +1,41 @@
+This test runs a build with a remote cache daemon, then restores an output using only the remote copy.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr hello remote-store cache.sock
+
+Copy in the Rikerfile
+  $ cp hello-Rikerfile Rikerfile
+
+Start a cache daemon and wait for its socket to appear
+  $ rkr-cache-server cache.sock remote-store > /dev/null 2>&1 &
+  $ while [ ! -S cache.sock ]; do sleep 0.1; done
+
+Run the build
+  $ rkr --show --no-wrapper --remote-cache cache.sock
+  rkr-launch
+  Rikerfile
+  gcc -o hello hello.c
+  [^ ]*cc1 .* (re)
+  [^ ]*as .* (re)
+  [^ ]*collect2 .* (re)
+  [^ ]*ld .* (re)
+
+The daemon should now hold a copy of the output
+  $ find remote-store -type f | grep -q .
+
+Remove the output and the local cache
+  $ rm -rf hello .rkr/cache
+
+Run a rebuild, which should restore the output
+  $ rkr --no-wrapper --remote-cache cache.sock
+
+Make sure the hello executable works
+  $ ./hello
+  Hello world
+
+Stop the daemon and clean up
+  $ kill $!
+  $ rm -rf .rkr Rikerfile hello remote-store cache.sock
@@ -0,0 +1,26 @@
+This test writes the same content to three outputs and makes sure it is uploaded only once.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr one two three remote-store cache.sock
+
+Copy in the Rikerfile
+  $ cp dup-Rikerfile Rikerfile
+
+Start a cache daemon and wait for its socket to appear
+  $ rkr-cache-server cache.sock remote-store > /dev/null 2>&1 &
+  $ while [ ! -S cache.sock ]; do sleep 0.1; done
+
+Run the build and count uploads to the remote cache
+  $ rkr --no-wrapper --remote-cache cache.sock --no-color --log cache 2>&1 | grep -c "Uploaded"
+  1
+
+The daemon should hold one copy of the content
+  $ find remote-store -type f | wc -l
+  1
+
+Stop the daemon and clean up
+  $ kill $!
+  $ rm -rf .rkr Rikerfile one two three remote-store cache.sock
@@ -0,0 +1,41 @@
+This test traces a build with seccomp notifications instead of ptrace stops.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Copy in the basic Rikerfile and make sure it's executable
+  $ cp basic-Rikerfile Rikerfile
+  $ chmod u+x Rikerfile
+
+Run the first build without the injected library, so every traced call uses notifications or ptrace
+  $ rkr --show --no-inject --seccomp-notify
+  rkr-launch
+  Rikerfile
+  cat input
+  $ cat output
+  Hello
+  no missing file
+
+A rebuild does nothing
+  $ rkr --show --no-inject --seccomp-notify
+
+Change the input and rebuild
+  $ echo "Goodbye" > input
+  $ rkr --show --no-inject --seccomp-notify
+  Rikerfile
+  cat input
+  $ cat output
+  Goodbye
+  no missing file
+
+Run a full build with system call stats to check that notifications were handled
+  $ rkr --fresh --no-inject --seccomp-notify --syscall-stats | grep "seccomp notification"
+  [1-9][0-9]*/[0-9]+ \([0-9]+%\) syscalls handled by seccomp notification (re)
+
+Clean up
+  $ rm -rf .rkr output Rikerfile
+  $ echo "Hello" > input
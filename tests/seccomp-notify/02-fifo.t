@@ -0,0 +1,20 @@
+This test opens both ends of a FIFO from two traced commands. With seccomp notifications, each
+blocking open must be answered without stopping the tracer from serving the other end.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output pipe
+
+Copy in the FIFO Rikerfile and make sure it's executable
+  $ cp fifo-Rikerfile Rikerfile
+  $ chmod u+x Rikerfile
+
+Run the build
+  $ rkr --no-inject --seccomp-notify
+  $ cat output
+  through a fifo
+
+Clean up
+  $ rm -rf .rkr output pipe Rikerfile
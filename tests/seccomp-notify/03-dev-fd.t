@@ -0,0 +1,27 @@
+This test opens files through /dev/fd, /dev/stdin, and paths that reach /proc/self indirectly. With
+seccomp notifications, the tracer runs these opens, so they must reach the tracee's files instead of
+rkr's.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output link
+  $ echo "Hello" > input
+
+Copy in the /dev/fd Rikerfile and make sure it's executable
+  $ cp dev-fd-Rikerfile Rikerfile
+  $ chmod u+x Rikerfile
+
+Run the build
+  $ rkr --no-inject --seccomp-notify
+  $ cat output
+  Hello
+  Hello
+  Hello
+  Hello
+  Hello
+  Hello
+
+Clean up
+  $ rm -rf .rkr output link Rikerfile
@@ -0,0 +1,21 @@
+This test creates files under different umasks. With seccomp notifications, supervisor threads
+create these files, so each one must get the umask of the tracee that asked for it.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr private shared
+
+Copy in the umask Rikerfile and make sure it's executable
+  $ cp umask-Rikerfile Rikerfile
+  $ chmod u+x Rikerfile
+
+Run the build with a umask that differs from the one the build sets for its second file
+  $ (umask 077 && rkr --no-inject --seccomp-notify)
+  $ stat -c %a private shared
+  600
+  644
+
+Clean up
+  $ rm -rf .rkr private shared Rikerfile
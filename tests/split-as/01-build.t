@@ -0,0 +1,39 @@
+Split multi-file assembler calls into parallel jobs
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr *.o ld.log
+
+Run the build
+  $ rkr --wrapper
+
+Only the split calls combine their objects with ld, which is told to link for the same target
+  $ cat ld.log
+  ld -r -o both.o */a-*.o */b-*.o (glob)
+  ld -m elf_i386 -r -o both32.o */a-*.o */b-*.o (glob)
+
+The temporary objects are gone
+  $ ls $(grep -o '/[^ ]*-[^ ]*\.o' ld.log) 2>/dev/null | wc -l
+  0
+
+The combined objects define both symbols
+  $ nm both.o
+  0000000000000000 T sym_a
+  0000000000000001 T sym_b
+
+  $ nm both32.o
+  00000000 T sym_a
+  00000001 T sym_b
+
+  $ readelf -h both32.o | grep Class
+    Class:                             ELF32
+
+The unsplit call produces the same symbols
+  $ nm single.o
+  0000000000000000 T sym_a
+  0000000000000001 T sym_b
+
+Clean up
+  $ rm -rf .rkr *.o ld.log
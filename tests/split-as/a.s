@@ -0,0 +1,4 @@
+	.text
+	.globl	sym_a
+sym_a:
+	ret
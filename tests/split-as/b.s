@@ -0,0 +1,4 @@
+	.text
+	.globl	sym_b
+sym_b:
+	ret
@@ -0,0 +1,51 @@
+This test checks that a no-op build saves a summary, and that the summary notices changes.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Make sure the Rikerfile is executable
+  $ chmod u+x Rikerfile
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+Wait so the build's outputs are older than the next build
+  $ sleep 2
+
+A no-op build does nothing, but saves a summary
+  $ rkr --show
+  $ test -f .rkr/summary
+
+A second no-op build is answered by the summary
+  $ rkr --show
+  $ cat output
+  Hello
+
+Change the input. The summary must not report the build as up to date.
+  $ echo "Goodbye" > input
+  $ rkr --show
+  Rikerfile
+  cat input
+  $ cat output
+  Goodbye
+  $ test -f .rkr/summary
+  [1]
+
+Remove the output. The build must restore it.
+  $ sleep 2
+  $ rkr --show
+  $ rm output
+  $ rkr --show
+  $ cat output
+  Goodbye
+
+Clean up
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
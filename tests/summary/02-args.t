@@ -0,0 +1,28 @@
+This test checks that a summary only answers builds with the same Rikerfile arguments.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Make sure the Rikerfile is executable
+  $ chmod u+x Rikerfile
+
+Run the first build with one argument, then a no-op build that saves a summary
+  $ rkr --args one
+  $ sleep 2
+  $ rkr --args one
+  $ test -f .rkr/summary
+
+The summary answers a build with the same argument
+  $ rkr --no-color --log phase --args one 2>&1 | grep "Build summary"
+  (phase) Build summary matched * paths (glob)
+
+A build with a different argument does not use the summary
+  $ rkr --no-color --log phase --args two 2>&1 | grep "Build summary"
+  (phase) Build summary was saved for different arguments or options
+
+Clean up
+  $ rm -rf .rkr output
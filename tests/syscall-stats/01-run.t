@@ -0,0 +1,26 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf myfile stats.csv .rkr
+
+Write system call latencies to a CSV file. Tracing every call with ptrace keeps the counts stable.
+  $ rkr --fresh --no-inject --syscall-stats-csv stats.csv > /dev/null
+
+The CSV file has a header row
+  $ head -n 1 stats.csv
+  syscall,path,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+
+The CSV file includes rare system calls, even though the printed stats leave them out
+  $ grep -c "^execve,ptrace," stats.csv
+  1
+  $ rkr --fresh --no-inject --syscall-stats | grep -c "execve (ptrace"
+  0
+  [1]
+
+Lowering the threshold prints them
+  $ rkr --fresh --no-inject --syscall-stats --syscall-stats-min 0 | grep -c "execve (ptrace"
+  [1-9][0-9]* (re)
+
+Cleanup
+  $ rm -rf myfile stats.csv .rkr
@@ -0,0 +1,39 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Cleanup
+  $ rm -rf myfile timeline.json .rkr
+
+Run riker and record a timeline
+  $ rkr --show --timeline timeline.json
+  rkr-launch
+  Rikerfile
+  touch myfile
+
+The timeline is a JSON array of events
+  $ head -c 1 timeline.json
+  [ (no-eol)
+  $ tail -n 1 timeline.json
+  ]
+
+Each build phase has a span
+  $ grep -o '"name":"phase [0-9]*","ph":"X"' timeline.json
+  "name":"phase 0","ph":"X"
+  "name":"phase 1","ph":"X"
+  "name":"phase 2","ph":"X"
+
+The traced commands have spans on their own tracks
+  $ grep -c '"cat":"command"' timeline.json
+  [1-9][0-9]* (re)
+
+Ptrace stops are recorded as instant events
+  $ grep -q '"name":"ptrace stop","ph":"i"' timeline.json
+
+An up-to-date build still records a timeline
+  $ rm timeline.json
+  $ rkr --show --timeline timeline.json
+  $ grep -o '"name":"phase 0","ph":"X"' timeline.json
+  "name":"phase 0","ph":"X"
+
+Cleanup
+  $ rm -rf myfile timeline.json .rkr
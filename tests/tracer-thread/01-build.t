@@ -0,0 +1,42 @@
+This test gathers tracing events on a separate thread.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output twice
+  $ echo "Hello" > input
+
+Make sure the Rikerfile is executable
+  $ chmod u+x Rikerfile
+
+Run the first build
+  $ rkr --show --tracer-thread
+  rkr-launch
+  Rikerfile
+  cat input
+  cat input
+  cat input
+  $ cat output twice
+  Hello
+  Hello
+  Hello
+
+A rebuild does nothing
+  $ rkr --show --tracer-thread
+
+Change the input and rebuild, this time with seccomp notifications as well
+  $ echo "Goodbye" > input
+  $ rkr --show --tracer-thread --seccomp-notify
+  Rikerfile
+  cat input
+  cat input
+  cat input
+  $ cat output twice
+  Goodbye
+  Goodbye
+  Goodbye
+
+Clean up
+  $ rm -rf .rkr output twice
+  $ echo "Hello" > input